@@ -7,8 +7,15 @@
  */
 #define _GNU_SOURCE
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
 #include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "common_toolx.h"
 
@@ -154,3 +161,191 @@ int parse_mem_size_str(char * mem_size_str, unsigned long long * mem_size)
 	return 0;
 }
 
+/* see header file for help */
+int calibrate_rdtsc(unsigned long long *hz)
+{
+	static unsigned long long cached_hz = 0;
+	struct timespec ts, te, sleep_ts = {0, 10000000};
+	unsigned long long cs, ce, ns;
+
+	if(hz == NULL)
+		return 1;
+
+	if(cached_hz == 0){
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		cs = rdtsc();
+		nanosleep(&sleep_ts, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &te);
+		ce = rdtsc();
+
+		ns = (te.tv_sec - ts.tv_sec) * 1000000000ULL + 
+			te.tv_nsec - ts.tv_nsec;
+		cached_hz = (unsigned long long)
+			((double)(ce - cs) * 1000000000.0 / ns);
+	}
+
+	*hz = cached_hz;
+	return 0;
+}
+
+/* see header file for help */
+int map_shared_mem(const char *name, int flags, size_t *size, int *fd, 
+		   void **mem)
+{
+	int oflags = O_RDWR;
+	int ret_val = 0;
+
+	*mem = MAP_FAILED;
+	if(flags & CTX_SHM_CREATE)
+		oflags |= O_CREAT | O_EXCL;
+
+	// open the shared memory
+	if(flags & CTX_SHM_FILE)
+		*fd = open(name, oflags, S_IRUSR | S_IWUSR);
+	else
+		*fd = shm_open(name, oflags, S_IRUSR | S_IWUSR);
+	if(*fd == -1){
+		CTX_DPRINTF("Cannot create shared memory %s: %s\n", name, 
+			    strerror(errno));
+		return 1;
+	}
+
+	// get the correct size of the shared memory
+	if(flags & CTX_SHM_CREATE){
+		// new shared memory, we need to change its size
+		if(flags & CTX_SHM_HUGEPAGE)
+			*size = (*size + CTX_HUGEPAGE_SIZE - 1) & 
+				~(CTX_HUGEPAGE_SIZE - 1);
+		ret_val = ftruncate(*fd, *size);
+		if(ret_val != 0){
+			CTX_DPRINTF("Cannot re-size shared memory %s: %s\n", 
+				    name, strerror(errno));
+			ret_val = 2;
+			goto error;
+		}
+	}
+	else{
+		// existing shared memory, we need to get its size
+		struct stat s;
+		ret_val = fstat(*fd, &s);
+		if(ret_val != 0){
+			CTX_DPRINTF("Cannot fstat shared memory %s: %s\n", 
+				    name, strerror(errno));
+			ret_val = 3;
+			goto error;
+		}
+		*size = s.st_size;
+	}	
+
+	// map the shared memory
+	*mem = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+	if(*mem == MAP_FAILED){
+		CTX_DPRINTF("Cannot map shared memory %s: %s\n", name, 
+			    strerror(errno));
+		ret_val = 4;
+		goto error;
+	}
+	// only a hint, huge pages may be disabled for shared memory
+	if((flags & CTX_SHM_HUGEPAGE) && 
+	   madvise(*mem, *size, MADV_HUGEPAGE) != 0)
+		CTX_DPRINTF("Cannot use huge pages for %s: %s\n", name, 
+			    strerror(errno));
+	
+	return 0;
+
+ error:
+	close(*fd);
+	*fd = -1;
+	return ret_val;
+}
+
+/* see header file for help */
+int unmap_shared_mem(void *mem, size_t size, int fd)
+{
+	int ret_val = 0;
+
+	if(mem != MAP_FAILED && mem != NULL){
+		ret_val = munmap(mem, size);
+		if(ret_val != 0)
+			CTX_DPRINTF("Cannot un-map shared memory: %s\n",
+				    strerror(errno));
+	}
+	
+	if(fd != -1){
+		ret_val = close(fd);
+		if(ret_val != 0)
+			CTX_DPRINTF("Cannot close shared memory: %s\n", 
+				    strerror(errno));
+	}
+	
+	return ret_val;
+}
+
+/* see header file for help */
+int bind_shared_mem(void *mem, size_t size, int node)
+{
+	// MPOL_BIND of <numaif.h>, without depending on libnuma
+	const int mpol_bind = 2;
+	unsigned long mask[(CTX_MAX_NUMA_NODES + 8 * sizeof(long) - 1) / 
+			   (8 * sizeof(long))] = {0};
+
+	if(mem == NULL || mem == MAP_FAILED || node < 0 || 
+	   node >= CTX_MAX_NUMA_NODES){
+		CTX_LOGERR("wrong parameters: mem (%p), node (%d)\n", mem, node);
+		return 1;
+	}
+
+	mask[node / (8 * sizeof(long))] = 1UL << (node % (8 * sizeof(long)));
+	if(syscall(SYS_mbind, mem, size, mpol_bind, mask, 
+		   CTX_MAX_NUMA_NODES + 1, 0) != 0){
+		CTX_DPRINTF("Cannot bind memory to node %d: %s\n", node, 
+			    strerror(errno));
+		return 2;
+	}
+
+	return 0;
+}
+
+/* see header file for help */
+int prefault_shared_mem(void *mem, size_t size, int lock)
+{
+	size_t i;
+	long page_size = sysconf(_SC_PAGESIZE);
+	volatile unsigned char *p = mem;
+
+	if(mem == NULL || mem == MAP_FAILED){
+		CTX_LOGERR("wrong parameters: mem (%p)\n", mem);
+		return 1;
+	}
+
+	// locking faults the pages in as well
+	if(lock){
+		if(mlock(mem, size) != 0){
+			CTX_DPRINTF("Cannot lock memory: %s\n", strerror(errno));
+			return 2;
+		}
+		return 0;
+	}
+
+	// write every page, so that it is not mapped to the zero page
+	for(i = 0; i < size; i += page_size)
+		p[i] = p[i];
+
+	return 0;
+}
+
+/* see header file for help */
+int destroy_shared_mem(const char *name, int flags)
+{
+	int ret_val;
+
+	if(flags & CTX_SHM_FILE)
+		ret_val = unlink(name);
+	else
+		ret_val = shm_unlink(name);
+	if(ret_val != 0)
+		CTX_DPRINTF("Cannot destroy shared memory %s: %s\n", name, 
+			    strerror(errno));
+
+	return ret_val;
+}
@@ -9,6 +9,8 @@
 #define __COMMON_TOOLX_H__
 
 #include <sys/syscall.h>
+#include <sys/types.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -55,6 +57,76 @@ pid_t gettid();
 int parse_mem_size_str(char * mem_size_str, unsigned long long * mem_size);
 
 
+/*
+ * Map a named shared memory object, or a file, into memory. The object is
+ * mapped shared and read-write.
+ *
+ * Parameters:
+ *     name       --> the name of the shared memory object (with a leading
+ *                    slash), or the path of the file if CTX_SHM_FILE is set
+ *     flags      --> CTX_SHM_CREATE: create a new object of *size bytes, 
+ *                                    fail if it exists
+ *                    CTX_SHM_FILE: name is a regular file
+ *                    CTX_SHM_HUGEPAGE: ask for transparent huge pages; the
+ *                                      size of a new object is rounded up
+ *                                      to CTX_HUGEPAGE_SIZE
+ *     size       --> the size of the new object; for an existing object, 
+ *                    the size of the object is returned here
+ *     fd         --> the file descriptor of the object
+ *     mem        --> the address of the mapping
+ * Return value:
+ *     0  --> success
+ *     1  --> cannot open the object
+ *     2  --> cannot resize the new object
+ *     3  --> cannot get the size of the existing object
+ *     4  --> cannot map the object
+ */
+#define CTX_SHM_CREATE 0x1
+#define CTX_SHM_FILE 0x2
+#define CTX_SHM_HUGEPAGE 0x4
+#define CTX_HUGEPAGE_SIZE (2UL << 20)
+int map_shared_mem(const char *name, int flags, size_t *size, int *fd, 
+		   void **mem);
+
+/*
+ * Unmap and close an object mapped by map_shared_mem. mem can be MAP_FAILED
+ * and fd can be -1, in which case they are skipped.
+ * Return value:
+ *     0  --> success
+ *     other --> failed, check errno for reasons
+ */
+int unmap_shared_mem(void *mem, size_t size, int fd);
+
+/*
+ * Bind the pages of a mapping to a NUMA node. Call it before the pages are
+ * touched; pages already faulted in are not moved.
+ * Return value:
+ *     0  --> success
+ *     1  --> wrong parameters
+ *     2  --> the binding failed, check errno for reasons
+ */
+#define CTX_MAX_NUMA_NODES 1024
+int bind_shared_mem(void *mem, size_t size, int node);
+
+/*
+ * Fault in all pages of a mapping, and optionally lock them in memory, so
+ * that the first accesses do not take page faults.
+ * Return value:
+ *     0  --> success
+ *     1  --> wrong parameters
+ *     2  --> cannot lock the pages, check errno for reasons
+ */
+int prefault_shared_mem(void *mem, size_t size, int lock);
+
+/*
+ * Remove a named shared memory object, or a file if CTX_SHM_FILE is set in
+ * flags. Existing mappings stay valid.
+ * Return value:
+ *     0  --> success
+ *     other --> failed, check errno for reasons
+ */
+int destroy_shared_mem(const char *name, int flags);
+
 /* 
  * Compilation time controlled debug output
  */
@@ -99,8 +171,32 @@ static __inline__ unsigned long long rdtsc(void)
         __asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
           return ( (unsigned long long)lo)|( ((unsigned long long)hi)<<32 );
 }
+#else
+/* no time stamp counter, count nanoseconds of the monotonic clock instead */
+#include <time.h>
+static __inline__ unsigned long long rdtsc(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 #endif
 
+/*
+ * Measure the frequency of the time stamp counter against the monotonic 
+ * clock. The measurement takes about 10 milliseconds on the first call, and 
+ * the result is cached for later calls. An invariant (constant rate) TSC is 
+ * assumed.
+ *
+ * Parameters:
+ *     hz    --> the number of rdtsc cycles per second
+ * Return value:
+ *     0  --> success
+ *     1  --> hz is NULL
+ */
+int calibrate_rdtsc(unsigned long long *hz);
+
 /*
  * my own boolean type; for non-C99 compile
  */
@@ -1,6 +1,76 @@
 /*
  * Implementation of the messageQx. This is a typical implementation of the 
- * producer and consumer problem using semaphores and shared memory.
+ * producer and consumer problem using shared memory. All the synchronization
+ * state lives in the shared memory, so no named kernel object other than the
+ * shared memory itself is needed.
+ *
+ * In the locked mode, the ring buffer is protected by a futex lock. The queue
+ * may have several priority lanes, each a ring of its own; receivers take the
+ * messages of the first non-empty lane, unless a lower lane has been passed
+ * over too many times.
+ *
+ * In the SPSC mode, the sender owns the tail index and the receiver owns the
+ * head index. Each index lives on its own cache line and is published with
+ * release/acquire atomics, so a message is handed over without any lock.
+ *
+ * The MPMC mode is a bounded queue with a sequence number in every slot
+ * (D. Vyukov's design). Senders claim a position by advancing the tail with
+ * a CAS, fill the slot and publish it by setting its sequence number to
+ * position + 1; receivers claim the head the same way and hand the slot back
+ * to the senders of the next lap by setting its sequence to position + qlen.
+ *
+ * The variable-length mode is a byte ring protected by the futex lock. Each
+ * message is a length header followed by the message, padded to 8 bytes, and
+ * the head and tail positions count bytes. A message that does not fit before
+ * the end of the ring is written at its beginning, after a wrap marker in
+ * place of a header.
+ *
+ * The broadcast mode is a ring with one sender and a fixed number of
+ * subscriber cursors, which live after the ring. Every subscriber receives
+ * every message sent after it subscribed, and the sender is gated by the
+ * slowest subscriber, or drops it if the queue is created with
+ * MSGQX_DROP_SLOW. A dropped subscriber checks its state after copying a
+ * message, so a message overwritten while it was being copied is discarded.
+ *
+ * The lossy mode has one sender that never waits: it overwrites the oldest
+ * slot when the queue is full. Every slot carries a sequence number, odd
+ * while the sender writes the slot, like a seqlock. A receiver claims the
+ * head with a CAS after it has copied a message and found the sequence 
+ * unchanged; a message overwritten before it is received is skipped, and
+ * counted as dropped.
+ *
+ * The journal mode keeps the messages in segment files mapped into memory,
+ * and a meta file with the number of messages appended and the offset of 
+ * every consumer. All of them are changed under the futex lock of the queue
+ * in shared memory, and synced to disk together, at most every sync 
+ * interval, so many messages share one sync.
+ *
+ * The receivers of a queue can also wait on an eventfd, e.g., in an epoll
+ * loop. A receiver that finds the queue empty arms the notify flag of the
+ * head, and the sender that sees the flag armed clears it and signals the
+ * eventfd, so only the empty to non-empty transitions are signaled.
+ *
+ * A queue in the locked or the variable-length mode can be resized. The
+ * resizer takes the lock, copies the messages into a new segment of the next
+ * generation, records that generation in the first segment (the one with the
+ * name of the queue) and marks the old segment as moved. The ring of the old
+ * segment is then truncated away. A handle notices the mark the next time it
+ * takes the lock, maps the newest generation and starts over.
+ *
+ * A sender can also coalesce its messages in a buffer of its handle, and
+ * publish them with one batch send when the buffer is full, when the oldest
+ * message has waited for the coalescing delay, or on msgqx_flush.
+ *
+ * A queue can have a payload pool, a second shared memory object with a slab
+ * of equally sized buffers. The free buffers are kept in a lock-free stack
+ * whose top carries an ABA tag, and each buffer has a reference count, so
+ * only a small descriptor goes through the queue.
+ *
+ * Senders wait at the tail end when the queue is full, and receivers wait at
+ * the head end when it is empty. A waiter first retries for a while, then
+ * counts itself as waiting and sleeps on the event futex of its end. The other
+ * side only bumps the event and calls the kernel when it sees a waiter, so no
+ * system call is made while the queue is neither empty nor full.
  * 
  * Author: Wei Wang <wwang@virginia.edu>
  */
@@ -8,14 +78,18 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-// for semaphores and shared memory
+// for shared memory and futexes
 #include <fcntl.h>           /* For O_* constants */
 #include <sys/stat.h>        /* For mode constants */
-#include <semaphore.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <time.h>
+#include <limits.h>
+#include <stddef.h>
+#include <sys/eventfd.h>
 
 // for error reporting
 #include <string.h>
@@ -24,40 +98,182 @@
 #include "common_toolx.h"
 #include "messageQx.h"
 
+// kernel headers before 5.16 have no futex_waitv; the call then fails with
+// ENOSYS, and the queues are polled instead
+#ifndef FUTEX_32
+struct futex_waitv{
+	unsigned long long val;
+	unsigned long long uaddr;
+	unsigned int flags;
+	unsigned int __reserved;
+};
+#define FUTEX_32 2
+#endif
+
+#define MSGQX_CACHE_LINE 64
+#define MSGQX_MAGIC 0x4d534751 // "MSGQ", set once the queue is initialized
+
+// one end of the queue, senders wait at the tail and receivers at the head
+struct msgqx_index{
+	unsigned long long pos; // messages sent (tail) or received (head)
+	unsigned int event; // futex word, bumped to wake up the waiters
+	unsigned int waiting; // the number of waiters sleeping on event
+	unsigned int notify; // signal the eventfd on the next message (head)
+};
+
+// statistics kept by a group of handles, see struct msgqx_stats
+struct msgqx_stat_slot{
+	unsigned long long msgs[2]; // messages sent and received
+	unsigned long long waits[2]; // waits of senders and receivers
+	unsigned long long wait_us[2]; // the total time of the waits
+	unsigned long long hist[2][MSGQX_STAT_BUCKETS];
+}__attribute__((aligned(MSGQX_CACHE_LINE)));
+
+#define MSGQX_STAT_SEND 0
+#define MSGQX_STAT_RECV 1
+#define MSGQX_STAT_SLOTS 8 // handles share a slot round robin
+
 // the structure of the message queue
 typedef struct _msgqx_queue{
+	unsigned int magic; // MSGQX_MAGIC once the queue is initialized
 	int msg_size; // the size of each message
 	int qlen; // the length of the queue; the queue is implemented as a
 	          // ring buffer
-	int first; // the index of first message
-	int msg_cnt; // the number of messages in the queue
-	unsigned char queue; // beginning of the memory queue
+	int mode; // the mode of the queue, MSGQX_MODE_*
+	int slot_size; // the distance between two slots in the ring
+	int spin; // the number of retries before sleeping
+	int flags; // MSGQX_ALIGN_SLOTS, MSGQX_HUGEPAGE, etc.
+	int numa_node; // the NUMA node of the memory, -1 for any node
+	int nsubs; // broadcast mode: the number of subscriber cursors
+	int efd_pid; // the process that created the eventfd, 0 if none
+	int efd; // the eventfd in that process
+	int gen; // the generation of this segment, 0 for the first one
+	int cur_gen; // first segment: the newest generation
+	int sync_us; // journal mode: the interval between syncs
+	char path[MSGQX_PATH_SIZE]; // journal mode: the prefix of the files
+	unsigned int refs; // private queue: the number of handles
+	// locked mode: the futex lock (0: free, 1: locked, 2: locked and
+	// contended) and the ring buffer state it protects
+	unsigned int lock __attribute__((aligned(MSGQX_CACHE_LINE)));
+	int moved; // the queue has been resized into a newer segment
+	int nlanes; // the number of priority lanes
+	int starve; // serve a lane passed over this many times, 0 for never
+	int first[MSGQX_MAX_LANES]; // the index of first message of each lane
+	int msg_cnt[MSGQX_MAX_LANES]; // the number of messages in each lane
+	int skipped[MSGQX_MAX_LANES]; // times each lane was passed over
+	long long synced_at; // journal mode: the last sync, in microseconds
+	// the two ends on separate cache lines
+	struct msgqx_index head __attribute__((aligned(MSGQX_CACHE_LINE)));
+	unsigned long long dropped; // lossy mode: messages skipped by receivers
+	struct msgqx_index tail __attribute__((aligned(MSGQX_CACHE_LINE)));
+	// the statistics
+	unsigned long long max_depth __attribute__((aligned(MSGQX_CACHE_LINE)));
+	unsigned int stat_next; // the slot of the next handle
+	struct msgqx_stat_slot stats[MSGQX_STAT_SLOTS];
+	// beginning of the memory queue
+	unsigned char queue __attribute__((aligned(MSGQX_CACHE_LINE))); 
 }msgqx_q;
 
+// broadcast mode: the cursor of a subscriber
+struct msgqx_sub{
+	unsigned long long pos; // messages received
+	unsigned int state; // MSGQX_SUB_*
+}__attribute__((aligned(MSGQX_CACHE_LINE)));
+
+#define MSGQX_SUB_FREE 0
+#define MSGQX_SUB_ACTIVE 1
+#define MSGQX_SUB_DROPPED 2 // dropped by the sender, not yet noticed
+
+// journal mode: the meta file of a journal, next to its segment files
+struct msgqx_journal{
+	unsigned int magic; // MSGQX_MAGIC once the journal is initialized
+	int msg_size; // the size of each message
+	int seg_len; // the number of messages in a segment file
+	int nsubs; // the number of consumers
+	unsigned long long tail; // messages appended
+	unsigned long long synced; // messages known to be on disk
+	unsigned long long first_seg; // the oldest segment file kept
+	unsigned long long cons[]; // messages received by each consumer
+};
+
+// journal mode: the longest name of a file
+#define MSGQX_FILE_NAME_SIZE (MSGQX_PATH_SIZE + 32)
+
+// a buffer of the payload pool
+struct msgqx_pool_buf{
+	unsigned int next; // the next free buffer
+	unsigned int ref; // the reference count, 0 if free
+};
+
+#define MSGQX_POOL_NONE 0xffffffffU // the end of the free list
+#define MSGQX_POOL_ALIGN 4096 // the alignment of the first buffer
+
+// the payload pool of a queue
+typedef struct _msgqx_pool{
+	unsigned int magic; // MSGQX_MAGIC once the pool is initialized
+	int nbufs; // the number of buffers
+	unsigned long long buf_size; // the size of each buffer
+	unsigned long long stride; // the distance between two buffers
+	unsigned long long data_off; // the offset of the first buffer
+	// the top of the free stack, an index in the lower 32 bits and an ABA
+	// tag in the higher 32 bits
+	unsigned long long top __attribute__((aligned(MSGQX_CACHE_LINE)));
+	// allocators wait here when the pool is empty
+	struct msgqx_index avail __attribute__((aligned(MSGQX_CACHE_LINE)));
+	// the buffer array, then the buffers starting at data_off
+	struct msgqx_pool_buf bufs[] __attribute__((aligned(MSGQX_CACHE_LINE)));
+}msgqx_pool;
+
 // the handle to the message queue, works like an class object pointer
 typedef struct _msgqx_handle{
-	sem_t *has_msg; // semaphore for receiving message
-	sem_t *has_slot;  // semaphore for sending message 
-	sem_t *mutex; // mutex for protecting the message queue
 	int shm_fd; // shared memory file descriptor
+	size_t mem_size; // the size of the shared memory mapping
 	msgqx_q *mem; // pointer to the shared memory
+	int mode; // the mode of the queue
+	char *name; // the name of the first segment, NULL if private
+	int futex_priv; // FUTEX_PRIVATE_FLAG if the queue is private, else 0
+	unsigned long long head; // SPSC sender: last head seen
+	unsigned long long tail; // SPSC receiver: last tail seen
+	int reserved; // a slot is reserved and not committed yet
+	int peeked; // a message is peeked and not released yet
+	unsigned long long resv_pos; // the position of the reserved slot
+	unsigned long long peek_pos; // the position of the peeked message
+	int sub; // broadcast mode: the subscriber of the handle, -1 if none
+	int lane; // locked mode: the lane to send to, or last received from
+	int efd; // the eventfd of the queue, -1 if none
+	int stat; // the statistics slot of the handle
+	char *cbuf; // coalescing: the buffered messages, NULL if none
+	int cmax; // coalescing: the size of cbuf in messages
+	int ccnt; // coalescing: the number of messages in cbuf
+	int cdelay; // coalescing: the delay of a message in microseconds
+	long long cdue; // coalescing: when the oldest message is due
+	struct msgqx_journal *jnl; // journal mode: the meta file
+	size_t jnl_size;
+	int jnl_fd;
+	long long jseg[2]; // journal mode: the segments mapped for sending and
+	                   // for receiving, -1 if none
+	int jseg_fd[2];
+	unsigned char *jseg_mem[2];
+	int pool_fd; // the payload pool, if any
+	size_t pool_size;
+	msgqx_pool *pool;
 }msgqx_h;
 
 
 // enumerate of the object types
 typedef enum _msgqx_obj_types{
-	recv_sem,
-	send_sem,
-	mutex_sem,
 	msgq_shm,
+	msgq_pool,
 }msgqx_ty;
 
 #define MSGQX_NAME_PREFIX "MSGQXPPRE"
-#define MSGQX_RECV_SEM_POSTFIX 'r'
-#define MSGQX_SEND_SEM_POSTFIX 's'
-#define MSGQX_MUTEX_SEM_POSTFIX 'm'
 #define MSGQX_MSGQ_MEM_POSTFIX 'q'
+#define MSGQX_POOL_MEM_POSTFIX 'p'
 #define NAME_BUFFER_SIZE 64
+// the name of a generation has the generation instead of the postfix
+#define MSGQX_GEN_POSTFIX 'g'
+#define GEN_NAME_BUFFER_SIZE (NAME_BUFFER_SIZE + 12)
+#define MSGQX_REMAP_TRIES 16 // attempts to catch up with a resized queue
 
 static int _msgqx_get_obj_name(char * buf, const char * name, msgqx_ty type)
 {
@@ -65,226 +281,506 @@ static int _msgqx_get_obj_name(char * buf, const char * name, msgqx_ty type)
 	char shm_slash[2] = {0,0};
 
 	switch(type){
-	case recv_sem:
-		postfix = MSGQX_RECV_SEM_POSTFIX;
-		break;
-	case send_sem:
-		postfix = MSGQX_SEND_SEM_POSTFIX;
-		break;
-	case mutex_sem:
-		postfix = MSGQX_MUTEX_SEM_POSTFIX;
-		break;
 	case msgq_shm:
 		postfix = MSGQX_MSGQ_MEM_POSTFIX;
 		shm_slash[0]='/';
 		break;
+	case msgq_pool:
+		postfix = MSGQX_POOL_MEM_POSTFIX;
+		shm_slash[0]='/';
+		break;
 	default:
 		postfix = 'x';
 	}
 
-	sprintf(buf, "%s%s_%c_%s", shm_slash, MSGQX_NAME_PREFIX,
-		postfix, name);
+	snprintf(buf, NAME_BUFFER_SIZE, "%s%s_%c_%s", shm_slash,
+		 MSGQX_NAME_PREFIX, postfix, name);
 
 	return 0;
 }
 
+// the name of the segment of a generation of a queue, from the name of its 
+// shared memory; the generation is in the prefix, so that it is never the
+// name of another queue
+static void _msgqx_get_gen_name(char *buf, const char *shm_name, int gen)
+{
+	size_t prefix = sizeof("/" MSGQX_NAME_PREFIX "_q_") - 1;
+
+	if(gen == 0)
+		snprintf(buf, GEN_NAME_BUFFER_SIZE, "%s", shm_name);
+	else
+		snprintf(buf, GEN_NAME_BUFFER_SIZE, "/%s_%c%d_%.*s", 
+			 MSGQX_NAME_PREFIX, MSGQX_GEN_POSTFIX, gen, 
+			 MSGQX_MAX_NAME, shm_name + prefix);
+}
+
 static void _init_msgqx_handle(msgqx_h *handle)
 {
-	handle->has_msg = handle->has_slot = handle->mutex = SEM_FAILED;
 	handle->mem = MAP_FAILED;
 	handle->shm_fd = -1;
+	handle->pool = MAP_FAILED;
+	handle->pool_fd = -1;
+	handle->sub = -1;
+	handle->efd = -1;
+	handle->cbuf = NULL;
+	handle->cmax = handle->ccnt = 0;
+	handle->jnl = MAP_FAILED;
+	handle->jnl_fd = -1;
+	handle->jseg[0] = handle->jseg[1] = -1;
+	handle->jseg_fd[0] = handle->jseg_fd[1] = -1;
+	handle->jseg_mem[0] = handle->jseg_mem[1] = MAP_FAILED;
 
 	return;
 }
 
-static void _init_msgqx_q(msgqx_q *q, int msg_size, int qlen)
+// MPMC and lossy mode: every slot starts with a sequence number
+#define MSGQX_SEQ_SIZE sizeof(unsigned long long)
+
+// variable-length mode: every message starts with its length, and the
+// messages are aligned to the header size
+#define MSGQX_VAR_HDR sizeof(unsigned long long)
+#define MSGQX_VAR_WRAP (~0ULL) // header of the padding before the wrap
+#define MSGQX_VAR_ALIGN(len) (((size_t)(len) + MSGQX_VAR_HDR - 1) & \
+			      ~(MSGQX_VAR_HDR - 1))
+
+// the size of a slot of a queue in a mode; in the variable-length mode, the
+// ring is qlen slots of the largest message
+static int _msgqx_slot_size(int msg_size, int mode, int flags)
+{
+	int size;
+
+	if(mode == MSGQX_MODE_MPMC || mode == MSGQX_MODE_LOSSY)
+		size = (MSGQX_SEQ_SIZE + msg_size + 7) & ~7;
+	else if(mode == MSGQX_MODE_VAR)
+		return MSGQX_VAR_HDR + MSGQX_VAR_ALIGN(msg_size);
+	else
+		size = msg_size;
+
+	if(flags & MSGQX_ALIGN_SLOTS)
+		size = (size + MSGQX_CACHE_LINE - 1) & ~(MSGQX_CACHE_LINE - 1);
+
+	return size;
+}
+
+// the beginning of the ring, as bytes; taken from the queue rather than 
+// from its one-byte member, which the compiler would check writes against
+static inline unsigned char * _msgqx_ring(msgqx_q *q)
+{
+	return (unsigned char*)q + offsetof(msgqx_q, queue);
+}
+
+// locate the slot of index idx
+static inline unsigned char * _msgqx_slot(msgqx_q *q, int idx)
+{
+	return _msgqx_ring(q) + (size_t)q->slot_size * idx;
+}
+
+// variable-length mode: the header of a record, i.e., the length of its 
+// message or MSGQX_VAR_WRAP
+static inline unsigned long long _msgqx_var_hdr(unsigned char *rec)
+{
+	unsigned long long hdr;
+
+	memcpy(&hdr, rec, sizeof(hdr));
+	return hdr;
+}
+
+// the size of the ring and what follows it
+static size_t _msgqx_ring_size(int msg_size, int qlen, 
+			       struct msgqx_attr *attr)
+{
+	size_t size;
+
+	// the messages of a journal are in its files
+	if(attr->mode == MSGQX_MODE_JOURNAL)
+		return 0;
+	size = (size_t)_msgqx_slot_size(msg_size, attr->mode, attr->flags) * 
+		qlen * attr->lanes;
+	if(attr->mode == MSGQX_MODE_BCAST)
+		size = ((size + MSGQX_CACHE_LINE - 1) & ~(MSGQX_CACHE_LINE - 1)) +
+			sizeof(struct msgqx_sub) * attr->subscribers;
+
+	return size;
+}
+
+// broadcast mode: the subscriber cursors after the ring
+static inline struct msgqx_sub * _msgqx_subs(msgqx_q *q)
 {
+	size_t ring = (size_t)q->slot_size * q->qlen;
+
+	return (struct msgqx_sub*)(_msgqx_ring(q) + 
+				   ((ring + MSGQX_CACHE_LINE - 1) & 
+				    ~(MSGQX_CACHE_LINE - 1)));
+}
+
+static void _init_msgqx_q(msgqx_q *q, int msg_size, int qlen,
+			  struct msgqx_attr *attr)
+{
+	int i;
+
 	q->msg_size = msg_size;
 	q->qlen = qlen;
-	q->first = q->msg_cnt = 0;
+	q->mode = attr->mode;
+	q->slot_size = _msgqx_slot_size(msg_size, attr->mode, attr->flags);
+	q->spin = attr->spin;
+	q->flags = attr->flags;
+	q->numa_node = attr->numa_node;
+	q->nsubs = attr->mode == MSGQX_MODE_BCAST ? attr->subscribers : 0;
+	q->efd_pid = 0;
+	q->efd = -1;
+	q->gen = q->cur_gen = 0;
+	q->sync_us = attr->sync_us;
+	q->synced_at = 0;
+	q->lock = 0;
+	q->moved = 0;
+	q->nlanes = attr->lanes;
+	q->starve = attr->starve;
+	memset(q->first, 0, sizeof(q->first));
+	memset(q->msg_cnt, 0, sizeof(q->msg_cnt));
+	memset(q->skipped, 0, sizeof(q->skipped));
+	q->dropped = 0;
+	memset(&q->head, 0, sizeof(struct msgqx_index));
+	memset(&q->tail, 0, sizeof(struct msgqx_index));
+	q->max_depth = 0;
+	q->stat_next = 0;
+	memset(q->stats, 0, sizeof(q->stats));
+
+	if(attr->mode == MSGQX_MODE_MPMC)
+		for(i = 0; i < qlen; i++)
+			*(unsigned long long*)_msgqx_slot(q, i) = i;
+	else if(attr->mode == MSGQX_MODE_LOSSY)
+		for(i = 0; i < qlen; i++)
+			*(unsigned long long*)_msgqx_slot(q, i) = 0;
+	for(i = 0; i < q->nsubs; i++){
+		_msgqx_subs(q)[i].pos = 0;
+		_msgqx_subs(q)[i].state = MSGQX_SUB_FREE;
+	}
+
+	// publish the queue to msgqx_open
+	__atomic_store_n(&q->magic, MSGQX_MAGIC, __ATOMIC_RELEASE);
 
 	return;
 }
 
-// generic function for creating semaphores
-// boolx new indicates whether to create a new semaphore
-// the int val is the initial value of the semaphore
-// the new semaphore is returned with sem_t ** sem
-// return 0 on success;
-static int _msgqx_open_sem(const char *name, boolx new, int val, sem_t ** sem)
+// map anonymous memory for a private queue, without a file descriptor;
+// return 0 on success, 3 on failure
+static int _msgqx_map_private(int flags, size_t *size, int *fd, void **mem)
 {
-	int flags = 0;
-	int ret_val = 0;
-
-	if(new)
-		flags |= O_CREAT | O_EXCL;
-	*sem = sem_open(name, flags, S_IRUSR | S_IWUSR, val);
-	
-	if(*sem == SEM_FAILED){
-		CTX_DPRINTF("Cannot open semaphore %s for: "
-			    "%s\n", name, strerror(errno));
-		ret_val = 1;
+	if(flags & MSGQX_HUGEPAGE)
+		*size = (*size + CTX_HUGEPAGE_SIZE - 1) & 
+			~(CTX_HUGEPAGE_SIZE - 1);
+	*fd = -1;
+	*mem = mmap(NULL, *size, PROT_READ | PROT_WRITE, 
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(*mem == MAP_FAILED){
+		CTX_DPRINTF("Cannot map private memory: %s\n", strerror(errno));
+		return 3;
 	}
-	
-	return ret_val;
+	if((flags & MSGQX_HUGEPAGE) && 
+	   madvise(*mem, *size, MADV_HUGEPAGE) != 0)
+		CTX_DPRINTF("No huge pages for private memory: %s\n",
+			    strerror(errno));
+
+	return 0;
 }
 
-// generic function for opening shared memory
-// return 0 on success
-int _msgqx_open_shm(const char *name, boolx new, int size, int *shm_fd,
-			   void **mem)
+// create and map a new shared memory object, or private memory if name is
+// NULL, and place its pages as the flags ask; return 0 on success, 3 on 
+// failure
+static int _msgqx_map_new(const char *name, int flags, int node, size_t *size,
+			  int *fd, void **mem)
 {
-	int flags = O_RDWR;
-	int ret_val = 0;
-	
-	if(new)
-		flags |= O_CREAT | O_EXCL;
+	int ret_val;
 
-	// open the shared memory
-	*shm_fd = shm_open(name, flags, S_IRUSR | S_IWUSR);
-	if(*shm_fd == -1){
-		CTX_DPRINTF("Cannot create shared memory %s: %s\n", name, 
-			    strerror(errno));
-		return 1;
+	if(name == NULL)
+		ret_val = _msgqx_map_private(flags, size, fd, mem);
+	else
+		ret_val = map_shared_mem(name, CTX_SHM_CREATE | 
+					 (flags & MSGQX_HUGEPAGE ? 
+					  CTX_SHM_HUGEPAGE : 0),
+					 size, fd, mem);
+	if(ret_val != 0){
+		// do not remove the object of someone else
+		if(ret_val != 1 && name != NULL)
+			destroy_shared_mem(name, 0);
+		return 3;
 	}
 
-	// get the correct size of the shared memory
-	if(new){
-		// new shared memory, we need to change its size
-		ret_val = ftruncate(*shm_fd, size);
-		if(ret_val != 0){
-			CTX_DPRINTF("Cannot re-size shared memory %s: %s\n", 
-				    name, strerror(errno));
-			return 2;
-		}
+	// bind the pages before they are faulted in
+	if((node >= 0 && bind_shared_mem(*mem, *size, node) != 0) ||
+	   ((flags & (MSGQX_PREFAULT | MSGQX_MLOCK)) && 
+	    prefault_shared_mem(*mem, *size, flags & MSGQX_MLOCK) != 0)){
+		if(name != NULL)
+			destroy_shared_mem(name, 0);
+		else
+			munmap(*mem, *size);
+		*mem = MAP_FAILED;
+		return 3;
 	}
-	else{
-		// existing shared memory, we need to get its size
-		struct stat s;
-		ret_val = fstat(*shm_fd, &s);
-		if(ret_val != 0){
-			CTX_DPRINTF("Cannot fstat shared memory %s: %s\n", 
-				    name, strerror(errno));
+
+	return 0;
+}
+
+// follow a queue that has been resized: map the newest generation, whose
+// name is recorded in the first segment; it may be resized again meanwhile
+static int _msgqx_remap(msgqx_h *h)
+{
+	int i, gen, fd;
+	size_t size;
+	msgqx_q *mem;
+	char name_buf[GEN_NAME_BUFFER_SIZE];
+
+	for(i = 0; i < MSGQX_REMAP_TRIES; i++){
+		size = 0;
+		if(map_shared_mem(h->name, 0, &size, &fd, (void**)&mem) != 0)
+			break;
+		gen = __atomic_load_n(&mem->cur_gen, __ATOMIC_ACQUIRE);
+		unmap_shared_mem(mem, size, fd);
+
+		_msgqx_get_gen_name(name_buf, h->name, gen);
+		size = 0;
+		if(map_shared_mem(name_buf, 0, &size, &fd, (void**)&mem) != 0)
+			continue;
+		unmap_shared_mem((void*)h->mem, h->mem_size, h->shm_fd);
+		h->mem = mem;
+		h->mem_size = size;
+		h->shm_fd = fd;
+		return 0;
+	}
+
+	CTX_DPRINTF("Cannot follow the resized queue %s\n", h->name);
+	return 3;
+}
+
+// journal mode: the file of a segment, or the meta file if seg is -1
+static void _msgqx_journal_name(char *buf, const char *prefix, long long seg)
+{
+	if(seg < 0)
+		snprintf(buf, MSGQX_FILE_NAME_SIZE, "%s.meta", prefix);
+	else
+		snprintf(buf, MSGQX_FILE_NAME_SIZE, "%s.%lld", prefix, seg);
+}
+
+// journal mode: map the meta file of a journal. With a message size, the
+// journal is created if it does not exist, and must have the same layout if
+// it does. Return 0 on success, 3 on failure.
+static int _msgqx_journal_open(msgqx_h *h, const char *prefix, int msg_size,
+			       int seg_len, int nsubs)
+{
+	struct msgqx_journal *j;
+	char file[MSGQX_FILE_NAME_SIZE];
+
+	_msgqx_journal_name(file, prefix, -1);
+	h->jnl_size = 0;
+	if(map_shared_mem(file, CTX_SHM_FILE, &h->jnl_size, &h->jnl_fd, 
+			  (void**)&h->jnl) == 0){
+		j = h->jnl;
+		if(h->jnl_size < sizeof(*j) || j->magic != MSGQX_MAGIC ||
+		   h->jnl_size < sizeof(*j) + j->nsubs * sizeof(j->cons[0]) ||
+		   (msg_size > 0 && (j->msg_size != msg_size || 
+				     j->seg_len != seg_len || 
+				     j->nsubs != nsubs))){
+			CTX_DPRINTF("Journal %s does not match the queue\n",
+				    file);
 			return 3;
 		}
-		size = s.st_size;
-	}	
-
-	// map the shared memory
-	*mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *shm_fd, 0);
-	if(*mem == MAP_FAILED){
-		CTX_DPRINTF("Cannot map shared memory %s: %s\n", name, 
-			    strerror(errno));
-		return 4;
+		return 0;
 	}
-	
+	if(msg_size <= 0)
+		return 3;
+
+	// a new journal, the file starts with zeros
+	h->jnl_size = sizeof(*j) + nsubs * sizeof(j->cons[0]);
+	if(map_shared_mem(file, CTX_SHM_FILE | CTX_SHM_CREATE, &h->jnl_size,
+			  &h->jnl_fd, (void**)&h->jnl) != 0)
+		return 3;
+	j = h->jnl;
+	j->msg_size = msg_size;
+	j->seg_len = seg_len;
+	j->nsubs = nsubs;
+	j->magic = MSGQX_MAGIC;
+	if(msync(j, h->jnl_size, MS_SYNC) != 0)
+		CTX_DPRINTF("Cannot sync %s: %s\n", file, strerror(errno));
+
 	return 0;
 }
-			   
+
+int msgqx_attr_init(struct msgqx_attr *attr)
+{
+	if(attr == NULL)
+		return 1;
+
+	attr->mode = MSGQX_MODE_LOCKED;
+	attr->spin = MSGQX_DEFAULT_SPIN;
+	attr->flags = 0;
+	attr->numa_node = -1;
+	attr->subscribers = 0;
+	attr->lanes = 1;
+	attr->starve = 0;
+	attr->path = NULL;
+	attr->sync_us = MSGQX_DEFAULT_SYNC_US;
+
+	return 0;
+}
+
 int msgqx_create(const char *name, int size, int len, void **h)
+{
+	return msgqx_create_attr(name, size, len, NULL, h);
+}
+
+int msgqx_create_attr(const char *name, int size, int len, 
+		      struct msgqx_attr *attr, void **h)
 {
 	int ret_val = 0;
 	msgqx_h *handle;
 	char name_buf[NAME_BUFFER_SIZE];
+	struct msgqx_attr def_attr;
+
+	if(attr == NULL){
+		msgqx_attr_init(&def_attr);
+		attr = &def_attr;
+	}
+	if((name == NULL && !(attr->flags & MSGQX_PRIVATE)) || h == NULL || 
+	   (name != NULL && strlen(name) > MSGQX_MAX_NAME) ||
+	   size <= 0 || len <= 0 ||
+	   attr->mode < MSGQX_MODE_LOCKED || attr->mode > MSGQX_MODE_JOURNAL ||
+	   attr->spin < 0 || attr->numa_node < -1 ||
+	   (attr->mode == MSGQX_MODE_BCAST && attr->subscribers <= 0) ||
+	   attr->lanes < 1 || attr->lanes > MSGQX_MAX_LANES || 
+	   (attr->lanes > 1 && attr->mode != MSGQX_MODE_LOCKED) ||
+	   attr->starve < 0 || 
+	   (attr->mode == MSGQX_MODE_JOURNAL && 
+	    (attr->path == NULL || attr->subscribers <= 0 || 
+	     attr->sync_us < -1 || 
+	     (attr->flags & MSGQX_PRIVATE) ||
+	     strlen(attr->path) + strlen(name) + 2 > MSGQX_PATH_SIZE))){
+		CTX_LOGERR("wrong parameters: name (%p), size (%d), len (%d) "
+			   "and mode (%d)\n", name, size, len, attr->mode);
+		if(h != NULL)
+			*h = NULL;
+		return 1;
+	}
 	
 	// create the handle
 	handle = (msgqx_h *)calloc(1, sizeof(msgqx_h));
 	_init_msgqx_handle(handle);
 	*h = (void*)handle;
-	
-	// open the receiving semaphore
-	_msgqx_get_obj_name(name_buf, name, recv_sem);
-	ret_val = _msgqx_open_sem(name_buf, truex, 0, &handle->has_msg);
-	if(ret_val != 0){
-		ret_val = 1;
-		goto error;
-	}
 
-	// open the sending semaphore
-	_msgqx_get_obj_name(name_buf, name, send_sem);
-	ret_val = _msgqx_open_sem(name_buf, truex, len, &handle->has_slot);
-	if(ret_val != 0){
-		ret_val = 2;
-		goto error;
+	// open the shared memory, or map private memory without a name
+	if(!(attr->flags & MSGQX_PRIVATE)){
+		_msgqx_get_obj_name(name_buf, name, msgq_shm);
+		handle->name = strdup(name_buf);
+		if(handle->name == NULL){
+			ret_val = 3;
+			goto error;
+		}
 	}
-
-	// open the mutex that protects the message queue
-	// note that the mutex is opened with value 0 because we need
-	// to initialize the share memory first
-	_msgqx_get_obj_name(name_buf, name, mutex_sem);
-	ret_val = _msgqx_open_sem(name_buf, truex, 0, &handle->mutex);
-	if(ret_val != 0){
-		ret_val = 4;
+	handle->mem_size = sizeof(msgqx_q) + _msgqx_ring_size(size, len, attr);
+	ret_val = _msgqx_map_new(handle->name, attr->flags, attr->numa_node,
+				 &handle->mem_size, &handle->shm_fd, 
+				 (void**)&handle->mem);
+	if(ret_val != 0)
 		goto error;
-	}
 
-	// open the shared memory
-	_msgqx_get_obj_name(name_buf, name, msgq_shm);
-	ret_val = _msgqx_open_shm(name_buf, truex, sizeof(msgqx_q) + size * len,
-				  &handle->shm_fd, (void**)&handle->mem);
-	if(ret_val != 0){
-		ret_val = 3;
-		goto error;
+	// a journal is created, or found where it was left
+	if(attr->mode == MSGQX_MODE_JOURNAL){
+		snprintf(handle->mem->path, MSGQX_PATH_SIZE, "%s/%s", 
+			 attr->path, name);
+		ret_val = _msgqx_journal_open(handle, handle->mem->path, size,
+					      len, attr->subscribers);
+		if(ret_val != 0){
+			destroy_shared_mem(name_buf, 0);
+			goto error;
+		}
 	}
 
 	// initialize the message queue
-	_init_msgqx_q(handle->mem, size, len);
-	// release the message queue, should have no error here
-	sem_post(handle->mutex);
+	_init_msgqx_q(handle->mem, size, len, attr);
+	handle->mode = attr->mode;
+	if(attr->flags & MSGQX_PRIVATE){
+		handle->mem->refs = 1;
+		handle->futex_priv = FUTEX_PRIVATE_FLAG;
+	}
+	handle->stat = __atomic_fetch_add(&handle->mem->stat_next, 1, 
+					  __ATOMIC_RELAXED) % MSGQX_STAT_SLOTS;
 	
 	return 0;
 	
  error:
 	msgqx_close(handle);
-	msgqx_destroy(name);
 	*h = NULL;
 	return ret_val;
 }
 
+int msgqx_dup(void *handle, void **h)
+{
+	msgqx_h *old = handle, *new;
+
+	if(old == NULL || h == NULL || old->mem == MAP_FAILED || 
+	   !(old->mem->flags & MSGQX_PRIVATE)){
+		CTX_LOGERR("wrong parameters: handle (%p) and h (%p)\n", 
+			   handle, h);
+		return 1;
+	}
+
+	new = (msgqx_h *)calloc(1, sizeof(msgqx_h));
+	if(new == NULL)
+		return 3;
+	_init_msgqx_handle(new);
+	new->mem = old->mem;
+	new->mem_size = old->mem_size;
+	new->mode = old->mode;
+	new->futex_priv = old->futex_priv;
+	new->stat = __atomic_fetch_add(&new->mem->stat_next, 1, 
+				       __ATOMIC_RELAXED) % MSGQX_STAT_SLOTS;
+	__atomic_add_fetch(&new->mem->refs, 1, __ATOMIC_RELAXED);
+	*h = new;
+
+	return 0;
+}
+
 int msgqx_open(const char *name, void **h, int *size)
 {
 	int ret_val = 0;
 	msgqx_h *handle;
 	char name_buf[NAME_BUFFER_SIZE];
 	
+	if(name == NULL || h == NULL || size == NULL || 
+	   strlen(name) > MSGQX_MAX_NAME){
+		CTX_LOGERR("wrong parameters: name (%p), handle (%p) and size "
+			   "(%p)\n", name, h, size);
+		return 1;
+	}
+
 	// create the handle
 	handle = (msgqx_h *)calloc(1, sizeof(msgqx_h));
 	_init_msgqx_handle(handle);
 	*h = (void*)handle;
 	
-	// open the receiving semaphore
-	_msgqx_get_obj_name(name_buf, name, recv_sem);
-	ret_val = _msgqx_open_sem(name_buf, falsex, 0, &handle->has_msg);
-	if(ret_val != 0){
-		ret_val = 1;
-		goto error;
-	}
-
-	// open the sending semaphore
-	_msgqx_get_obj_name(name_buf, name, send_sem);
-	ret_val = _msgqx_open_sem(name_buf, falsex, 0, &handle->has_slot);
-	if(ret_val != 0){
-		ret_val = 2;
-		goto error;
-	}
-
-	// open the mutex that protects the message queue
-	_msgqx_get_obj_name(name_buf, name, mutex_sem);
-	ret_val = _msgqx_open_sem(name_buf, falsex, 0, &handle->mutex);
-	if(ret_val != 0){
-		ret_val = 4;
-		goto error;
-	}
-
 	// open the shared memory
 	_msgqx_get_obj_name(name_buf, name, msgq_shm);
-	ret_val = _msgqx_open_shm(name_buf, falsex, 0, &handle->shm_fd, 
-				  (void**)&handle->mem);
-	if(ret_val != 0){
+	ret_val = map_shared_mem(name_buf, 0, &handle->mem_size, 
+				 &handle->shm_fd, (void**)&handle->mem);
+	if(ret_val != 0 || handle->mem_size < sizeof(msgqx_q) ||
+	   __atomic_load_n(&handle->mem->magic, __ATOMIC_ACQUIRE) !=
+	   MSGQX_MAGIC){
+		CTX_DPRINTF("Message queue %s is not ready\n", name);
+		ret_val = 3;
+		goto error;
+	}
+	handle->name = strdup(name_buf);
+	// the queue may have been resized
+	if(handle->name == NULL || 
+	   (handle->mem->moved && _msgqx_remap(handle) != 0) ||
+	   (handle->mem->mode == MSGQX_MODE_JOURNAL && 
+	    _msgqx_journal_open(handle, handle->mem->path, 0, 0, 0) != 0)){
 		ret_val = 3;
 		goto error;
 	}
 	*size = handle->mem->msg_size;
+	handle->mode = handle->mem->mode;
+	handle->stat = __atomic_fetch_add(&handle->mem->stat_next, 1, 
+					  __ATOMIC_RELAXED) % MSGQX_STAT_SLOTS;
 
 	return 0;
  error:
@@ -300,10 +796,7 @@ static inline int _msgqx_param_check(msgqx_h *h, void *buf)
 {
 	if(h == NULL || 
 	   buf == NULL || 
-	   h->mem == NULL || 
-	   h->has_msg == SEM_FAILED || h->has_msg == NULL ||
-	   h->has_slot == SEM_FAILED || h->has_slot == NULL ||
-	   h->mutex == SEM_FAILED || h->mutex == NULL)
+	   h->mem == NULL || h->mem == MAP_FAILED)
 		return 1;
 	else
 		return 0;
@@ -322,8 +815,8 @@ static int _msgqx_time_diff(struct timespec *s, struct timespec *e,
 {
 	long long ns_start, ns_end, diff;
 	
-	ns_start = s->tv_sec * 1000000000 + s->tv_nsec;
-	ns_end = e->tv_sec * 1000000000 + e->tv_nsec;
+	ns_start = s->tv_sec * 1000000000LL + s->tv_nsec;
+	ns_end = e->tv_sec * 1000000000LL + e->tv_nsec;
 
 	diff = ns_end - ns_start;
 	*sec = diff / 1000000000;
@@ -338,7 +831,7 @@ static void _msgqx_time_add(struct timespec *s, int sec, int nsec)
 {
 	long long ns;
 	
-	ns= (s->tv_sec+sec) * 1000000000 + s->tv_nsec + nsec;
+	ns= (s->tv_sec+sec) * 1000000000LL + s->tv_nsec + nsec;
 	
 	if(ns <= 0)
 		return;
@@ -349,311 +842,2591 @@ static void _msgqx_time_add(struct timespec *s, int sec, int nsec)
 	return;
 }
 
-// generic interface for a semaphore wait
-// can be a blocked wait, a try wait or a timed wait
-// return 0 if semaphore acquired;
-// return 4 if try-wait failed to acquired immediately
-// return 5 if timed-wait failed to acquired within time span.
-// return 3 if other errors occur
-static int _msgqx_wait_sem(sem_t *sem, msgqx_wty wait_type, int *sec, int *nsec)
+// compute the deadline of a timed wait on the monotonic clock, which is not
+// affected by changes to the system time
+static void _msgqx_deadline(struct timespec *ts, int sec, int nsec)
 {
-	int ret_val = 0;
-	struct timespec ts, te;
-
-	switch(wait_type){
-	case blockedwait:
-		ret_val = sem_wait(sem);
-		break;
-	case trywait:
-		ret_val = sem_trywait(sem);
-		break;
-	case timedwait:
-		clock_gettime(CLOCK_REALTIME, &ts);
-		_msgqx_time_add(&te, *sec, *nsec);
-
-		ret_val = sem_timedwait(sem, &te);
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	_msgqx_time_add(ts, sec, nsec);
+}
 
-		clock_gettime(CLOCK_REALTIME, &te);
-		_msgqx_time_diff(&ts, &te, sec, nsec);
-		break;
-	default:
-		break; // not reached
-	}
+// the monotonic clock in microseconds
+static long long _msgqx_now_us(void)
+{
+	struct timespec now;
 
-	if(ret_val == 0)
-		return ret_val;
-	else if(wait_type == trywait && errno == EAGAIN)
-		return 4;
-	else if(wait_type == timedwait && errno == ETIMEDOUT)
-		return 5;
-	else{
-		CTX_DPRINTF("Failed when waiting for a semaphore: %s\n",
-			    strerror(errno));
-		return 3;
-	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
 }
 
-
-// generic interface for a semaphore post
-// return 0 on success;
-// return 1 if failed;
-static int _msgqx_post_sem(sem_t * sem)
+// compute the time left before a deadline; return 1 if it has passed
+static int _msgqx_time_left(struct timespec *deadline, struct timespec *left)
 {
-	if(sem_post(sem)){
-		CTX_DPRINTF("Failed when posting a semaphore: %s\n",
-			    strerror(errno));
+	int sec, nsec;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if(_msgqx_time_diff(&now, deadline, &sec, &nsec) ||
+	   (sec == 0 && nsec == 0))
 		return 1;
-	}
+
+	left->tv_sec = sec;
+	left->tv_nsec = nsec;
 
 	return 0;
 }
 
-// copy the message to the message queue, always assume parameters are valid
-static int _msgqx_put_msg(msgqx_h *h, void *data)
+// the futex system calls; the queue can be shared by processes, so the
+// futexes are not private, unless priv is FUTEX_PRIVATE_FLAG for a private
+// queue
+static inline int _msgqx_futex_wait(unsigned int *addr, unsigned int val,
+				    struct timespec *timeout, int priv)
 {
-	unsigned char *p;
-	int idx;
-	
-	if(h->mem->msg_cnt >= h->mem->qlen){
-		CTX_DPRINTF("Strange, the queue is full\n");
-		return 2;
-	}
-	// locate the beginning of the slot
-	idx = (h->mem->first + h->mem->msg_cnt) % h->mem->qlen;
-	p = &h->mem->queue + h->mem->msg_size * idx;
-	// copy the data
-	memcpy((void*)p, data, h->mem->msg_size);
-	h->mem->msg_cnt++;
-	
-	return 0;
+	return syscall(SYS_futex, addr, FUTEX_WAIT | priv, val, timeout, NULL,
+		       0);
 }
 
-// generic interface for sending message
-static int _msgqx_send(msgqx_h *h, void *data, msgqx_wty wait_type, int sec, 
-		       int nsec)
+static inline void _msgqx_futex_wake(unsigned int *addr, int n, int priv)
 {
-	int ret_val;
-	// check the parameters
-	if(_msgqx_param_check(h, data))
-		return 1;
-	
-	// wait for empty slot
-	ret_val = _msgqx_wait_sem(h->has_slot, wait_type, &sec, &nsec);
-	if(ret_val)
-		return ret_val;
-	// wait for the message queue
-	ret_val = _msgqx_wait_sem(h->mutex, wait_type, &sec, &nsec);
-	if(ret_val)
-		return ret_val;
-	// copy the message to the queue
-	ret_val = _msgqx_put_msg(h, data);
-	if(ret_val)
-		return 2;
+	syscall(SYS_futex, addr, FUTEX_WAKE | priv, n, NULL, NULL, 0);
+}
 
-	// release the message queue
-	ret_val = _msgqx_post_sem(h->mutex);
-	if(ret_val)
-		return 7;
-	
-	// post the receiving semaphore
-	ret_val = _msgqx_post_sem(h->has_msg);
-	if(ret_val)
-		return 6;
+// wait on several futexes at once, until an absolute deadline on the
+// monotonic clock if it is not NULL; return the index of the futex that
+// woke us up
+static inline int _msgqx_futex_waitv(struct futex_waitv *waiters, int n,
+				     struct timespec *deadline)
+{
+#ifdef SYS_futex_waitv
+	return syscall(SYS_futex_waitv, waiters, n, 0, deadline, 
+		       CLOCK_MONOTONIC);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
 
-	return 0;
+// tell the processor we are spinning
+static inline void _msgqx_cpu_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#endif
 }
 
-int msgqx_send(void *handle, void *data)
+// locked mode: acquire the futex lock, spin for a while before sleeping
+static void _msgqx_lock(msgqx_h *h)
 {
-	return _msgqx_send((msgqx_h*)handle, data, blockedwait, 0, 0);
+	int i;
+	unsigned int c;
+	unsigned int *lock = &h->mem->lock;
+
+	for(i = 0; ; i++){
+		c = 0;
+		if(__atomic_compare_exchange_n(lock, &c, 1, 0,
+					       __ATOMIC_ACQUIRE,
+					       __ATOMIC_RELAXED))
+			return;
+		if(i >= h->mem->spin)
+			break;
+		_msgqx_cpu_relax();
+	}
+
+	// mark the lock contended, and sleep until it is released
+	if(c != 2)
+		c = __atomic_exchange_n(lock, 2, __ATOMIC_ACQUIRE);
+	while(c != 0){
+		_msgqx_futex_wait(lock, 2, NULL, h->futex_priv);
+		c = __atomic_exchange_n(lock, 2, __ATOMIC_ACQUIRE);
+	}
 }
 
-int msgqx_trysend(void *handle, void *data)
+// locked mode: release the futex lock, wake up one sleeper if contended
+static void _msgqx_unlock(msgqx_h *h)
 {
-	return _msgqx_send((msgqx_h*)handle, data, trywait, 0, 0);
+	if(__atomic_exchange_n(&h->mem->lock, 0, __ATOMIC_RELEASE) == 2)
+		_msgqx_futex_wake(&h->mem->lock, 1, h->futex_priv);
 }
 
-int msgqx_timedsend(void *handle, void *data, int sec, int nsec)
+// what an op returns instead of a count when the queue has been resized, or
+// when it cannot go on
+#define MSGQX_OP_MOVED -1
+#define MSGQX_OP_FAILED -2
+
+// locked and variable-length modes: take the lock, unless the queue has been
+// resized into a new segment; return MSGQX_OP_MOVED if it has
+static inline int _msgqx_lock_ring(msgqx_h *h)
 {
-	return _msgqx_send((msgqx_h*)handle, data, timedwait, sec, nsec);
+	_msgqx_lock(h);
+	if(!h->mem->moved)
+		return 0;
+	_msgqx_unlock(h);
+	return MSGQX_OP_MOVED;
 }
 
-// copy the message from the message queue, always assume parameters are valid
-static int _msgqx_get_msg(msgqx_h *h, void *buf)
+// wake up to n waiters at an end of the queue, if there are any
+static inline void _msgqx_wake(struct msgqx_index *idx, int n, int priv)
 {
-	unsigned char *p;
-	
-	if(h->mem->msg_cnt <= 0){
-		CTX_DPRINTF("Strange, the queue is empty\n");
-		return 2;
+	// pairs with the fence in the waiting side: either it sees the new
+	// state of the queue, or we see it waiting
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&idx->waiting, __ATOMIC_RELAXED)){
+		__atomic_add_fetch(&idx->event, 1, __ATOMIC_RELEASE);
+		_msgqx_futex_wake(&idx->event, n, priv);
 	}
-	// locate the first message
-	p = &h->mem->queue + h->mem->msg_size * h->mem->first;
-	// copy the data
-	memcpy((void*)buf, p, h->mem->msg_size);
-	// update the first message index
-	h->mem->first++;
-	h->mem->first %= h->mem->qlen;
-	h->mem->msg_cnt--;
-	
-	return 0;
 }
 
-
-// generic interface for receiving message
-static int _msgqx_receive(msgqx_h *h, void *buf, msgqx_wty wait_type, int sec, 
-		       int nsec)
+// signal the eventfd if a receiver has asked for it; called after the fence
+// of _msgqx_wake
+static void _msgqx_notify(msgqx_h *h)
 {
-	int ret_val;
-	// check the parameters
-	if(_msgqx_param_check(h, buf))
-		return 1;
-	
-	// wait for new message
-	ret_val = _msgqx_wait_sem(h->has_msg, wait_type, &sec, &nsec);
-	if(ret_val)
-		return ret_val;
-	// wait for the message queue
-	ret_val = _msgqx_wait_sem(h->mutex, wait_type, &sec, &nsec);
-	if(ret_val)
-		return ret_val;
-	// copy the message to the queue
-	ret_val = _msgqx_get_msg(h, buf);
-	if(ret_val)
-		return 2;
-
-	// release the message queue
-	ret_val = _msgqx_post_sem(h->mutex);
-	if(ret_val)
-		return 7;
-	
-	// post the sending semaphore
-	ret_val = _msgqx_post_sem(h->has_slot);
-	if(ret_val)
-		return 6;
+	unsigned long long one = 1;
 
-	return 0;
+	if(h->efd < 0 || !__atomic_load_n(&h->mem->head.notify, 
+					  __ATOMIC_RELAXED) ||
+	   !__atomic_exchange_n(&h->mem->head.notify, 0, __ATOMIC_RELAXED))
+		return;
+	if(write(h->efd, &one, sizeof(one)) != sizeof(one))
+		CTX_DPRINTF("Cannot signal the eventfd: %s\n", strerror(errno));
 }
 
-int msgqx_receive(void *handle, void *data)
+// the number of messages in the queue, read without the lock; for the 
+// slowest subscriber or consumer in the broadcast and journal modes
+static unsigned long long _msgqx_depth(msgqx_h *h)
 {
-	return _msgqx_receive((msgqx_h*)handle, data, blockedwait, 0, 0);
+	msgqx_q *q = h->mem;
+	struct msgqx_sub *subs = _msgqx_subs(q);
+	unsigned long long depth = 0, head, tail;
+	int i, n;
+
+	switch(h->mode){
+	case MSGQX_MODE_LOCKED:
+	case MSGQX_MODE_VAR:
+		for(i = 0; i < q->nlanes; i++)
+			depth += __atomic_load_n(&q->msg_cnt[i], 
+						 __ATOMIC_RELAXED);
+		return depth;
+	case MSGQX_MODE_BCAST:
+	case MSGQX_MODE_JOURNAL:
+		if(h->mode == MSGQX_MODE_BCAST){
+			tail = __atomic_load_n(&q->tail.pos, __ATOMIC_RELAXED);
+			n = q->nsubs;
+		}
+		else{
+			tail = __atomic_load_n(&h->jnl->tail, __ATOMIC_RELAXED);
+			n = h->jnl->nsubs;
+		}
+		for(i = 0; i < n; i++){
+			if(h->mode == MSGQX_MODE_BCAST){
+				if(__atomic_load_n(&subs[i].state, 
+						   __ATOMIC_RELAXED) !=
+				   MSGQX_SUB_ACTIVE)
+					continue;
+				head = __atomic_load_n(&subs[i].pos, 
+						       __ATOMIC_RELAXED);
+			}
+			else
+				head = __atomic_load_n(&h->jnl->cons[i], 
+						       __ATOMIC_RELAXED);
+			// a subscriber still joining may be ahead
+			if(head <= tail && tail - head > depth)
+				depth = tail - head;
+		}
+		return depth;
+	default:
+		head = __atomic_load_n(&q->head.pos, __ATOMIC_RELAXED);
+		tail = __atomic_load_n(&q->tail.pos, __ATOMIC_RELAXED);
+		if(head >= tail)
+			return 0;
+		depth = tail - head;
+		// the lossy mode has overwritten the older ones
+		if(h->mode == MSGQX_MODE_LOSSY && 
+		   depth > (unsigned long long)q->qlen)
+			depth = q->qlen;
+		return depth;
+	}
 }
 
-int msgqx_tryreceive(void *handle, void *data)
+// raise the high-water mark to a depth of the queue
+static void _msgqx_stat_depth(msgqx_q *q, unsigned long long depth)
 {
-	return _msgqx_receive((msgqx_h*)handle, data, trywait, 0, 0);
+	unsigned long long max;
+
+	max = __atomic_load_n(&q->max_depth, __ATOMIC_RELAXED);
+	while(depth > max && 
+	      !__atomic_compare_exchange_n(&q->max_depth, &max, depth, 1,
+					   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
 }
 
-int msgqx_timedreceive(void *handle, void *data, int sec, int nsec)
+// count cnt messages sent or received by a handle. The depth is only read
+// here with MSGQX_TRACK_DEPTH: it loads the lines of the other end, and of
+// every subscriber in the broadcast and journal modes.
+static void _msgqx_stat_msgs(msgqx_h *h, int side, int cnt)
 {
-	return _msgqx_receive((msgqx_h*)handle, data, timedwait, sec, nsec);
+	msgqx_q *q = h->mem;
+
+	__atomic_add_fetch(&q->stats[h->stat].msgs[side], cnt, 
+			   __ATOMIC_RELAXED);
+	if(side == MSGQX_STAT_SEND && (q->flags & MSGQX_TRACK_DEPTH))
+		_msgqx_stat_depth(q, _msgqx_depth(h));
 }
 
-// generic interface for closing a semaphore
-static int _msgqx_close_sem(sem_t * sem)
+// count a wait of a handle at the end "mine", from start until now; a 
+// sender waited for a full queue, a depth worth keeping
+static void _msgqx_stat_wait(msgqx_h *h, struct msgqx_index *mine, 
+			     long long start)
 {
-	if(sem != SEM_FAILED && sem != NULL)
-		return sem_close(sem);
-	return 0;
+	struct msgqx_stat_slot *st = &h->mem->stats[h->stat];
+	unsigned long long us = _msgqx_now_us() - start;
+	int side, bucket;
+
+	if(mine == &h->mem->tail)
+		side = MSGQX_STAT_SEND;
+	else if(mine == &h->mem->head)
+		side = MSGQX_STAT_RECV;
+	else
+		return; // the payload pool
+	bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+	if(bucket >= MSGQX_STAT_BUCKETS)
+		bucket = MSGQX_STAT_BUCKETS - 1;
+
+	__atomic_add_fetch(&st->waits[side], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&st->wait_us[side], us, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&st->hist[side][bucket], 1, __ATOMIC_RELAXED);
+	if(side == MSGQX_STAT_SEND)
+		_msgqx_stat_depth(h->mem, _msgqx_depth(h));
 }
 
-// generic interface fore closing a shared memory
-static int _msgqx_close_shm(void * mem, int size, int shm_fd)
+// wake up the waiters at the end "peer" after cnt messages (or slots) moved,
+// and count the messages
+static void _msgqx_wake_peer(msgqx_h *h, struct msgqx_index *peer, int cnt)
 {
-	int ret_val = 0;
-	if(mem != MAP_FAILED){
-		ret_val = munmap(mem, size);
-		if(ret_val != 0)
-			CTX_DPRINTF("Cannot un-map shared memory: %s\n",
-				    strerror(errno));
-		
-	}
-	
-	if(shm_fd != -1){
-		ret_val = close(shm_fd);
-		if(ret_val != 0)
-			CTX_DPRINTF("Cannot close shared memory: %s\n", 
-				    strerror(errno));
+	// in the variable-length mode, or with several lanes, the space freed
+	// by a receiver may be what any of the waiting senders waits for; in
+	// the broadcast and journal modes, every subscriber or consumer 
+	// receives the new messages
+	if(((h->mode == MSGQX_MODE_VAR || h->mem->nlanes > 1) && 
+	    peer == &h->mem->tail) ||
+	   ((h->mode == MSGQX_MODE_BCAST || h->mode == MSGQX_MODE_JOURNAL) &&
+	    peer == &h->mem->head))
+		_msgqx_wake(peer, INT_MAX, h->futex_priv);
+	else
+		_msgqx_wake(peer, cnt, h->futex_priv);
+
+	if(peer == &h->mem->head){
+		_msgqx_notify(h);
+		_msgqx_stat_msgs(h, MSGQX_STAT_SEND, cnt);
 	}
-	
-	return ret_val;
+	else if(peer == &h->mem->tail)
+		_msgqx_stat_msgs(h, MSGQX_STAT_RECV, cnt);
 }
 
-int msgqx_close(void *handle)
+// copy n messages between a buffer and the ring of a lane, starting at slot
+// idx; the messages wrap around the end of the ring at most once. Only for 
+// the modes whose slots hold nothing but the message, and maybe padding.
+static void _msgqx_ring_copy(msgqx_q *q, int lane, int idx, void *buf, int n,
+			     boolx to_ring)
+{
+	int i, span = q->qlen - idx, base = lane * q->qlen;
+	size_t len;
+
+	// padded slots are copied one by one
+	if(q->slot_size != q->msg_size){
+		for(i = 0; i < n; i++, idx = (idx + 1) % q->qlen){
+			if(to_ring)
+				memcpy(_msgqx_slot(q, base + idx), buf, 
+				       q->msg_size);
+			else
+				memcpy(buf, _msgqx_slot(q, base + idx), 
+				       q->msg_size);
+			buf = (unsigned char*)buf + q->msg_size;
+		}
+		return;
+	}
+
+	if(span > n)
+		span = n;
+
+	len = (size_t)q->msg_size * span;
+	if(to_ring)
+		memcpy(_msgqx_slot(q, base + idx), buf, len);
+	else
+		memcpy(buf, _msgqx_slot(q, base + idx), len);
+
+	if(span == n)
+		return;
+	buf = (unsigned char*)buf + len;
+	len = (size_t)q->msg_size * (n - span);
+	if(to_ring)
+		memcpy(_msgqx_slot(q, base), buf, len);
+	else
+		memcpy(buf, _msgqx_slot(q, base), len);
+}
+
+// locked mode: choose the lane to receive from, -1 if all lanes are empty.
+// This is the first non-empty lane, unless a lower non-empty lane has been
+// passed over starve times. The lock is held.
+static int _msgqx_pick_lane(msgqx_q *q)
+{
+	int i, lane = -1;
+
+	for(i = 0; i < q->nlanes; i++){
+		if(q->msg_cnt[i] == 0)
+			continue;
+		if(lane < 0)
+			lane = i;
+		else if(q->starve > 0 && q->skipped[i] >= q->starve){
+			lane = i;
+			break;
+		}
+	}
+	if(lane < 0)
+		return lane;
+
+	for(i = 0; i < q->nlanes; i++)
+		if(i != lane && q->msg_cnt[i] > 0)
+			q->skipped[i]++;
+	q->skipped[lane] = 0;
+
+	return lane;
+}
+
+// copy up to n messages to the message queue, always assume parameters are
+// valid and the lock is held; return the number of messages copied, 0 if the
+// lane is full
+static int _msgqx_put_msg(msgqx_h *h, void *data, int n)
+{
+	msgqx_q *q = h->mem;
+	int idx, lane = h->lane;
+
+	if(n > q->qlen - q->msg_cnt[lane])
+		n = q->qlen - q->msg_cnt[lane];
+	if(n <= 0)
+		return 0;
+	// locate the beginning of the first free slot
+	idx = (q->first[lane] + q->msg_cnt[lane]) % q->qlen;
+	// copy the data
+	_msgqx_ring_copy(q, lane, idx, data, n, truex);
+	q->msg_cnt[lane] += n;
+
+	return n;
+}
+
+// copy up to n messages from the message queue, always assume parameters are
+// valid and the lock is held; return the number of messages copied, 0 if the
+// queue is empty. The messages come from one lane.
+static int _msgqx_get_msg(msgqx_h *h, void *buf, int n)
+{
+	msgqx_q *q = h->mem;
+	int lane = _msgqx_pick_lane(q);
+
+	if(lane < 0)
+		return 0;
+	if(n > q->msg_cnt[lane])
+		n = q->msg_cnt[lane];
+	// copy the data
+	_msgqx_ring_copy(q, lane, q->first[lane], buf, n, falsex);
+	// update the first message index
+	q->first[lane] += n;
+	q->first[lane] %= q->qlen;
+	q->msg_cnt[lane] -= n;
+	h->lane = lane;
+
+	return n;
+}
+
+// locked mode: copy up to n messages into the queue, return the number of
+// messages copied
+static int _msgqx_locked_put(msgqx_h *h, void *data, int n)
+{
+	int ret_val;
+
+	if(_msgqx_lock_ring(h))
+		return MSGQX_OP_MOVED;
+	ret_val = _msgqx_put_msg(h, data, n);
+	_msgqx_unlock(h);
+
+	return ret_val;
+}
+
+// locked mode: copy up to n messages out of the queue, return the number of
+// messages copied
+static int _msgqx_locked_get(msgqx_h *h, void *buf, int n)
+{
+	int ret_val;
+
+	if(_msgqx_lock_ring(h))
+		return MSGQX_OP_MOVED;
+	ret_val = _msgqx_get_msg(h, buf, n);
+	_msgqx_unlock(h);
+
+	return ret_val;
+}
+
+// journal mode: map segment seg into slot "which" of the handle, 0 for 
+// sending and 1 for receiving; a sender creates the segment files. Return
+// NULL on failure.
+static unsigned char * _msgqx_journal_seg(msgqx_h *h, int which, 
+					  unsigned long long seg)
+{
+	char file[MSGQX_FILE_NAME_SIZE];
+	size_t size = (size_t)h->jnl->seg_len * h->jnl->msg_size;
+	int ret_val;
+
+	if(h->jseg[which] == (long long)seg)
+		return h->jseg_mem[which];
+
+	unmap_shared_mem(h->jseg_mem[which], size, h->jseg_fd[which]);
+	h->jseg[which] = -1;
+	_msgqx_journal_name(file, h->mem->path, seg);
+	ret_val = map_shared_mem(file, CTX_SHM_FILE, &size, &h->jseg_fd[which],
+				 (void**)&h->jseg_mem[which]);
+	if(ret_val == 1 && which == 0)
+		ret_val = map_shared_mem(file, CTX_SHM_FILE | CTX_SHM_CREATE, 
+					 &size, &h->jseg_fd[which],
+					 (void**)&h->jseg_mem[which]);
+	if(ret_val != 0 || 
+	   size < (size_t)h->jnl->seg_len * h->jnl->msg_size){
+		CTX_DPRINTF("Cannot map the journal segment %s\n", file);
+		unmap_shared_mem(h->jseg_mem[which], size, h->jseg_fd[which]);
+		h->jseg_mem[which] = MAP_FAILED;
+		h->jseg_fd[which] = -1;
+		return NULL;
+	}
+	h->jseg[which] = seg;
+
+	return h->jseg_mem[which];
+}
+
+// journal mode: write the new messages, then the meta file, to disk; the 
+// lock is held
+static void _msgqx_journal_sync(msgqx_h *h)
+{
+	struct msgqx_journal *j = h->jnl;
+	unsigned long long seg;
+	char file[MSGQX_FILE_NAME_SIZE];
+	int fd;
+
+	seg = j->synced / j->seg_len;
+	if(seg < j->first_seg)
+		seg = j->first_seg;
+	for(; j->tail > j->synced && seg <= (j->tail - 1) / j->seg_len; seg++){
+		_msgqx_journal_name(file, h->mem->path, seg);
+		fd = open(file, O_RDWR);
+		if(fd < 0 || fdatasync(fd) != 0)
+			CTX_DPRINTF("Cannot sync %s: %s\n", file, 
+				    strerror(errno));
+		if(fd >= 0)
+			close(fd);
+	}
+	j->synced = j->tail;
+	if(msync(j, h->jnl_size, MS_SYNC) != 0)
+		CTX_DPRINTF("Cannot sync the journal: %s\n", strerror(errno));
+	h->mem->synced_at = _msgqx_now_us();
+}
+
+// journal mode: sync if the interval has passed; the lock is held
+static void _msgqx_journal_commit(msgqx_h *h)
+{
+	int sync_us = h->mem->sync_us;
+
+	if(sync_us == 0 || 
+	   (sync_us > 0 && _msgqx_now_us() - h->mem->synced_at >= sync_us))
+		_msgqx_journal_sync(h);
+}
+
+// journal mode: remove the segment files that every consumer has passed;
+// the lock is held
+static void _msgqx_journal_trim(msgqx_h *h)
+{
+	struct msgqx_journal *j = h->jnl;
+	unsigned long long pos = j->tail;
+	char file[MSGQX_FILE_NAME_SIZE];
+	int i;
+
+	for(i = 0; i < j->nsubs; i++)
+		if(j->cons[i] < pos)
+			pos = j->cons[i];
+	for(; j->first_seg < pos / j->seg_len; j->first_seg++){
+		_msgqx_journal_name(file, h->mem->path, j->first_seg);
+		destroy_shared_mem(file, CTX_SHM_FILE);
+	}
+}
+
+// journal mode: append up to n messages, return the number of messages 
+// appended
+static int _msgqx_journal_put(msgqx_h *h, void *data, int n)
+{
+	struct msgqx_journal *j = h->jnl;
+	unsigned char *seg;
+	int i;
+
+	_msgqx_lock(h);
+	for(i = 0; i < n; i++, j->tail++){
+		seg = _msgqx_journal_seg(h, 0, j->tail / j->seg_len);
+		if(seg == NULL)
+			break;
+		memcpy(seg + (size_t)(j->tail % j->seg_len) * j->msg_size,
+		       (unsigned char*)data + (size_t)i * j->msg_size, 
+		       j->msg_size);
+	}
+	if(i > 0)
+		_msgqx_journal_commit(h);
+	_msgqx_unlock(h);
+
+	return i > 0 ? i : MSGQX_OP_FAILED;
+}
+
+// journal mode: copy up to n messages for the consumer of the handle, return
+// the number of messages copied, 0 if it has received all messages
+static int _msgqx_journal_get(msgqx_h *h, void *buf, int n)
+{
+	struct msgqx_journal *j = h->jnl;
+	unsigned long long pos, first;
+	unsigned char *seg;
+	int i, failed = 0;
+
+	_msgqx_lock(h);
+	pos = first = j->cons[h->sub];
+	for(i = 0; i < n && pos < j->tail; i++, pos++){
+		seg = _msgqx_journal_seg(h, 1, pos / j->seg_len);
+		if(seg == NULL){
+			failed = 1;
+			break;
+		}
+		memcpy((unsigned char*)buf + (size_t)i * j->msg_size,
+		       seg + (size_t)(pos % j->seg_len) * j->msg_size,
+		       j->msg_size);
+	}
+	j->cons[h->sub] = pos;
+	if(pos / j->seg_len != first / j->seg_len)
+		_msgqx_journal_trim(h);
+	if(i > 0)
+		_msgqx_journal_commit(h);
+	_msgqx_unlock(h);
+
+	return (i == 0 && failed) ? MSGQX_OP_FAILED : i;
+}
+
+// SPSC: copy up to n messages into the queue, return the number of messages
+// copied
+static int _msgqx_spsc_put(msgqx_h *h, void *data, int n)
+{
+	msgqx_q *q = h->mem;
+	unsigned long long tail = __atomic_load_n(&q->tail.pos, 
+						  __ATOMIC_RELAXED);
+
+	if(tail - h->head + n > (unsigned long long)q->qlen){
+		// only read the receiver's cache line when the queue looks full
+		h->head = __atomic_load_n(&q->head.pos, __ATOMIC_ACQUIRE);
+		if(tail - h->head + n > (unsigned long long)q->qlen)
+			n = q->qlen - (int)(tail - h->head);
+		if(n == 0)
+			return 0;
+	}
+
+	_msgqx_ring_copy(q, 0, tail % q->qlen, data, n, truex);
+	__atomic_store_n(&q->tail.pos, tail + n, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+// SPSC: copy up to n messages out of the queue, return the number of 
+// messages copied
+static int _msgqx_spsc_get(msgqx_h *h, void *buf, int n)
+{
+	msgqx_q *q = h->mem;
+	unsigned long long head = __atomic_load_n(&q->head.pos, 
+						  __ATOMIC_RELAXED);
+
+	if(h->tail - head < (unsigned long long)n){
+		h->tail = __atomic_load_n(&q->tail.pos, __ATOMIC_ACQUIRE);
+		if(h->tail - head < (unsigned long long)n)
+			n = (int)(h->tail - head);
+		if(n == 0)
+			return 0;
+	}
+
+	_msgqx_ring_copy(q, 0, head % q->qlen, buf, n, falsex);
+	__atomic_store_n(&q->head.pos, head + n, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+// MPMC: count the slots from position pos on, up to n, whose sequence
+// number is pos + i + ahead, i.e., the free slots (ahead = 0) or the filled
+// slots (ahead = 1) of this lap. diff is the distance of the sequence number
+// of the first slot not counted; with n = 0, as if the slot were not ready.
+static inline int _msgqx_mpmc_ready(msgqx_q *q, unsigned long long pos, int n,
+				    int ahead, long long *diff)
+{
+	int i;
+	unsigned long long seq;
+
+	*diff = -1;
+	for(i = 0; i < n; i++){
+		seq = __atomic_load_n((unsigned long long*)
+				      _msgqx_slot(q, (pos + i) % q->qlen),
+				      __ATOMIC_ACQUIRE);
+		*diff = (long long)(seq - (pos + i + ahead));
+		if(*diff != 0)
+			break;
+	}
+
+	return i;
+}
+
+// MPMC: claim up to n slots at an end of the queue with one CAS, and return
+// the first claimed position in pos; ahead is 0 for the tail, 1 for the head
+static int _msgqx_mpmc_claim(msgqx_q *q, struct msgqx_index *end, int n,
+			     int ahead, unsigned long long *pos)
+{
+	int cnt;
+	long long diff;
+
+	*pos = __atomic_load_n(&end->pos, __ATOMIC_RELAXED);
+	for(;;){
+		cnt = _msgqx_mpmc_ready(q, *pos, n, ahead, &diff);
+		if(cnt > 0){
+			// the first cnt slots are ready in this lap, try to 
+			// claim them
+			if(__atomic_compare_exchange_n(&end->pos, pos, 
+						       *pos + cnt, 1, 
+						       __ATOMIC_RELAXED,
+						       __ATOMIC_RELAXED))
+				return cnt;
+		}
+		else if(diff < 0)
+			// the first slot is still used by the last lap (tail)
+			// or not filled yet (head)
+			return 0;
+		else
+			*pos = __atomic_load_n(&end->pos, __ATOMIC_RELAXED);
+	}
+}
+
+// MPMC: claim the tail and copy up to n messages into the slots, return the
+// number of messages copied
+static int _msgqx_mpmc_put(msgqx_h *h, void *data, int n)
+{
+	msgqx_q *q = h->mem;
+	unsigned char *slot;
+	unsigned long long pos;
+	int i;
+
+	n = _msgqx_mpmc_claim(q, &q->tail, n, 0, &pos);
+
+	for(i = 0; i < n; i++){
+		slot = _msgqx_slot(q, (pos + i) % q->qlen);
+		memcpy(slot + MSGQX_SEQ_SIZE, 
+		       (unsigned char*)data + (size_t)q->msg_size * i, 
+		       q->msg_size);
+		__atomic_store_n((unsigned long long*)slot, pos + i + 1, 
+				 __ATOMIC_RELEASE);
+	}
+
+	return n;
+}
+
+// MPMC: claim the head and copy up to n messages out, return the number of
+// messages copied
+static int _msgqx_mpmc_get(msgqx_h *h, void *buf, int n)
+{
+	msgqx_q *q = h->mem;
+	unsigned char *slot;
+	unsigned long long pos;
+	int i;
+
+	n = _msgqx_mpmc_claim(q, &q->head, n, 1, &pos);
+
+	for(i = 0; i < n; i++){
+		slot = _msgqx_slot(q, (pos + i) % q->qlen);
+		memcpy((unsigned char*)buf + (size_t)q->msg_size * i, 
+		       slot + MSGQX_SEQ_SIZE, q->msg_size);
+		__atomic_store_n((unsigned long long*)slot, 
+				 pos + i + q->qlen, __ATOMIC_RELEASE);
+	}
+
+	return n;
+}
+
+// locked mode: reserve the first free slot of the first lane; on success the
+// lock is held until the slot is committed
+static int _msgqx_locked_reserve(msgqx_h *h, void *slot, int n)
+{
+	msgqx_q *q = h->mem;
+
+	if(_msgqx_lock_ring(h))
+		return MSGQX_OP_MOVED;
+	if(q->msg_cnt[0] == q->qlen){
+		_msgqx_unlock(h);
+		return 0;
+	}
+	*(void**)slot = _msgqx_slot(q, (q->first[0] + q->msg_cnt[0]) % 
+				    q->qlen);
+
+	return 1;
+}
+
+// locked mode: locate the oldest message; on success the lock is held until
+// the message is released
+static int _msgqx_locked_peek(msgqx_h *h, void *msg, int n)
+{
+	msgqx_q *q = h->mem;
+	int lane;
+
+	if(_msgqx_lock_ring(h))
+		return MSGQX_OP_MOVED;
+	lane = _msgqx_pick_lane(q);
+	if(lane < 0){
+		_msgqx_unlock(h);
+		return 0;
+	}
+	h->peek_pos = lane;
+	*(void**)msg = _msgqx_slot(q, lane * q->qlen + q->first[lane]);
+
+	return 1;
+}
+
+// SPSC: reserve the slot at the tail, it is published by the commit
+static int _msgqx_spsc_reserve(msgqx_h *h, void *slot, int n)
+{
+	msgqx_q *q = h->mem;
+	unsigned long long tail = __atomic_load_n(&q->tail.pos, 
+						  __ATOMIC_RELAXED);
+
+	if(tail - h->head >= (unsigned long long)q->qlen){
+		h->head = __atomic_load_n(&q->head.pos, __ATOMIC_ACQUIRE);
+		if(tail - h->head >= (unsigned long long)q->qlen)
+			return 0;
+	}
+	h->resv_pos = tail;
+	*(void**)slot = _msgqx_slot(q, tail % q->qlen);
+
+	return 1;
+}
+
+// SPSC: locate the message at the head, it stays in the queue until released
+static int _msgqx_spsc_peek(msgqx_h *h, void *msg, int n)
+{
+	msgqx_q *q = h->mem;
+	unsigned long long head = __atomic_load_n(&q->head.pos, 
+						  __ATOMIC_RELAXED);
+
+	if(h->tail == head){
+		h->tail = __atomic_load_n(&q->tail.pos, __ATOMIC_ACQUIRE);
+		if(h->tail == head)
+			return 0;
+	}
+	h->peek_pos = head;
+	*(void**)msg = _msgqx_slot(q, head % q->qlen);
+
+	return 1;
+}
+
+// MPMC: claim one slot at the tail, it is published by the commit
+static int _msgqx_mpmc_reserve(msgqx_h *h, void *slot, int n)
+{
+	msgqx_q *q = h->mem;
+
+	if(_msgqx_mpmc_claim(q, &q->tail, 1, 0, &h->resv_pos) == 0)
+		return 0;
+	*(void**)slot = _msgqx_slot(q, h->resv_pos % q->qlen) + 
+		MSGQX_SEQ_SIZE;
+
+	return 1;
+}
+
+// MPMC: claim one message at the head, its slot is freed by the release
+static int _msgqx_mpmc_peek(msgqx_h *h, void *msg, int n)
+{
+	msgqx_q *q = h->mem;
+
+	if(_msgqx_mpmc_claim(q, &q->head, 1, 1, &h->peek_pos) == 0)
+		return 0;
+	*(void**)msg = _msgqx_slot(q, h->peek_pos % q->qlen) + 
+		MSGQX_SEQ_SIZE;
+
+	return 1;
+}
+
+// variable-length mode: a message and the buffer it is copied from or to
+struct msgqx_var_msg{
+	void *buf;
+	int len; // the length of the message
+	int size; // the size of the receiving buffer
+};
+
+// variable-length mode: copy a message into the byte ring, return 1 if it is
+// copied, 0 if there is not enough space
+static int _msgqx_var_put(msgqx_h *h, void *data, int n)
+{
+	msgqx_q *q = h->mem;
+	struct msgqx_var_msg *m = data;
+	size_t ring = (size_t)q->slot_size * q->qlen;
+	size_t rec = MSGQX_VAR_HDR + MSGQX_VAR_ALIGN(m->len);
+	size_t wr, skip = 0;
+	unsigned long long hdr = MSGQX_VAR_WRAP;
+
+	if(_msgqx_lock_ring(h))
+		return MSGQX_OP_MOVED;
+	wr = q->tail.pos % ring;
+	// do not split the message at the end of the ring
+	if(wr + rec > ring)
+		skip = ring - wr;
+	if(q->tail.pos - q->head.pos + skip + rec > ring){
+		_msgqx_unlock(h);
+		return 0;
+	}
+	if(skip){
+		memcpy(_msgqx_ring(q) + wr, &hdr, sizeof(hdr));
+		wr = 0;
+	}
+	hdr = m->len;
+	memcpy(_msgqx_ring(q) + wr, &hdr, sizeof(hdr));
+	memcpy(_msgqx_ring(q) + wr + MSGQX_VAR_HDR, m->buf, m->len);
+	q->tail.pos += skip + rec;
+	q->msg_cnt[0]++;
+	_msgqx_unlock(h);
+
+	return 1;
+}
+
+// variable-length mode: copy the oldest message out of the byte ring, return
+// 1 if there is a message, 0 if the ring is empty. If the buffer is too small,
+// the message stays in the ring, and only its length is returned.
+static int _msgqx_var_get(msgqx_h *h, void *buf, int n)
+{
+	msgqx_q *q = h->mem;
+	struct msgqx_var_msg *m = buf;
+	size_t ring = (size_t)q->slot_size * q->qlen;
+	size_t rd;
+	unsigned char *rec;
+
+	if(_msgqx_lock_ring(h))
+		return MSGQX_OP_MOVED;
+	if(q->msg_cnt[0] == 0){
+		_msgqx_unlock(h);
+		return 0;
+	}
+	rd = q->head.pos % ring;
+	rec = _msgqx_ring(q) + rd;
+	if(_msgqx_var_hdr(rec) == MSGQX_VAR_WRAP){
+		q->head.pos += ring - rd;
+		rec = _msgqx_ring(q);
+	}
+	m->len = (int)_msgqx_var_hdr(rec);
+	if(m->len <= m->size){
+		memcpy(m->buf, rec + MSGQX_VAR_HDR, m->len);
+		q->head.pos += MSGQX_VAR_HDR + MSGQX_VAR_ALIGN(m->len);
+		// restart from the beginning of an empty ring, so that the 
+		// largest message always fits in it
+		if(--q->msg_cnt[0] == 0)
+			q->head.pos = q->tail.pos = 0;
+	}
+	_msgqx_unlock(h);
+
+	return 1;
+}
+
+// broadcast mode: copy up to n messages into the queue, as far as the 
+// slowest subscriber allows, and drop the subscribers that fill the queue if
+// the queue drops slow subscribers; return the number of messages copied
+static int _msgqx_bcast_put(msgqx_h *h, void *data, int n)
+{
+	msgqx_q *q = h->mem;
+	struct msgqx_sub *subs = _msgqx_subs(q);
+	unsigned long long tail = __atomic_load_n(&q->tail.pos, 
+						  __ATOMIC_RELAXED);
+	unsigned long long used;
+	int i;
+	boolx dropped = falsex;
+
+	// pairs with the fence of a new subscriber: either we see its cursor
+	// or it sees our tail
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for(i = 0; i < q->nsubs && n > 0; i++){
+		if(__atomic_load_n(&subs[i].state, __ATOMIC_ACQUIRE) != 
+		   MSGQX_SUB_ACTIVE)
+			continue;
+		used = tail - __atomic_load_n(&subs[i].pos, __ATOMIC_ACQUIRE);
+		// a subscriber still joining may not have caught up yet
+		if(used > (unsigned long long)q->qlen)
+			continue;
+		if(used == (unsigned long long)q->qlen && 
+		   (q->flags & MSGQX_DROP_SLOW)){
+			// the slot it reads next is overwritten after this
+			__atomic_store_n(&subs[i].state, MSGQX_SUB_DROPPED,
+					 __ATOMIC_SEQ_CST);
+			dropped = truex;
+			continue;
+		}
+		if(n > q->qlen - (int)used)
+			n = q->qlen - (int)used;
+	}
+	if(n == 0)
+		return 0;
+
+	// a dropped subscriber that sees any byte of the new messages sees that
+	// it is dropped; pairs with the fence in _msgqx_bcast_get
+	if(dropped)
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+	_msgqx_ring_copy(q, 0, tail % q->qlen, data, n, truex);
+	__atomic_store_n(&q->tail.pos, tail + n, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+// broadcast mode: copy up to n messages out of the queue for the subscriber
+// of the handle, return the number of messages copied. If the subscriber has
+// been dropped, it is unsubscribed, and 1 is returned so that the caller does
+// not wait.
+static int _msgqx_bcast_get(msgqx_h *h, void *buf, int n)
+{
+	msgqx_q *q = h->mem;
+	struct msgqx_sub *sub = &_msgqx_subs(q)[h->sub];
+	unsigned long long pos = __atomic_load_n(&sub->pos, __ATOMIC_RELAXED);
+
+	if(h->tail - pos < (unsigned long long)n){
+		h->tail = __atomic_load_n(&q->tail.pos, __ATOMIC_ACQUIRE);
+		if(h->tail - pos < (unsigned long long)n)
+			n = (int)(h->tail - pos);
+	}
+	if(n > 0)
+		_msgqx_ring_copy(q, 0, pos % q->qlen, buf, n, falsex);
+
+	// the sender drops us before it overwrites the messages we copy
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if(__atomic_load_n(&sub->state, __ATOMIC_RELAXED) != MSGQX_SUB_ACTIVE){
+		__atomic_store_n(&sub->state, MSGQX_SUB_FREE, __ATOMIC_RELEASE);
+		h->sub = -1;
+		return 1;
+	}
+	if(n == 0)
+		return 0;
+
+	__atomic_store_n(&sub->pos, pos + n, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+// lossy mode: the sequence number of position pos while it is written, and
+// once it is written
+#define MSGQX_LOSSY_BUSY(pos) (2 * (pos) + 1)
+#define MSGQX_LOSSY_DONE(pos) (2 * (pos) + 2)
+
+// lossy mode: copy n messages into the queue, overwriting the oldest ones;
+// return n
+static int _msgqx_lossy_put(msgqx_h *h, void *data, int n)
+{
+	msgqx_q *q = h->mem;
+	unsigned long long tail = __atomic_load_n(&q->tail.pos, 
+						  __ATOMIC_RELAXED);
+	unsigned long long *seq;
+	int i;
+
+	for(i = 0; i < n; i++, tail++){
+		seq = (unsigned long long*)_msgqx_slot(q, tail % q->qlen);
+		// mark the slot busy before any byte of it changes
+		__atomic_store_n(seq, MSGQX_LOSSY_BUSY(tail), __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		memcpy(seq + 1, (unsigned char*)data + (size_t)q->msg_size * i,
+		       q->msg_size);
+		__atomic_store_n(seq, MSGQX_LOSSY_DONE(tail), __ATOMIC_RELEASE);
+		__atomic_store_n(&q->tail.pos, tail + 1, __ATOMIC_RELEASE);
+	}
+
+	return n;
+}
+
+// lossy mode: copy up to n messages out of the queue, skipping the ones that
+// have been overwritten; return the number of messages copied
+static int _msgqx_lossy_get(msgqx_h *h, void *buf, int n)
+{
+	msgqx_q *q = h->mem;
+	unsigned long long head, tail, skip, *seq, s;
+	unsigned char *msg;
+	int cnt = 0;
+
+	while(cnt < n){
+		head = __atomic_load_n(&q->head.pos, __ATOMIC_ACQUIRE);
+		tail = __atomic_load_n(&q->tail.pos, __ATOMIC_ACQUIRE);
+		if(head == tail)
+			break;
+
+		// the sender has lapped us, skip to the oldest message
+		skip = 0;
+		if(tail - head > (unsigned long long)q->qlen)
+			skip = tail - head - q->qlen;
+		else{
+			seq = (unsigned long long*)_msgqx_slot(q, head % 
+							       q->qlen);
+			msg = (unsigned char*)buf + (size_t)q->msg_size * cnt;
+			s = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+			if(s == MSGQX_LOSSY_DONE(head)){
+				memcpy(msg, seq + 1, q->msg_size);
+				__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			}
+			// overwritten before or while we copied it
+			if(s != MSGQX_LOSSY_DONE(head) || 
+			   __atomic_load_n(seq, __ATOMIC_RELAXED) != s)
+				skip = 1;
+		}
+
+		if(__atomic_compare_exchange_n(&q->head.pos, &head, 
+					       head + (skip ? skip : 1), 0,
+					       __ATOMIC_RELAXED, 
+					       __ATOMIC_RELAXED)){
+			if(skip)
+				__atomic_add_fetch(&q->dropped, skip, 
+						   __ATOMIC_RELAXED);
+			else
+				cnt++;
+		}
+	}
+
+	return cnt;
+}
+
+// generic interface for sending and receiving. The caller waits at the end
+// "mine" until op moves at least one of the n messages, and then wakes up as
+// many waiters at the end "peer" as messages moved; peer is NULL if op does
+// not publish anything yet. op returns MSGQX_OP_MOVED if the queue has been
+// resized, and the caller starts over in the new segment.
+// return 0 on success, with the number of messages moved in cnt;
+// return 4 if a try failed to succeed immediately
+// return 5 if a timed wait failed to succeed within time span.
+// return 3 if other errors occur
+static int _msgqx_xfer(msgqx_h *h, void *data, int n, int *cnt,
+		       int (*op)(msgqx_h *, void *, int),
+		       struct msgqx_index *mine, struct msgqx_index *peer,
+		       msgqx_wty wait_type, int sec, int nsec)
+{
+	int i, ret_val;
+	unsigned int event;
+	size_t mine_off, peer_off;
+	struct timespec deadline, left, *timeout = NULL;
+	long long start = 0;
+
+ retry:
+	if((*cnt = op(h, data, n)) > 0)
+		goto done;
+	// the queue is empty: ask the next sender to signal the eventfd, and
+	// check again in case it has just sent
+	if(*cnt == 0 && mine == &h->mem->head && 
+	   __atomic_load_n(&h->mem->efd_pid, __ATOMIC_RELAXED) != 0){
+		__atomic_store_n(&mine->notify, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if((*cnt = op(h, data, n)) > 0)
+			goto done;
+	}
+	if(*cnt < 0)
+		goto moved;
+	if(wait_type == trywait)
+		return 4;
+	if(start == 0)
+		start = _msgqx_now_us();
+	if(wait_type == timedwait && timeout == NULL){
+		_msgqx_deadline(&deadline, sec, nsec);
+		timeout = &left;
+	}
+
+	// the other side is probably busy right now, retry for a while
+	for(i = 0; i < h->mem->spin; i++){
+		_msgqx_cpu_relax();
+		if((*cnt = op(h, data, n)) > 0)
+			goto done;
+		if(*cnt < 0)
+			goto moved;
+	}
+
+	for(;;){
+		// count as a waiter, then check again before sleeping; the
+		// event changes if we are woken up in between
+		event = __atomic_load_n(&mine->event, __ATOMIC_ACQUIRE);
+		__atomic_add_fetch(&mine->waiting, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if((*cnt = op(h, data, n)) != 0){
+			__atomic_sub_fetch(&mine->waiting, 1, __ATOMIC_RELAXED);
+			if(*cnt < 0)
+				goto moved;
+			break;
+		}
+		if(timeout != NULL && _msgqx_time_left(&deadline, timeout)){
+			__atomic_sub_fetch(&mine->waiting, 1, __ATOMIC_RELAXED);
+			_msgqx_stat_wait(h, mine, start);
+			return 5;
+		}
+
+		ret_val = _msgqx_futex_wait(&mine->event, event, timeout,
+					    h->futex_priv);
+		__atomic_sub_fetch(&mine->waiting, 1, __ATOMIC_RELAXED);
+		if(ret_val != 0 && errno != EAGAIN && errno != EINTR &&
+		   errno != ETIMEDOUT){
+			CTX_DPRINTF("Failed when waiting for the queue: %s\n",
+				    strerror(errno));
+			return 3;
+		}
+	}
+
+ done:
+	if(start != 0)
+		_msgqx_stat_wait(h, mine, start);
+	if(peer != NULL)
+		_msgqx_wake_peer(h, peer, *cnt);
+	return 0;
+
+ moved:
+	if(*cnt == MSGQX_OP_FAILED){
+		*cnt = 0;
+		return 3;
+	}
+	// the ends are at the same offsets in the new segment
+	mine_off = (unsigned char*)mine - (unsigned char*)h->mem;
+	peer_off = peer != NULL ? 
+		(unsigned char*)peer - (unsigned char*)h->mem : 0;
+	*cnt = 0;
+	if(_msgqx_remap(h) != 0)
+		return 3;
+	mine = (struct msgqx_index*)((unsigned char*)h->mem + mine_off);
+	if(peer != NULL)
+		peer = (struct msgqx_index*)((unsigned char*)h->mem + peer_off);
+	goto retry;
+}
+
+static int _msgqx_flush(msgqx_h *h, msgqx_wty wait_type, int sec, int nsec);
+
+// generic interface for sending messages to a lane
+static int _msgqx_send(msgqx_h *h, int lane, void *data, int n, int *cnt,
+		       msgqx_wty wait_type, int sec, int nsec)
+{
+	int (*put)(msgqx_h *, void *, int);
+	int sent, ret_val;
+	struct msgqx_var_msg var;
+
+	// check the parameters
+	if(_msgqx_param_check(h, data) || n <= 0 || lane < 0 || 
+	   lane >= h->mem->nlanes)
+		return 1;
+	if(cnt == NULL)
+		cnt = &sent;
+	// the messages still in the coalescing buffer go first
+	if(h->ccnt > 0 && data != h->cbuf &&
+	   (ret_val = _msgqx_flush(h, wait_type, sec, nsec)) != 0){
+		*cnt = 0;
+		return ret_val;
+	}
+	h->lane = lane;
+
+	switch(h->mode){
+	case MSGQX_MODE_SPSC:
+		put = _msgqx_spsc_put;
+		break;
+	case MSGQX_MODE_MPMC:
+		put = _msgqx_mpmc_put;
+		break;
+	case MSGQX_MODE_VAR:
+		// one message of the largest size
+		if(n != 1)
+			return 1;
+		var.buf = data;
+		var.len = var.size = h->mem->msg_size;
+		data = &var;
+		put = _msgqx_var_put;
+		break;
+	case MSGQX_MODE_BCAST:
+		put = _msgqx_bcast_put;
+		break;
+	case MSGQX_MODE_LOSSY:
+		put = _msgqx_lossy_put;
+		break;
+	case MSGQX_MODE_JOURNAL:
+		put = _msgqx_journal_put;
+		break;
+	default:
+		put = _msgqx_locked_put;
+	}
+
+	return _msgqx_xfer(h, data, n, cnt, put, &h->mem->tail, &h->mem->head,
+			   wait_type, sec, nsec);
+}
+
+// coalescing: publish the buffered messages in order; a try or timed flush
+// that fails leaves the rest in the buffer
+static int _msgqx_flush(msgqx_h *h, msgqx_wty wait_type, int sec, int nsec)
+{
+	int sent, ret_val, size = h->mem->msg_size;
+	struct timespec deadline, left;
+
+	if(wait_type == timedwait)
+		_msgqx_deadline(&deadline, sec, nsec);
+	while(h->ccnt > 0){
+		ret_val = _msgqx_send(h, 0, h->cbuf, h->ccnt, &sent, wait_type,
+				      sec, nsec);
+		if(ret_val != 0)
+			return ret_val;
+		h->ccnt -= sent;
+		memmove(h->cbuf, h->cbuf + (size_t)sent * size, 
+			(size_t)h->ccnt * size);
+		if(h->ccnt > 0 && wait_type == timedwait){
+			if(_msgqx_time_left(&deadline, &left))
+				return 5;
+			sec = left.tv_sec;
+			nsec = left.tv_nsec;
+		}
+	}
+
+	return 0;
+}
+
+// coalescing: add a message to the buffer, and publish the buffer when it
+// is full or its oldest message is due
+static int _msgqx_coalesce(msgqx_h *h, void *data, msgqx_wty wait_type,
+			   int sec, int nsec)
+{
+	int ret_val, size = h->mem->msg_size;
+	long long now;
+
+	// no room until some of the buffer is published
+	if(h->ccnt == h->cmax){
+		ret_val = _msgqx_flush(h, wait_type, sec, nsec);
+		if(h->ccnt == h->cmax)
+			return ret_val;
+	}
+
+	memcpy(h->cbuf + (size_t)h->ccnt * size, data, size);
+	now = _msgqx_now_us();
+	if(h->ccnt++ == 0)
+		h->cdue = now + h->cdelay;
+	if(h->ccnt < h->cmax && now < h->cdue)
+		return 0;
+
+	// the message is taken, a full queue only delays the flush
+	ret_val = _msgqx_flush(h, wait_type, sec, nsec);
+	return (ret_val == 4 || ret_val == 5) ? 0 : ret_val;
+}
+
+// send one message, through the coalescing buffer if the handle has one
+static int _msgqx_send_one(msgqx_h *h, void *data, msgqx_wty wait_type,
+			   int sec, int nsec)
+{
+	if(_msgqx_param_check(h, data))
+		return 1;
+	if(h->cmax > 0)
+		return _msgqx_coalesce(h, data, wait_type, sec, nsec);
+
+	return _msgqx_send(h, 0, data, 1, NULL, wait_type, sec, nsec);
+}
+
+int msgqx_send(void *handle, void *data)
+{
+	return _msgqx_send_one((msgqx_h*)handle, data, blockedwait, 0, 0);
+}
+
+int msgqx_trysend(void *handle, void *data)
+{
+	return _msgqx_send_one((msgqx_h*)handle, data, trywait, 0, 0);
+}
+
+int msgqx_timedsend(void *handle, void *data, int sec, int nsec)
+{
+	return _msgqx_send_one((msgqx_h*)handle, data, timedwait, sec, nsec);
+}
+
+int msgqx_set_coalesce(void *handle, int max_msgs, int usec)
+{
+	int ret_val;
+	msgqx_h *h = handle;
+
+	if(_msgqx_param_check(h, h) || h->mode == MSGQX_MODE_VAR || 
+	   max_msgs < 0 || usec < 0)
+		return 1;
+
+	// publish what the old buffer holds
+	ret_val = _msgqx_flush(h, blockedwait, 0, 0);
+	if(ret_val != 0)
+		return ret_val;
+	free(h->cbuf);
+	h->cbuf = NULL;
+	h->cmax = 0;
+	if(max_msgs <= 1)
+		return 0;
+
+	h->cbuf = malloc((size_t)max_msgs * h->mem->msg_size);
+	if(h->cbuf == NULL){
+		CTX_DPRINTF("Cannot allocate the coalescing buffer\n");
+		return 2;
+	}
+	h->cmax = max_msgs;
+	h->cdelay = usec;
+
+	return 0;
+}
+
+int msgqx_flush(void *handle)
+{
+	msgqx_h *h = handle;
+
+	if(_msgqx_param_check(h, h))
+		return 1;
+
+	return _msgqx_flush(h, blockedwait, 0, 0);
+}
+
+int msgqx_tryflush(void *handle)
+{
+	msgqx_h *h = handle;
+
+	if(_msgqx_param_check(h, h))
+		return 1;
+
+	return _msgqx_flush(h, trywait, 0, 0);
+}
+
+int msgqx_flush_timeout(void *handle, int *usec)
+{
+	msgqx_h *h = handle;
+	long long left;
+
+	if(_msgqx_param_check(h, usec))
+		return 1;
+
+	if(h->ccnt == 0){
+		*usec = -1;
+		return 0;
+	}
+	left = h->cdue - _msgqx_now_us();
+	*usec = left > 0 ? (int)left : 0;
+
+	return 0;
+}
+
+int msgqx_send_batch(void *handle, void *data, int n, int *sent)
+{
+	return _msgqx_send((msgqx_h*)handle, 0, data, n, sent, blockedwait, 0,
+			   0);
+}
+
+int msgqx_trysend_batch(void *handle, void *data, int n, int *sent)
+{
+	return _msgqx_send((msgqx_h*)handle, 0, data, n, sent, trywait, 0, 0);
+}
+
+int msgqx_timedsend_batch(void *handle, void *data, int n, int *sent, 
+			  int sec, int nsec)
+{
+	return _msgqx_send((msgqx_h*)handle, 0, data, n, sent, timedwait, 
+			   sec, nsec);
+}
+
+// generic interface for receiving messages, and the lane they come from
+static int _msgqx_receive(msgqx_h *h, void *buf, int n, int *cnt, int *lane,
+			  msgqx_wty wait_type, int sec, int nsec)
+{
+	int (*get)(msgqx_h *, void *, int);
+	int received, ret_val;
+	struct msgqx_var_msg var;
+
+	// check the parameters
+	if(_msgqx_param_check(h, buf) || n <= 0)
+		return 1;
+	if(cnt == NULL)
+		cnt = &received;
+	h->lane = 0;
+
+	switch(h->mode){
+	case MSGQX_MODE_SPSC:
+		get = _msgqx_spsc_get;
+		break;
+	case MSGQX_MODE_MPMC:
+		get = _msgqx_mpmc_get;
+		break;
+	case MSGQX_MODE_VAR:
+		// one message, into a buffer of the largest size
+		if(n != 1)
+			return 1;
+		var.buf = buf;
+		var.size = h->mem->msg_size;
+		buf = &var;
+		get = _msgqx_var_get;
+		break;
+	case MSGQX_MODE_BCAST:
+		if(h->sub < 0)
+			return 1;
+		get = _msgqx_bcast_get;
+		break;
+	case MSGQX_MODE_LOSSY:
+		get = _msgqx_lossy_get;
+		break;
+	case MSGQX_MODE_JOURNAL:
+		if(h->sub < 0)
+			return 1;
+		get = _msgqx_journal_get;
+		break;
+	default:
+		get = _msgqx_locked_get;
+	}
+
+	ret_val = _msgqx_xfer(h, buf, n, cnt, get, &h->mem->head, 
+			      &h->mem->tail, wait_type, sec, nsec);
+	// a dropped subscriber
+	if(ret_val == 0 && h->mode == MSGQX_MODE_BCAST && h->sub < 0){
+		*cnt = 0;
+		return 7;
+	}
+	if(ret_val == 0 && lane != NULL)
+		*lane = h->lane;
+
+	return ret_val;
+}
+
+int msgqx_receive(void *handle, void *data)
+{
+	return _msgqx_receive((msgqx_h*)handle, data, 1, NULL, NULL, 
+			      blockedwait, 0, 0);
+}
+
+int msgqx_tryreceive(void *handle, void *data)
+{
+	return _msgqx_receive((msgqx_h*)handle, data, 1, NULL, NULL, trywait,
+			      0, 0);
+}
+
+int msgqx_timedreceive(void *handle, void *data, int sec, int nsec)
+{
+	return _msgqx_receive((msgqx_h*)handle, data, 1, NULL, NULL, 
+			      timedwait, sec, nsec);
+}
+
+int msgqx_receive_batch(void *handle, void *buf, int n, int *received)
+{
+	return _msgqx_receive((msgqx_h*)handle, buf, n, received, NULL, 
+			      blockedwait, 0, 0);
+}
+
+int msgqx_tryreceive_batch(void *handle, void *buf, int n, int *received)
+{
+	return _msgqx_receive((msgqx_h*)handle, buf, n, received, NULL, 
+			      trywait, 0, 0);
+}
+
+int msgqx_timedreceive_batch(void *handle, void *buf, int n, int *received,
+			     int sec, int nsec)
+{
+	return _msgqx_receive((msgqx_h*)handle, buf, n, received, NULL, 
+			      timedwait, sec, nsec);
+}
+
+int msgqx_send_lane(void *handle, void *data, int lane)
+{
+	return _msgqx_send((msgqx_h*)handle, lane, data, 1, NULL, blockedwait,
+			   0, 0);
+}
+
+int msgqx_trysend_lane(void *handle, void *data, int lane)
+{
+	return _msgqx_send((msgqx_h*)handle, lane, data, 1, NULL, trywait, 0,
+			   0);
+}
+
+int msgqx_timedsend_lane(void *handle, void *data, int lane, int sec, 
+			 int nsec)
+{
+	return _msgqx_send((msgqx_h*)handle, lane, data, 1, NULL, timedwait,
+			   sec, nsec);
+}
+
+int msgqx_receive_lane(void *handle, void *buf, int *lane)
+{
+	return _msgqx_receive((msgqx_h*)handle, buf, 1, NULL, lane, 
+			      blockedwait, 0, 0);
+}
+
+int msgqx_tryreceive_lane(void *handle, void *buf, int *lane)
+{
+	return _msgqx_receive((msgqx_h*)handle, buf, 1, NULL, lane, trywait,
+			      0, 0);
+}
+
+int msgqx_timedreceive_lane(void *handle, void *buf, int *lane, int sec, 
+			    int nsec)
+{
+	return _msgqx_receive((msgqx_h*)handle, buf, 1, NULL, lane, timedwait,
+			      sec, nsec);
+}
+
+// try to receive a message from each of the n queues in turn, starting at
+// start; return 4 if they are all empty
+static int _msgqx_try_any(msgqx_h **hs, int n, void *buf, int start,
+			  int *which)
+{
+	int i, k, ret_val;
+
+	for(k = 0; k < n; k++){
+		i = (start + k) % n;
+		ret_val = _msgqx_receive(hs[i], buf, 1, NULL, NULL, trywait, 0,
+					 0);
+		if(ret_val != 4){
+			*which = i;
+			return ret_val;
+		}
+	}
+
+	return 4;
+}
+
+// generic interface for receiving from any of n queues. The queues are
+// scanned from the one after the last one received from, so that a busy
+// queue cannot starve the others, and the caller sleeps on the head events
+// of all the queues with one futex_waitv.
+static int _msgqx_receive_any(msgqx_h **hs, int n, void *buf, int *which,
+			      msgqx_wty wait_type, int sec, int nsec)
+{
+	int i, start, woken = -1, ret_val, wait_ret, moved;
+	struct futex_waitv waiters[MSGQX_MAX_ANY];
+	msgqx_q *mems[MSGQX_MAX_ANY];
+	struct timespec deadline, left, tick = {0, 1000000};
+
+	// check the parameters
+	if(hs == NULL || n <= 0 || n > MSGQX_MAX_ANY || which == NULL)
+		return 1;
+	for(i = 0; i < n; i++)
+		if(_msgqx_param_check(hs[i], buf))
+			return 1;
+	start = (*which >= 0 && *which < n) ? (*which + 1) % n : 0;
+
+	ret_val = _msgqx_try_any(hs, n, buf, start, which);
+	if(ret_val != 4 || wait_type == trywait)
+		return ret_val;
+	if(wait_type == timedwait)
+		_msgqx_deadline(&deadline, sec, nsec);
+
+	// some sender is probably about to send, retry for a while
+	for(i = 0; i < hs[0]->mem->spin; i++){
+		_msgqx_cpu_relax();
+		ret_val = _msgqx_try_any(hs, n, buf, start, which);
+		if(ret_val != 4)
+			return ret_val;
+	}
+
+	for(;;){
+		// count as a waiter of every queue, then check again before
+		// sleeping, as in _msgqx_xfer
+		for(i = 0; i < n; i++){
+			struct msgqx_index *head = &hs[i]->mem->head;
+
+			mems[i] = hs[i]->mem;
+			waiters[i].val = __atomic_load_n(&head->event,
+							 __ATOMIC_ACQUIRE);
+			waiters[i].uaddr = (unsigned long)&head->event;
+			waiters[i].flags = FUTEX_32 | hs[i]->futex_priv;
+			waiters[i].__reserved = 0;
+			__atomic_add_fetch(&head->waiting, 1, __ATOMIC_RELAXED);
+		}
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		ret_val = _msgqx_try_any(hs, n, buf, start, which);
+		if(ret_val == 4 && wait_type == timedwait && 
+		   _msgqx_time_left(&deadline, &left))
+			ret_val = 5;
+		// a resized queue is followed by the try, so the events we
+		// would sleep on may be gone
+		for(i = 0, moved = 0; i < n; i++)
+			moved |= hs[i]->mem != mems[i];
+		wait_ret = 0;
+		if(ret_val == 4 && !moved){
+			wait_ret = _msgqx_futex_waitv(waiters, n, 
+						      wait_type == timedwait ?
+						      &deadline : NULL);
+			// without futex_waitv, poll the queues every tick
+			if(wait_ret < 0 && errno == ENOSYS)
+				wait_ret = _msgqx_futex_wait(
+					&hs[0]->mem->head.event, 
+					waiters[0].val, &tick, 
+					hs[0]->futex_priv);
+			if(wait_ret >= 0 && wait_ret < n)
+				woken = wait_ret;
+		}
+		for(i = 0; i < n; i++)
+			if(hs[i]->mem == mems[i])
+				__atomic_sub_fetch(&mems[i]->head.waiting, 1,
+						   __ATOMIC_RELAXED);
+
+		if(ret_val != 4)
+			break;
+		if(wait_ret < 0 && errno != EAGAIN && errno != EINTR &&
+		   errno != ETIMEDOUT){
+			CTX_DPRINTF("Failed when waiting for the queues: %s\n",
+				    strerror(errno));
+			return 3;
+		}
+	}
+
+	// we took the wake-up of a queue but received from another one; pass
+	// it on to the next waiter of that queue
+	if(ret_val == 0 && woken >= 0 && woken != *which)
+		_msgqx_wake(&hs[woken]->mem->head, 1, hs[woken]->futex_priv);
+
+	return ret_val;
+}
+
+int msgqx_receive_any(void **handles, int n, void *buf, int *which)
+{
+	return _msgqx_receive_any((msgqx_h**)handles, n, buf, which, 
+				  blockedwait, 0, 0);
+}
+
+int msgqx_tryreceive_any(void **handles, int n, void *buf, int *which)
+{
+	return _msgqx_receive_any((msgqx_h**)handles, n, buf, which, trywait,
+				  0, 0);
+}
+
+int msgqx_timedreceive_any(void **handles, int n, void *buf, int *which,
+			   int sec, int nsec)
+{
+	return _msgqx_receive_any((msgqx_h**)handles, n, buf, which, 
+				  timedwait, sec, nsec);
+}
+
+// generic interface for sending a message of a given length, only in the
+// variable-length mode
+static int _msgqx_send_len(msgqx_h *h, void *data, int len,
+			   msgqx_wty wait_type, int sec, int nsec)
+{
+	int cnt;
+	struct msgqx_var_msg var;
+
+	if(_msgqx_param_check(h, data) || h->mode != MSGQX_MODE_VAR ||
+	   len < 0 || len > h->mem->msg_size)
+		return 1;
+
+	var.buf = data;
+	var.len = var.size = len;
+
+	return _msgqx_xfer(h, &var, 1, &cnt, _msgqx_var_put, &h->mem->tail,
+			   &h->mem->head, wait_type, sec, nsec);
+}
+
+int msgqx_send_len(void *handle, void *data, int len)
+{
+	return _msgqx_send_len((msgqx_h*)handle, data, len, blockedwait, 0, 0);
+}
+
+int msgqx_trysend_len(void *handle, void *data, int len)
+{
+	return _msgqx_send_len((msgqx_h*)handle, data, len, trywait, 0, 0);
+}
+
+int msgqx_timedsend_len(void *handle, void *data, int len, int sec, int nsec)
+{
+	return _msgqx_send_len((msgqx_h*)handle, data, len, timedwait, sec, 
+			       nsec);
+}
+
+// generic interface for receiving a message and its length, only in the
+// variable-length mode
+static int _msgqx_receive_len(msgqx_h *h, void *buf, int size, int *len,
+			      msgqx_wty wait_type, int sec, int nsec)
+{
+	int cnt, ret_val;
+	struct msgqx_var_msg var;
+
+	if(_msgqx_param_check(h, buf) || h->mode != MSGQX_MODE_VAR ||
+	   size < 0 || len == NULL)
+		return 1;
+
+	var.buf = buf;
+	var.size = size;
+	ret_val = _msgqx_xfer(h, &var, 1, &cnt, _msgqx_var_get, &h->mem->head,
+			      &h->mem->tail, wait_type, sec, nsec);
+	if(ret_val != 0)
+		return ret_val;
+
+	*len = var.len;
+	if(var.len > size)
+		return 6;
+
+	return 0;
+}
+
+int msgqx_receive_len(void *handle, void *buf, int size, int *len)
+{
+	return _msgqx_receive_len((msgqx_h*)handle, buf, size, len, 
+				  blockedwait, 0, 0);
+}
+
+int msgqx_tryreceive_len(void *handle, void *buf, int size, int *len)
+{
+	return _msgqx_receive_len((msgqx_h*)handle, buf, size, len, trywait,
+				  0, 0);
+}
+
+int msgqx_timedreceive_len(void *handle, void *buf, int size, int *len,
+			   int sec, int nsec)
+{
+	return _msgqx_receive_len((msgqx_h*)handle, buf, size, len, timedwait,
+				  sec, nsec);
+}
+
+// generic interface for reserving a slot
+static int _msgqx_reserve(msgqx_h *h, void **slot, msgqx_wty wait_type,
+			  int sec, int nsec)
+{
+	int (*reserve)(msgqx_h *, void *, int);
+	int cnt, ret_val;
+
+	if(_msgqx_param_check(h, slot) || h->reserved)
+		return 1;
+	// the messages still in the coalescing buffer go first
+	if(h->ccnt > 0 && (ret_val = _msgqx_flush(h, wait_type, sec, nsec)))
+		return ret_val;
+
+	switch(h->mode){
+	case MSGQX_MODE_SPSC:
+		reserve = _msgqx_spsc_reserve;
+		break;
+	case MSGQX_MODE_MPMC:
+		reserve = _msgqx_mpmc_reserve;
+		break;
+	case MSGQX_MODE_VAR:
+	case MSGQX_MODE_BCAST:
+	case MSGQX_MODE_LOSSY:
+	case MSGQX_MODE_JOURNAL:
+		return 1;
+	default:
+		reserve = _msgqx_locked_reserve;
+	}
+
+	ret_val = _msgqx_xfer(h, slot, 1, &cnt, reserve, &h->mem->tail, NULL,
+			      wait_type, sec, nsec);
+	if(ret_val == 0)
+		h->reserved = 1;
+
+	return ret_val;
+}
+
+int msgqx_reserve(void *handle, void **slot)
+{
+	return _msgqx_reserve((msgqx_h*)handle, slot, blockedwait, 0, 0);
+}
+
+int msgqx_tryreserve(void *handle, void **slot)
+{
+	return _msgqx_reserve((msgqx_h*)handle, slot, trywait, 0, 0);
+}
+
+int msgqx_timedreserve(void *handle, void **slot, int sec, int nsec)
+{
+	return _msgqx_reserve((msgqx_h*)handle, slot, timedwait, sec, nsec);
+}
+
+int msgqx_commit(void *handle)
+{
+	msgqx_h *h = handle;
+	msgqx_q *q;
+
+	if(h == NULL || !h->reserved)
+		return 1;
+	q = h->mem;
+
+	switch(h->mode){
+	case MSGQX_MODE_SPSC:
+		__atomic_store_n(&q->tail.pos, h->resv_pos + 1, 
+				 __ATOMIC_RELEASE);
+		break;
+	case MSGQX_MODE_MPMC:
+		__atomic_store_n((unsigned long long*)
+				 _msgqx_slot(q, h->resv_pos % q->qlen),
+				 h->resv_pos + 1, __ATOMIC_RELEASE);
+		break;
+	default:
+		q->msg_cnt[0]++;
+		_msgqx_unlock(h);
+	}
+	h->reserved = 0;
+	_msgqx_wake_peer(h, &q->head, 1);
+
+	return 0;
+}
+
+// generic interface for peeking at a message
+static int _msgqx_peek(msgqx_h *h, void **msg, msgqx_wty wait_type,
+		       int sec, int nsec)
+{
+	int (*peek)(msgqx_h *, void *, int);
+	int cnt, ret_val;
+
+	if(_msgqx_param_check(h, msg) || h->peeked)
+		return 1;
+
+	switch(h->mode){
+	case MSGQX_MODE_SPSC:
+		peek = _msgqx_spsc_peek;
+		break;
+	case MSGQX_MODE_MPMC:
+		peek = _msgqx_mpmc_peek;
+		break;
+	case MSGQX_MODE_VAR:
+	case MSGQX_MODE_BCAST:
+	case MSGQX_MODE_LOSSY:
+	case MSGQX_MODE_JOURNAL:
+		return 1;
+	default:
+		peek = _msgqx_locked_peek;
+	}
+
+	ret_val = _msgqx_xfer(h, msg, 1, &cnt, peek, &h->mem->head, NULL,
+			      wait_type, sec, nsec);
+	if(ret_val == 0)
+		h->peeked = 1;
+
+	return ret_val;
+}
+
+int msgqx_peek(void *handle, void **msg)
+{
+	return _msgqx_peek((msgqx_h*)handle, msg, blockedwait, 0, 0);
+}
+
+int msgqx_trypeek(void *handle, void **msg)
+{
+	return _msgqx_peek((msgqx_h*)handle, msg, trywait, 0, 0);
+}
+
+int msgqx_timedpeek(void *handle, void **msg, int sec, int nsec)
+{
+	return _msgqx_peek((msgqx_h*)handle, msg, timedwait, sec, nsec);
+}
+
+int msgqx_release(void *handle)
+{
+	msgqx_h *h = handle;
+	msgqx_q *q;
+
+	if(h == NULL || !h->peeked)
+		return 1;
+	q = h->mem;
+
+	switch(h->mode){
+	case MSGQX_MODE_SPSC:
+		__atomic_store_n(&q->head.pos, h->peek_pos + 1, 
+				 __ATOMIC_RELEASE);
+		break;
+	case MSGQX_MODE_MPMC:
+		__atomic_store_n((unsigned long long*)
+				 _msgqx_slot(q, h->peek_pos % q->qlen),
+				 h->peek_pos + q->qlen, __ATOMIC_RELEASE);
+		break;
+	default:
+		q->first[h->peek_pos] = (q->first[h->peek_pos] + 1) % q->qlen;
+		q->msg_cnt[h->peek_pos]--;
+		_msgqx_unlock(h);
+	}
+	h->peeked = 0;
+	_msgqx_wake_peer(h, &q->tail, 1);
+
+	return 0;
+}
+
+// locked mode: copy the messages of every lane to the beginning of the lane
+// in the new segment
+static void _msgqx_move_locked(msgqx_q *old, msgqx_q *q)
+{
+	int i, lane;
+
+	for(lane = 0; lane < old->nlanes; lane++){
+		for(i = 0; i < old->msg_cnt[lane]; i++)
+			memcpy(_msgqx_slot(q, lane * q->qlen + i),
+			       _msgqx_slot(old, lane * old->qlen + 
+					   (old->first[lane] + i) % old->qlen),
+			       old->msg_size);
+		q->first[lane] = 0;
+	}
+}
+
+// variable-length mode: copy the messages to the beginning of the new byte
+// ring, without the padding before the wrap
+static void _msgqx_move_var(msgqx_q *old, msgqx_q *q)
+{
+	size_t ring = (size_t)old->slot_size * old->qlen, rd, rec, wr = 0;
+	unsigned long long pos = old->head.pos;
+	unsigned char *from;
+	int i;
+
+	for(i = 0; i < old->msg_cnt[0]; i++){
+		rd = pos % ring;
+		from = _msgqx_ring(old) + rd;
+		if(_msgqx_var_hdr(from) == MSGQX_VAR_WRAP){
+			pos += ring - rd;
+			from = _msgqx_ring(old);
+		}
+		rec = MSGQX_VAR_HDR + MSGQX_VAR_ALIGN(_msgqx_var_hdr(from));
+		memcpy(_msgqx_ring(q) + wr, from, rec);
+		pos += rec;
+		wr += rec;
+	}
+	q->head.pos = 0;
+	q->tail.pos = wr;
+}
+
+int msgqx_resize(void *handle, int len)
 {
-	int size = 0, ret_val = 0;
 	msgqx_h *h = handle;
+	msgqx_q *old, *q, *root;
+	struct msgqx_attr attr;
+	char name_buf[GEN_NAME_BUFFER_SIZE];
+	size_t size, root_size = 0;
+	int i, fd, root_fd, gen;
+
+	if(_msgqx_param_check(h, h) || len <= 0 || h->reserved || 
+	   h->peeked || (h->mode != MSGQX_MODE_LOCKED && 
+			 h->mode != MSGQX_MODE_VAR) || h->name == NULL)
+		return 1;
 
-	if(h == NULL)
+	// the lock of the newest segment keeps everyone else out
+	while(_msgqx_lock_ring(h))
+		if(_msgqx_remap(h) != 0)
+			return 3;
+	old = h->mem;
+	if(len == old->qlen){
+		_msgqx_unlock(h);
+		return 0;
+	}
+	// the messages must fit in the new ring
+	for(i = 0; i < old->nlanes; i++)
+		if(old->msg_cnt[i] > len){
+			_msgqx_unlock(h);
+			return 4;
+		}
+	if(old->mode == MSGQX_MODE_VAR && old->tail.pos - old->head.pos >
+	   (unsigned long long)old->slot_size * len){
+		_msgqx_unlock(h);
+		return 4;
+	}
+
+	// create the segment of the next generation
+	msgqx_attr_init(&attr);
+	attr.mode = old->mode;
+	attr.flags = old->flags;
+	attr.lanes = old->nlanes;
+	size = sizeof(msgqx_q) + _msgqx_ring_size(old->msg_size, len, &attr);
+	gen = old->gen + 1;
+	_msgqx_get_gen_name(name_buf, h->name, gen);
+	if(_msgqx_map_new(name_buf, old->flags, old->numa_node, &size, &fd, 
+			  (void**)&q) != 0){
+		_msgqx_unlock(h);
+		return 3;
+	}
+
+	// the header is copied as it is, except for the ring and the waiters
+	memcpy(q, old, offsetof(msgqx_q, queue));
+	q->qlen = len;
+	q->gen = gen;
+	q->lock = 0;
+	q->head.event = q->head.waiting = 0;
+	q->tail.event = q->tail.waiting = 0;
+	if(old->mode == MSGQX_MODE_VAR)
+		_msgqx_move_var(old, q);
+	else
+		_msgqx_move_locked(old, q);
+
+	// record the new generation in the first segment
+	root = old;
+	if(old->gen > 0 && 
+	   map_shared_mem(h->name, 0, &root_size, &root_fd, (void**)&root)){
+		_msgqx_unlock(h);
+		unmap_shared_mem(q, size, fd);
+		destroy_shared_mem(name_buf, 0);
+		return 3;
+	}
+	__atomic_store_n(&root->cur_gen, gen, __ATOMIC_RELEASE);
+	if(root != old)
+		unmap_shared_mem(root, root_size, root_fd);
+
+	// send everyone to the new segment
+	old->moved = 1;
+	_msgqx_unlock(h);
+	__atomic_add_fetch(&old->head.event, 1, __ATOMIC_RELEASE);
+	_msgqx_futex_wake(&old->head.event, INT_MAX, 0);
+	__atomic_add_fetch(&old->tail.event, 1, __ATOMIC_RELEASE);
+	_msgqx_futex_wake(&old->tail.event, INT_MAX, 0);
+
+	// give back the memory of the old ring; the first segment stays, as it
+	// records the newest generation
+	if(ftruncate(h->shm_fd, sizeof(msgqx_q)) != 0)
+		CTX_DPRINTF("Cannot truncate the old segment: %s\n",
+			    strerror(errno));
+	if(old->gen > 0){
+		_msgqx_get_gen_name(name_buf, h->name, old->gen);
+		destroy_shared_mem(name_buf, 0);
+	}
+	unmap_shared_mem((void*)old, h->mem_size, h->shm_fd);
+	h->mem = q;
+	h->mem_size = size;
+	h->shm_fd = fd;
+
+	return 0;
+}
+
+// add a counter of a statistics slot to a sum
+#define MSGQX_STAT_SUM(sum, cnt) \
+	((sum) += __atomic_load_n(&(cnt), __ATOMIC_RELAXED))
+
+int msgqx_get_stats(void *handle, struct msgqx_stats *stats)
+{
+	msgqx_h *h = handle;
+	struct msgqx_stat_slot *st;
+	int i, j;
+
+	if(_msgqx_param_check(h, stats))
 		return 1;
+	if(__atomic_load_n(&h->mem->moved, __ATOMIC_ACQUIRE) && 
+	   _msgqx_remap(h) != 0)
+		return 3;
 
-	// close receiving semaphore
-	ret_val |= _msgqx_close_sem(h->has_msg);
-	// close sending semaphore
-	ret_val |= _msgqx_close_sem(h->has_slot);
-	// close message queue mutex
-	ret_val |= _msgqx_close_sem(h->mutex);
-	// un-map and close shared memory
-	if(h->mem != NULL && h->mem != MAP_FAILED){
-		size = sizeof(msgqx_q) + 
-			h->mem->msg_size * h->mem->qlen;
-		
-		ret_val |= _msgqx_close_shm((void*)h->mem, size, h->shm_fd);
+	memset(stats, 0, sizeof(struct msgqx_stats));
+	for(i = 0; i < MSGQX_STAT_SLOTS; i++){
+		st = &h->mem->stats[i];
+		MSGQX_STAT_SUM(stats->sent, st->msgs[MSGQX_STAT_SEND]);
+		MSGQX_STAT_SUM(stats->received, st->msgs[MSGQX_STAT_RECV]);
+		MSGQX_STAT_SUM(stats->send_waits, st->waits[MSGQX_STAT_SEND]);
+		MSGQX_STAT_SUM(stats->recv_waits, st->waits[MSGQX_STAT_RECV]);
+		MSGQX_STAT_SUM(stats->send_wait_us, 
+			       st->wait_us[MSGQX_STAT_SEND]);
+		MSGQX_STAT_SUM(stats->recv_wait_us, 
+			       st->wait_us[MSGQX_STAT_RECV]);
+		for(j = 0; j < MSGQX_STAT_BUCKETS; j++){
+			MSGQX_STAT_SUM(stats->send_hist[j], 
+				       st->hist[MSGQX_STAT_SEND][j]);
+			MSGQX_STAT_SUM(stats->recv_hist[j], 
+				       st->hist[MSGQX_STAT_RECV][j]);
+		}
 	}
+	stats->depth = _msgqx_depth(h);
+	_msgqx_stat_depth(h->mem, stats->depth);
+	stats->max_depth = __atomic_load_n(&h->mem->max_depth, 
+					   __ATOMIC_RELAXED);
+	if(stats->max_depth < stats->depth)
+		stats->max_depth = stats->depth;
 
-	// free handle memory
-	free(handle);
+	return 0;
+}
 
-	return ret_val;
+int msgqx_reset_stats(void *handle)
+{
+	msgqx_h *h = handle;
+
+	if(_msgqx_param_check(h, h))
+		return 1;
+	if(__atomic_load_n(&h->mem->moved, __ATOMIC_ACQUIRE) && 
+	   _msgqx_remap(h) != 0)
+		return 3;
+
+	// counts added meanwhile may be lost
+	memset(h->mem->stats, 0, sizeof(h->mem->stats));
+	__atomic_store_n(&h->mem->max_depth, _msgqx_depth(h), 
+			 __ATOMIC_RELAXED);
+
+	return 0;
 }
 
-// generic interface for destroying a semaphore
-static int _msgqx_destroy_sem(const char *name)
+int msgqx_dropped(void *handle, unsigned long long *dropped)
 {
-	int ret_val = 0;
+	msgqx_h *h = handle;
+	msgqx_q *q;
+	unsigned long long head, tail;
+
+	if(_msgqx_param_check(h, dropped) || h->mode != MSGQX_MODE_LOSSY)
+		return 1;
+	q = h->mem;
+
+	// plus the messages overwritten that no receiver has skipped yet
+	head = __atomic_load_n(&q->head.pos, __ATOMIC_ACQUIRE);
+	tail = __atomic_load_n(&q->tail.pos, __ATOMIC_ACQUIRE);
+	*dropped = __atomic_load_n(&q->dropped, __ATOMIC_RELAXED);
+	if(tail - head > (unsigned long long)q->qlen && tail > head)
+		*dropped += tail - head - q->qlen;
+
+	return 0;
+}
+
+int msgqx_event_create(void *handle, int *fd)
+{
+	msgqx_h *h = handle;
+
+	if(_msgqx_param_check(h, fd) || h->efd >= 0)
+		return 1;
+
+	h->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(h->efd < 0){
+		CTX_DPRINTF("Cannot create an eventfd: %s\n", strerror(errno));
+		return 3;
+	}
+
+	// the senders find it in our process; the first message signals it
+	__atomic_store_n(&h->mem->efd, h->efd, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->mem->head.notify, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->mem->efd_pid, getpid(), __ATOMIC_RELEASE);
+	*fd = h->efd;
+
+	return 0;
+}
+
+int msgqx_event_open(void *handle, int *fd)
+{
+	msgqx_h *h = handle;
+	int pid;
+
+	if(_msgqx_param_check(h, fd) || h->efd >= 0)
+		return 1;
+
+	pid = __atomic_load_n(&h->mem->efd_pid, __ATOMIC_ACQUIRE);
+	if(pid == 0)
+		return 3;
+	if(pid == getpid())
+		h->efd = dup(h->mem->efd);
+	else{
+#if defined(SYS_pidfd_open) && defined(SYS_pidfd_getfd)
+		// copy the descriptor from the process that created it
+		int pidfd = syscall(SYS_pidfd_open, pid, 0);
+
+		if(pidfd >= 0){
+			h->efd = syscall(SYS_pidfd_getfd, pidfd, h->mem->efd,
+					 0);
+			close(pidfd);
+		}
+#else
+		// kernel headers before 5.6 cannot copy it
+		errno = ENOSYS;
+#endif
+	}
+	if(h->efd < 0){
+		CTX_DPRINTF("Cannot get the eventfd of process %d: %s\n", pid,
+			    strerror(errno));
+		h->efd = -1;
+		return 3;
+	}
+	*fd = h->efd;
+
+	return 0;
+}
+
+int msgqx_event_attach(void *handle, int fd)
+{
+	msgqx_h *h = handle;
+
+	if(_msgqx_param_check(h, h) || h->efd >= 0 || fd < 0)
+		return 1;
+
+	h->efd = fd;
+	// the queue has an eventfd now, even if we got it from elsewhere
+	if(__atomic_load_n(&h->mem->efd_pid, __ATOMIC_RELAXED) == 0){
+		__atomic_store_n(&h->mem->efd, fd, __ATOMIC_RELAXED);
+		__atomic_store_n(&h->mem->efd_pid, getpid(), __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+int msgqx_consumer(void *handle, int id)
+{
+	msgqx_h *h = handle;
+
+	if(_msgqx_param_check(h, h) || h->mode != MSGQX_MODE_JOURNAL || 
+	   id < 0 || id >= h->jnl->nsubs)
+		return 1;
+
+	h->sub = id;
+
+	return 0;
+}
+
+int msgqx_sync(void *handle)
+{
+	msgqx_h *h = handle;
+
+	if(_msgqx_param_check(h, h) || h->mode != MSGQX_MODE_JOURNAL)
+		return 1;
+
+	_msgqx_lock(h);
+	_msgqx_journal_sync(h);
+	_msgqx_unlock(h);
+
+	return 0;
+}
+
+int msgqx_subscribe(void *handle)
+{
+	msgqx_h *h = handle;
+	msgqx_q *q;
+	struct msgqx_sub *sub;
+	unsigned long long pos, tail;
+	unsigned int state;
+	int i;
+
+	if(_msgqx_param_check(h, h) || h->mode != MSGQX_MODE_BCAST || 
+	   h->sub >= 0)
+		return 1;
+	q = h->mem;
+
+	for(i = 0; i < q->nsubs; i++){
+		sub = &_msgqx_subs(q)[i];
+		state = MSGQX_SUB_FREE;
+		if(__atomic_load_n(&sub->state, __ATOMIC_RELAXED) == state &&
+		   __atomic_compare_exchange_n(&sub->state, &state, 
+					       MSGQX_SUB_ACTIVE, 0, 
+					       __ATOMIC_ACQUIRE,
+					       __ATOMIC_RELAXED))
+			break;
+	}
+	if(i == q->nsubs)
+		return 3;
+	sub = &_msgqx_subs(q)[i];
+
+	// start from the tail, and make sure that the sender has seen our
+	// cursor before it could overwrite the message at the tail
+	tail = __atomic_load_n(&q->tail.pos, __ATOMIC_ACQUIRE);
+	do{
+		pos = tail;
+		__atomic_store_n(&sub->pos, pos, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		tail = __atomic_load_n(&q->tail.pos, __ATOMIC_ACQUIRE);
+	}while(tail != pos);
+
+	h->sub = i;
+	h->tail = tail;
+
+	return 0;
+}
+
+int msgqx_unsubscribe(void *handle)
+{
+	msgqx_h *h = handle;
+
+	if(_msgqx_param_check(h, h) || h->mode != MSGQX_MODE_BCAST || 
+	   h->sub < 0)
+		return 1;
+
+	// the sender may be waiting for us
+	__atomic_store_n(&_msgqx_subs(h->mem)[h->sub].state, MSGQX_SUB_FREE,
+			 __ATOMIC_RELEASE);
+	h->sub = -1;
+	_msgqx_wake(&h->mem->tail, 1, h->futex_priv);
+
+	return 0;
+}
+
+int msgqx_pool_create(const char *name, unsigned long long buf_size,
+		      int nbufs, void *handle)
+{
+	int i, ret_val;
+	msgqx_h *h = handle;
+	msgqx_pool *p;
+	char name_buf[NAME_BUFFER_SIZE];
+	unsigned long long stride, data_off;
+
+	if(name == NULL || _msgqx_param_check(h, h) || h->pool != MAP_FAILED ||
+	   buf_size == 0 || nbufs <= 0 || h->name == NULL){
+		CTX_LOGERR("wrong parameters: name (%p), handle (%p), buf_size "
+			   "(%llu) and nbufs (%d)\n", name, handle, buf_size,
+			   nbufs);
+		return 1;
+	}
+
+	stride = (buf_size + MSGQX_CACHE_LINE - 1) & ~(MSGQX_CACHE_LINE - 1ULL);
+	data_off = (sizeof(msgqx_pool) + sizeof(struct msgqx_pool_buf) * nbufs
+		    + MSGQX_POOL_ALIGN - 1) & ~(MSGQX_POOL_ALIGN - 1ULL);
+
+	// the pool is placed like its queue
+	_msgqx_get_obj_name(name_buf, name, msgq_pool);
+	h->pool_size = data_off + stride * nbufs;
+	ret_val = _msgqx_map_new(name_buf, h->mem->flags, h->mem->numa_node,
+				 &h->pool_size, &h->pool_fd, (void**)&h->pool);
+	if(ret_val != 0){
+		unmap_shared_mem((void*)h->pool, h->pool_size, h->pool_fd);
+		h->pool = MAP_FAILED;
+		h->pool_fd = -1;
+		return 3;
+	}
+
+	// all buffers are free
+	p = h->pool;
+	p->nbufs = nbufs;
+	p->buf_size = buf_size;
+	p->stride = stride;
+	p->data_off = data_off;
+	for(i = 0; i < nbufs; i++){
+		p->bufs[i].next = i + 1 < nbufs ? i + 1 : MSGQX_POOL_NONE;
+		p->bufs[i].ref = 0;
+	}
+	p->top = 0;
+	memset(&p->avail, 0, sizeof(struct msgqx_index));
+	__atomic_store_n(&p->magic, MSGQX_MAGIC, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+int msgqx_pool_open(const char *name, void *handle)
+{
+	msgqx_h *h = handle;
+	char name_buf[NAME_BUFFER_SIZE];
+
+	if(name == NULL || _msgqx_param_check(h, h) || h->pool != MAP_FAILED ||
+	   h->name == NULL){
+		CTX_LOGERR("wrong parameters: name (%p), handle (%p)\n", name,
+			   handle);
+		return 1;
+	}
+
+	_msgqx_get_obj_name(name_buf, name, msgq_pool);
+	if(map_shared_mem(name_buf, 0, &h->pool_size, &h->pool_fd, 
+			  (void**)&h->pool) != 0 ||
+	   h->pool_size < sizeof(msgqx_pool) ||
+	   __atomic_load_n(&h->pool->magic, __ATOMIC_ACQUIRE) != MSGQX_MAGIC){
+		CTX_DPRINTF("Payload pool of %s is not ready\n", name);
+		unmap_shared_mem((void*)h->pool, h->pool_size, h->pool_fd);
+		h->pool = MAP_FAILED;
+		h->pool_fd = -1;
+		return 3;
+	}
+
+	return 0;
+}
+
+// pop a buffer from the free stack, return 1 if a buffer is allocated
+static int _msgqx_pool_get(msgqx_h *h, void *data, int n)
+{
+	msgqx_pool *p = h->pool;
+	struct msgqx_desc *desc = data;
+	unsigned long long top, new_top;
+	unsigned int idx;
+
+	top = __atomic_load_n(&p->top, __ATOMIC_ACQUIRE);
+	do{
+		idx = (unsigned int)top;
+		if(idx == MSGQX_POOL_NONE)
+			return 0;
+		// the tag changes on every update, so a stale next is caught
+		// by the CAS
+		new_top = ((top >> 32) + 1) << 32 |
+			__atomic_load_n(&p->bufs[idx].next, __ATOMIC_RELAXED);
+	}while(!__atomic_compare_exchange_n(&p->top, &top, new_top, 1,
+					    __ATOMIC_ACQUIRE, 
+					    __ATOMIC_ACQUIRE));
+
+	__atomic_store_n(&p->bufs[idx].ref, 1, __ATOMIC_RELAXED);
+	desc->offset = p->data_off + p->stride * idx;
+
+	return 1;
+}
+
+// push a buffer back to the free stack, and wake up a waiting allocator
+static void _msgqx_pool_put(msgqx_pool *p, unsigned int idx)
+{
+	unsigned long long top, new_top;
+
+	top = __atomic_load_n(&p->top, __ATOMIC_RELAXED);
+	do{
+		__atomic_store_n(&p->bufs[idx].next, (unsigned int)top, 
+				 __ATOMIC_RELAXED);
+		new_top = ((top >> 32) + 1) << 32 | idx;
+	}while(!__atomic_compare_exchange_n(&p->top, &top, new_top, 1,
+					    __ATOMIC_RELEASE, 
+					    __ATOMIC_RELAXED));
+
+	_msgqx_wake(&p->avail, 1, 0);
+}
+
+// locate the buffer of a descriptor; return its index, or -1 if the
+// descriptor is not valid
+static int _msgqx_pool_idx(msgqx_h *h, struct msgqx_desc *desc)
+{
+	msgqx_pool *p;
+	unsigned long long off;
+
+	if(h == NULL || h->pool == MAP_FAILED || desc == NULL)
+		return -1;
+	p = h->pool;
+	if(desc->offset < p->data_off || desc->len > p->buf_size)
+		return -1;
 
-	ret_val = sem_unlink(name);
+	off = desc->offset - p->data_off;
+	if(off % p->stride != 0 || off / p->stride >= (unsigned)p->nbufs)
+		return -1;
+
+	return (int)(off / p->stride);
+}
+
+// generic interface for allocating a buffer
+static int _msgqx_pool_alloc(msgqx_h *h, unsigned long long len, 
+			     struct msgqx_desc *desc, void **buf,
+			     msgqx_wty wait_type, int sec, int nsec)
+{
+	int cnt, ret_val;
+
+	if(_msgqx_param_check(h, desc) || h->pool == MAP_FAILED || 
+	   len > h->pool->buf_size)
+		return 1;
+
+	ret_val = _msgqx_xfer(h, desc, 1, &cnt, _msgqx_pool_get, 
+			      &h->pool->avail, NULL, wait_type, sec, nsec);
 	if(ret_val != 0)
-		CTX_DPRINTF("Cannot destroy semaphore %s: %s\n", 
-			    name, strerror(errno));
-	
-	return ret_val;
+		return ret_val;
+
+	desc->len = len;
+	if(buf != NULL)
+		*buf = (unsigned char*)h->pool + desc->offset;
+
+	return 0;
+}
+
+int msgqx_pool_alloc(void *handle, unsigned long long len, 
+		     struct msgqx_desc *desc, void **buf)
+{
+	return _msgqx_pool_alloc((msgqx_h*)handle, len, desc, buf, blockedwait,
+				 0, 0);
+}
+
+int msgqx_pool_tryalloc(void *handle, unsigned long long len, 
+			struct msgqx_desc *desc, void **buf)
+{
+	return _msgqx_pool_alloc((msgqx_h*)handle, len, desc, buf, trywait,
+				 0, 0);
+}
+
+int msgqx_pool_timedalloc(void *handle, unsigned long long len, 
+			  struct msgqx_desc *desc, void **buf, int sec, 
+			  int nsec)
+{
+	return _msgqx_pool_alloc((msgqx_h*)handle, len, desc, buf, timedwait,
+				 sec, nsec);
+}
+
+int msgqx_pool_get(void *handle, struct msgqx_desc *desc, void **buf)
+{
+	msgqx_h *h = handle;
+
+	if(buf == NULL || _msgqx_pool_idx(h, desc) < 0)
+		return 1;
+
+	*buf = (unsigned char*)h->pool + desc->offset;
+
+	return 0;
+}
+
+int msgqx_pool_ref(void *handle, struct msgqx_desc *desc, int n)
+{
+	msgqx_h *h = handle;
+	int idx = _msgqx_pool_idx(h, desc);
+
+	if(idx < 0 || n <= 0 || 
+	   __atomic_load_n(&h->pool->bufs[idx].ref, __ATOMIC_RELAXED) == 0)
+		return 1;
+
+	__atomic_add_fetch(&h->pool->bufs[idx].ref, n, __ATOMIC_RELAXED);
+
+	return 0;
 }
 
-// generic interface for destroying a shared memory
-static int _msgqx_destroy_shm(const char *name)
+int msgqx_pool_free(void *handle, struct msgqx_desc *desc)
+{
+	msgqx_h *h = handle;
+	int idx = _msgqx_pool_idx(h, desc);
+
+	if(idx < 0 || 
+	   __atomic_load_n(&h->pool->bufs[idx].ref, __ATOMIC_RELAXED) == 0)
+		return 1;
+
+	// the last reference returns the buffer; the release pairs with the
+	// acquire of the next allocation, so reads of the payload are done
+	if(__atomic_sub_fetch(&h->pool->bufs[idx].ref, 1, 
+			      __ATOMIC_ACQ_REL) == 0)
+		_msgqx_pool_put(h->pool, idx);
+
+	return 0;
+}
+
+int msgqx_close(void *handle)
 {
 	int ret_val = 0;
+	msgqx_h *h = handle;
 
-	ret_val = shm_unlink(name);
-	if(ret_val != 0)
-		CTX_DPRINTF("Cannot destroy shared memory %s: "
-			    " %s\n", name, strerror(errno));
+	if(h == NULL)
+		return 1;
+
+	if(h->sub >= 0)
+		msgqx_unsubscribe(h);
+
+	// publish the coalesced messages that fit, the rest are lost
+	if(h->ccnt > 0 && _msgqx_flush(h, trywait, 0, 0))
+		CTX_DPRINTF("%d coalesced messages dropped\n", h->ccnt);
+	free(h->cbuf);
+	free(h->name);
+
+	if(h->jnl != MAP_FAILED){
+		size_t seg_size = (size_t)h->jnl->seg_len * h->jnl->msg_size;
+
+		unmap_shared_mem(h->jseg_mem[0], seg_size, h->jseg_fd[0]);
+		unmap_shared_mem(h->jseg_mem[1], seg_size, h->jseg_fd[1]);
+	}
+	unmap_shared_mem(h->jnl, h->jnl_size, h->jnl_fd);
+
+	if(h->efd >= 0){
+		int pid = getpid();
+
+		// other processes cannot copy our eventfd any more
+		if(h->mem->efd == h->efd)
+			__atomic_compare_exchange_n(&h->mem->efd_pid, &pid, 0, 
+						    0, __ATOMIC_RELAXED,
+						    __ATOMIC_RELAXED);
+		close(h->efd);
+	}
+
+	// un-map and close shared memory; the memory of a private queue goes
+	// with its last handle
+	if(h->mem != NULL && h->mem != MAP_FAILED && 
+	   (h->mem->flags & MSGQX_PRIVATE) &&
+	   __atomic_sub_fetch(&h->mem->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		h->mem = MAP_FAILED;
+	if(h->mem != NULL)
+		ret_val |= unmap_shared_mem((void*)h->mem, h->mem_size, 
+					    h->shm_fd);
+	ret_val |= unmap_shared_mem((void*)h->pool, h->pool_size, h->pool_fd);
+
+	// free handle memory
+	free(handle);
 
 	return ret_val;
 }
 
-// generic function for destroying semaphores and shared memory
+// generic function for destroying the shared memory
 int msgqx_destroy(const char *name)
 {
 	int ret_val = 0;
 
-	char name_buf[NAME_BUFFER_SIZE];
+	char name_buf[NAME_BUFFER_SIZE], gen_buf[GEN_NAME_BUFFER_SIZE];
+	size_t size = 0;
+	int fd;
+	msgqx_q *q;
+
+	if(name == NULL || strlen(name) > MSGQX_MAX_NAME)
+		return 1;
 
-	// destroy the receiving semaphore
-	_msgqx_get_obj_name(name_buf, name, recv_sem);
-	ret_val |= _msgqx_destroy_sem(name_buf);
-	// destroy the sending semaphore
-	_msgqx_get_obj_name(name_buf, name, send_sem);
-	ret_val |= _msgqx_destroy_sem(name_buf);
-	// destroy the message queue mutex
-	_msgqx_get_obj_name(name_buf, name, mutex_sem);
-	ret_val |= _msgqx_destroy_sem(name_buf);
-	// destroy the shared memory
+	// destroy the shared memory, and the newest generation of a resized
+	// queue; the older ones are removed by the resize
 	_msgqx_get_obj_name(name_buf, name, msgq_shm);
-	ret_val |= _msgqx_destroy_shm(name_buf);
+	if(map_shared_mem(name_buf, 0, &size, &fd, (void**)&q) == 0){
+		if(size >= sizeof(msgqx_q) && q->cur_gen > 0){
+			_msgqx_get_gen_name(gen_buf, name_buf, q->cur_gen);
+			destroy_shared_mem(gen_buf, 0);
+		}
+		unmap_shared_mem(q, size, fd);
+	}
+	ret_val |= destroy_shared_mem(name_buf, 0);
+	// the queue may have no payload pool
+	_msgqx_get_obj_name(name_buf, name, msgq_pool);
+	destroy_shared_mem(name_buf, 0);
 		
 	return ret_val;
 }
-
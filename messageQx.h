@@ -1,5 +1,6 @@
 /*
- * The header file of a general message queue.
+ * The header file of a general message queue. A queue lives in one named
+ * shared memory object, which also holds all its synchronization state.
  * 
  * Author: Wei Wang <wwang@virginia.edu>
  */
@@ -10,24 +11,163 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
+
+/*
+ * Modes of a message queue, selected when the queue is created.
+ *     MSGQX_MODE_LOCKED: any number of senders and receivers, the queue is
+ *                        protected by a lock (default). The queue may have
+ *                        several priority lanes (attr.lanes).
+ *     MSGQX_MODE_SPSC: exactly one sender and one receiver at a time. The
+ *                      queue is lock-free; a side only waits for the other
+ *                      when the queue is empty or full.
+ *     MSGQX_MODE_MPMC: any number of senders and receivers, lock-free; a
+ *                      sender or receiver only waits for the others when
+ *                      the queue is full or empty.
+ *     MSGQX_MODE_VAR: variable-length messages up to the message size, any
+ *                     number of senders and receivers, protected by a lock.
+ *                     The queue is a ring of bytes as large as len messages
+ *                     of the largest size, and each message only takes its
+ *                     length plus a small header. Use msgqx_send_len and
+ *                     msgqx_receive_len to send and receive messages.
+ *     MSGQX_MODE_BCAST: one sender and up to attr.subscribers subscribers.
+ *                       Every message is received by every subscriber,
+ *                       which calls msgqx_subscribe first. The sender waits
+ *                       for the slowest subscriber, unless the queue drops
+ *                       slow subscribers (MSGQX_DROP_SLOW).
+ *     MSGQX_MODE_LOSSY: one sender and any number of receivers. The sender
+ *                       never waits: when the queue is full, it overwrites
+ *                       the oldest message, which is then counted as 
+ *                       dropped (see msgqx_dropped). Reserve and peek are
+ *                       not supported.
+ *     MSGQX_MODE_JOURNAL: a durable queue kept in files, with any number of
+ *                         senders and attr.subscribers consumers. Every 
+ *                         consumer receives every message, from where it
+ *                         left off, also after the queue is created again
+ *                         over the same files, e.g., after a reboot. The
+ *                         messages are appended to segment files of len
+ *                         messages, attr.path/name.0, .1, ..., which are
+ *                         removed once every consumer has passed them; 
+ *                         attr.path/name.meta keeps the consumer offsets. 
+ *                         Every receiving handle selects a consumer with 
+ *                         msgqx_consumer. Reserve and peek are not 
+ *                         supported, and msgqx_destroy keeps the files.
+ */
+#define MSGQX_MODE_LOCKED 0
+#define MSGQX_MODE_SPSC 1
+#define MSGQX_MODE_MPMC 2
+#define MSGQX_MODE_VAR 3
+#define MSGQX_MODE_BCAST 4
+#define MSGQX_MODE_LOSSY 5
+#define MSGQX_MODE_JOURNAL 6
+
+/*
+ * Attributes of a new message queue. Initialize it with msgqx_attr_init
+ * before setting the fields.
+ */
+struct msgqx_attr{
+	int mode; // the mode of the queue, MSGQX_MODE_*
+	int spin; // how many times to retry (or to try the lock) before
+	          // sleeping, when the queue is full or empty
+	int flags; // the layout and memory options below
+	int numa_node; // bind the memory to this NUMA node, -1 for any node
+	int subscribers; // broadcast mode: the maximum number of subscribers
+	int lanes; // locked mode: the number of priority lanes, each of len
+	           // messages; lane 0 has the highest priority
+	int starve; // locked mode: serve a non-empty lane after it has been
+	            // passed over starve times for higher lanes, 0 for strict
+	            // priority
+	const char *path; // journal mode: the directory of the files
+	int sync_us; // journal mode: sync the files to disk at most every 
+	             // sync_us microseconds while the queue is used, 0 for 
+	             // every call, -1 to leave it to the system
+};
+
+#define MSGQX_MAX_LANES 8
+#define MSGQX_MAX_ANY 128
+#define MSGQX_PATH_SIZE 256 // the longest attr.path/name, with the '\0'
+#define MSGQX_MAX_NAME 50 // the longest name of a queue
+#define MSGQX_DEFAULT_SYNC_US 1000
+
+#define MSGQX_DEFAULT_SPIN 100
+
+/*
+ * Layout and memory options of a queue, also applied to its payload pool.
+ *     MSGQX_ALIGN_SLOTS: pad every slot to a multiple of the cache line, so
+ *                        that two messages never share a line (not for the
+ *                        variable-length mode)
+ *     MSGQX_HUGEPAGE: back the queue with transparent huge pages, if the
+ *                     system allows them for shared memory
+ *     MSGQX_PREFAULT: fault in all pages when the queue is created
+ *     MSGQX_MLOCK: lock all pages in memory when the queue is created
+ *     MSGQX_DROP_SLOW: broadcast mode: instead of waiting for a subscriber
+ *                      that has not received any of the messages in the 
+ *                      queue, drop it; it may subscribe again to skip to
+ *                      the newest messages
+ *     MSGQX_PRIVATE: the queue is for the threads of one process only. It
+ *                    lives in private memory without a name (the name of
+ *                    the queue may be NULL), and its futexes are private
+ *                    to the process. Every thread gets its own handle with
+ *                    msgqx_dup, and the memory is freed with the last
+ *                    handle, so there is nothing to destroy. A private 
+ *                    queue cannot be opened, resized, given a payload 
+ *                    pool, or be in the journal mode.
+ *     MSGQX_TRACK_DEPTH: keep the high-water mark of the depth (see struct
+ *                        msgqx_stats) at every send. Without it, the mark
+ *                        is only kept when a sender waits for a full queue
+ *                        and when the statistics are read, so that a send
+ *                        does not read the other end of the queue.
+ */
+#define MSGQX_ALIGN_SLOTS 0x1
+#define MSGQX_HUGEPAGE 0x2
+#define MSGQX_PREFAULT 0x4
+#define MSGQX_MLOCK 0x8
+#define MSGQX_DROP_SLOW 0x10
+#define MSGQX_PRIVATE 0x20
+#define MSGQX_TRACK_DEPTH 0x40
+
+/*
+ * Initialize the attributes with the default values.
+ * Return values:
+ *     0: success
+ *     1: attr is NULL
+ */
+int msgqx_attr_init(struct msgqx_attr *attr);
+
 /*
  * Create a new message queue.
  *
  * Input parameters:
- *     name: the name of message queue;
+ *     name: the name of message queue, up to MSGQX_MAX_NAME characters;
  *     size: the size of each message;
  *     len: maximum number of messages in the queue
  * Ouput parameters:
  *     handle: the handle to the message queue;
  * Return values:
  *     0: success
- *     1: failed to create receiving semaphore
- *     2: failed to create sending semaphore
+ *     1: wrong parameters, or the name is too long
  *     3: failed to create shared memory
- *     4: failed to create message queue mutex
  */
 int msgqx_create(const char * name, int size, int len, void ** handle);
 
+/*
+ * Create a new message queue with attributes. msgqx_create is the same as
+ * this function with default attributes. Processes that open the queue
+ * later get the same mode.
+ *
+ * Input parameters:
+ *     name, size, len: see msgqx_create; name can be NULL with 
+ *                      MSGQX_PRIVATE
+ *     attr: the attributes of the queue, NULL for the default attributes
+ * Ouput parameters:
+ *     handle: the handle to the message queue;
+ * Return values:
+ *     0: success
+ *     1: wrong parameters or attributes
+ *     3: failed to create shared memory, or to place it as attr asks
+ */
+int msgqx_create_attr(const char *name, int size, int len, 
+		      struct msgqx_attr *attr, void **handle);
+
 /*
  * Open an existing message queue.
  *
@@ -38,16 +178,32 @@ int msgqx_create(const char * name, int size, int len, void ** handle);
  *     size: the size of each message (should be)
  * Return values:
  *     0: success
- *     1: failed to open receiving semaphore
- *     2: failed to open sending semaphore
- *     3: failed to open shared memory
- *     4: failed to create message queue mutex
+ *     1: wrong parameters, or the name is too long
+ *     3: failed to open shared memory, or the queue is not initialized
  */
 int msgqx_open(const char *name, void **handle, int *size);
 
+/*
+ * Make another handle to a private queue (MSGQX_PRIVATE), for another thread
+ * of the process. The handles are closed with msgqx_close, and the queue is
+ * freed when the last one is closed.
+ *
+ * Input parameters:
+ *     handle: a handle to the private queue
+ * Ouput parameters:
+ *     h: the new handle
+ * Return values:
+ *     0: success
+ *     1: wrong parameters, or the queue is not private
+ *     3: failed to allocate the handle
+ */
+int msgqx_dup(void *handle, void **h);
+
 /*
  * Send a message to th queue. Note that it is the sender's responsibility to 
- * make sure that the size of data is proper. 
+ * make sure that the size of data is proper. When the queue is full, a
+ * blocked or timed send retries for a while before it sleeps. The timeout of
+ * a timed send is measured with the monotonic clock.
  *
  * Input parameters:
  *     handle: the handle to the message queue
@@ -58,12 +214,9 @@ int msgqx_open(const char *name, void **handle, int *size);
  * Return values:
  *     0: success
  *     1: invalid parameters
- *     2: the queue is full (bug?)
- *     3: error when waiting from semaphore
- *     4: failed to acquire the message queue for try send
- *     5: failed to acquire the message queue for timed send
- *     6: failed to post received semaphore
- *     7: failed to release the message queue
+ *     3: error when waiting for the queue
+ *     4: the queue is full for try send
+ *     5: the queue stayed full for timed send
  */
 int msgqx_send(void *handle, void *data);
 int msgqx_trysend(void *handle, void *data);
@@ -82,17 +235,450 @@ int msgqx_timedsend(void *handle, void *data, int sec, int nsec);
  * Return values:
  *     0: success
  *     1: invalid parameters
- *     2: the queue is empty (bug?)
- *     3: error when waiting from semaphore
- *     4: failed to acquire the message queue for try receive
- *     5: failed to acquire the message queue for timed receive
- *     6: failed to post received semaphore
- *     7: failed to release the message queue
+ *     3: error when waiting for the queue
+ *     4: the queue is empty for try receive
+ *     5: the queue stayed empty for timed receive
+ *     7: broadcast mode: the subscriber has been dropped and unsubscribed
  */
 int msgqx_receive(void *handle, void *buf);
 int msgqx_tryreceive(void *handle, void *buf);
 int msgqx_timedreceive(void *handle, void *buf, int sec, int nsec);
 
+/*
+ * Send or receive a batch of messages. A batch call waits like the single
+ * message call until at least one message can be moved, then moves as many of
+ * the n messages as the queue allows at once, with one lock acquisition (or 
+ * one index update) and a single wake-up of the other side. The messages are
+ * stored back to back in data or buf.
+ *
+ * Input parameters:
+ *     handle: the handle to the message queue
+ *     data: n messages to send
+ *     n: the maximum number of messages to send or receive
+ * Input parameters for timed calls:
+ *     sec: seconds to wait
+ *     nsec: nanoseconds to wait
+ * Ouput parameters:
+ *     buf: the received messages, must hold n messages
+ *     sent/received: the number of messages moved, can be NULL
+ * Return values:
+ *     same as msgqx_send/msgqx_receive; n must be 1 in the variable-length
+ *     mode
+ */
+int msgqx_send_batch(void *handle, void *data, int n, int *sent);
+int msgqx_trysend_batch(void *handle, void *data, int n, int *sent);
+int msgqx_timedsend_batch(void *handle, void *data, int n, int *sent,
+			  int sec, int nsec);
+int msgqx_receive_batch(void *handle, void *buf, int n, int *received);
+int msgqx_tryreceive_batch(void *handle, void *buf, int n, int *received);
+int msgqx_timedreceive_batch(void *handle, void *buf, int n, int *received,
+			     int sec, int nsec);
+
+/*
+ * Coalesce the messages sent with a handle. msgqx_send, msgqx_trysend and 
+ * msgqx_timedsend then copy the message into a buffer of the handle, and 
+ * the buffer is published with one batch send when it is full, when a send
+ * finds that the oldest message in it has waited for usec microseconds, or
+ * on msgqx_flush. A try or timed send returns 4 or 5 only if the buffer is 
+ * full and cannot be published. The other sends of the handle publish the
+ * buffer first, so the messages stay in order. Not in the variable-length
+ * mode.
+ *
+ * The delay is only checked by the sends; a sender that may stop sending 
+ * for a while calls msgqx_flush_timeout to learn how long it can wait 
+ * before it must flush: -1 when nothing is buffered. msgqx_close publishes
+ * the buffered messages that fit without waiting, the rest are lost.
+ *
+ * Input parameters:
+ *     handle: the handle to the message queue
+ *     max_msgs: the size of the buffer in messages, 0 or 1 to stop 
+ *               coalescing
+ *     usec: how long a message may stay in the buffer, in microseconds
+ * Ouput parameters:
+ *     usec: the time left before the buffer must be flushed
+ * Return values:
+ *     0: success
+ *     1: invalid parameters
+ *     2: cannot allocate the buffer
+ *     3, 4, 5: as msgqx_send, for flushing the buffer
+ */
+int msgqx_set_coalesce(void *handle, int max_msgs, int usec);
+int msgqx_flush(void *handle);
+int msgqx_tryflush(void *handle);
+int msgqx_flush_timeout(void *handle, int *usec);
+
+/*
+ * Send a message to a lane, or receive a message and the lane it comes
+ * from. A receiver takes the messages of the first non-empty lane (see 
+ * attr.starve), and the calls without a lane send to lane 0. A queue 
+ * without lanes has only lane 0.
+ *
+ * Input parameters:
+ *     handle: the handle to the message queue
+ *     data: the message to send
+ *     lane: the lane to send to
+ * Input parameters for timed calls:
+ *     sec: seconds to wait
+ *     nsec: nanoseconds to wait
+ * Ouput parameters:
+ *     buf: the received message
+ *     lane: the lane of the received message, can be NULL
+ * Return values:
+ *     same as msgqx_send/msgqx_receive; 4 and 5 for a send mean that the 
+ *     lane is full
+ */
+int msgqx_send_lane(void *handle, void *data, int lane);
+int msgqx_trysend_lane(void *handle, void *data, int lane);
+int msgqx_timedsend_lane(void *handle, void *data, int lane, int sec, 
+			 int nsec);
+int msgqx_receive_lane(void *handle, void *buf, int *lane);
+int msgqx_tryreceive_lane(void *handle, void *buf, int *lane);
+int msgqx_timedreceive_lane(void *handle, void *buf, int *lane, int sec, 
+			    int nsec);
+
+/*
+ * Receive a message from any of n queues, waiting on all of them at once.
+ * The queues are tried in turn from the one after *which, so pass back the
+ * *which of the last call and a busy queue cannot starve the others. The
+ * queues can be in different modes; buf must be large enough for the
+ * messages of all of them.
+ *
+ * Input parameters:
+ *     handles: the handles to the message queues
+ *     n: the number of queues, at most MSGQX_MAX_ANY
+ *     which: the queue received from last time, -1 to start from the first
+ *     sec: seconds to wait
+ *     nsec: nanoseconds to wait
+ * Ouput parameters:
+ *     buf: the received message
+ *     which: the index of the queue the message is from
+ * Return values:
+ *     same as msgqx_receive; for 7, which is the dropped subscriber
+ */
+int msgqx_receive_any(void **handles, int n, void *buf, int *which);
+int msgqx_tryreceive_any(void **handles, int n, void *buf, int *which);
+int msgqx_timedreceive_any(void **handles, int n, void *buf, int *which,
+			   int sec, int nsec);
+
+/*
+ * Send or receive a message of any length up to the message size, in the
+ * variable-length mode. msgqx_send and msgqx_receive also work in this mode,
+ * for messages of the largest size.
+ *
+ * Input parameters:
+ *     handle: the handle to the message queue
+ *     data: the message to send
+ *     len: the length of the message to send
+ *     size: the size of buf
+ * Input parameters for timed calls:
+ *     sec: seconds to wait
+ *     nsec: nanoseconds to wait
+ * Ouput parameters:
+ *     buf: the received message
+ *     len: the length of the received message
+ * Return values:
+ *     0: success
+ *     1: invalid parameters, or the queue is not in the variable-length mode
+ *     3, 4, 5: same as msgqx_send/msgqx_receive
+ *     6: buf is smaller than the message, which stays in the queue; its 
+ *        length is returned in len
+ */
+int msgqx_send_len(void *handle, void *data, int len);
+int msgqx_trysend_len(void *handle, void *data, int len);
+int msgqx_timedsend_len(void *handle, void *data, int len, int sec, int nsec);
+int msgqx_receive_len(void *handle, void *buf, int size, int *len);
+int msgqx_tryreceive_len(void *handle, void *buf, int size, int *len);
+int msgqx_timedreceive_len(void *handle, void *buf, int size, int *len,
+			   int sec, int nsec);
+
+/*
+ * Zero-copy send: reserve the next free slot of the queue (of lane 0), build
+ * the message right in the slot, and commit it to make it visible to the 
+ * receivers. A handle holds at most one reserved slot. Reserve waits like 
+ * msgqx_send when the queue is full.
+ *
+ * In the locked mode the queue stays locked from reserve to commit, so
+ * the message should be built quickly, and no other queue function may be
+ * called with the same queue in between. In the lock-free modes, receivers
+ * may have to wait for a reserved slot that is not committed yet.
+ *
+ * Input parameters:
+ *     handle: the handle to the message queue
+ * Input parameters for timed reserve:
+ *     sec: seconds to wait
+ *     nsec: nanoseconds to wait
+ * Ouput parameters:
+ *     slot: the address of the reserved slot, msg_size bytes
+ * Return values:
+ *     0: success
+ *     1: invalid parameters, a slot is already reserved (reserve) or no
+ *        slot is reserved (commit), or the queue is in the variable-length,
+ *        the broadcast or the lossy mode
+ *     3, 4, 5: same as msgqx_send
+ */
+int msgqx_reserve(void *handle, void **slot);
+int msgqx_tryreserve(void *handle, void **slot);
+int msgqx_timedreserve(void *handle, void **slot, int sec, int nsec);
+int msgqx_commit(void *handle);
+
+/*
+ * Zero-copy receive: peek at the oldest message in place, and release it to
+ * free its slot for the senders. A handle holds at most one peeked message.
+ * Peek waits like msgqx_receive when the queue is empty. In the MPMC mode,
+ * the peeked message is taken from the queue, and other receivers do not see
+ * it. The restrictions of the locked mode are the same as msgqx_reserve.
+ *
+ * Input parameters:
+ *     handle: the handle to the message queue
+ * Input parameters for timed peek:
+ *     sec: seconds to wait
+ *     nsec: nanoseconds to wait
+ * Ouput parameters:
+ *     msg: the address of the message in the queue, valid until released
+ * Return values:
+ *     0: success
+ *     1: invalid parameters, a message is already peeked (peek) or no
+ *        message is peeked (release), or the queue is in the 
+ *        variable-length, the broadcast or the lossy mode
+ *     3, 4, 5: same as msgqx_receive
+ */
+int msgqx_peek(void *handle, void **msg);
+int msgqx_trypeek(void *handle, void **msg);
+int msgqx_timedpeek(void *handle, void **msg, int sec, int nsec);
+int msgqx_release(void *handle);
+
+/*
+ * A payload pool can be attached to a queue to send large payloads without
+ * copying them. The pool is a slab of nbufs buffers of buf_size bytes in its
+ * own shared memory object. A sender allocates a buffer, fills it, and sends
+ * its descriptor through the queue, which should have messages of the size
+ * of struct msgqx_desc. A receiver locates the payload with msgqx_pool_get,
+ * reads it in place, and frees it. The descriptor is only meaningful to the
+ * processes that attached the pool of the same queue.
+ */
+struct msgqx_desc{
+	unsigned long long offset; // the offset of the buffer in the pool
+	unsigned long long len; // the length of the payload
+};
+
+/*
+ * Create the payload pool of a queue and attach it to a handle, or attach
+ * the existing pool. The pool is destroyed along with the queue.
+ *
+ * Input parameters:
+ *     name: the name of message queue
+ *     buf_size: the size of each buffer
+ *     nbufs: the number of buffers
+ *     handle: the handle to the message queue
+ * Return values:
+ *     0: success
+ *     1: wrong parameters, or a pool is already attached
+ *     3: failed to create or open shared memory, or the pool is not 
+ *        initialized
+ */
+int msgqx_pool_create(const char *name, unsigned long long buf_size, 
+		      int nbufs, void *handle);
+int msgqx_pool_open(const char *name, void *handle);
+
+/*
+ * Allocate a buffer of the pool with a reference count of 1. When the pool
+ * is empty, a blocked or timed allocation waits for a buffer to be freed.
+ *
+ * Input parameters:
+ *     handle: the handle to the message queue
+ *     len: the length of the payload, at most buf_size
+ * Input parameters for timed allocation:
+ *     sec: seconds to wait
+ *     nsec: nanoseconds to wait
+ * Ouput parameters:
+ *     desc: the descriptor of the buffer
+ *     buf: the address of the buffer, can be NULL
+ * Return values:
+ *     0: success
+ *     1: invalid parameters, or no pool is attached
+ *     3: error when waiting for the pool
+ *     4: the pool is empty for try allocation
+ *     5: the pool stayed empty for timed allocation
+ */
+int msgqx_pool_alloc(void *handle, unsigned long long len, 
+		     struct msgqx_desc *desc, void **buf);
+int msgqx_pool_tryalloc(void *handle, unsigned long long len, 
+			struct msgqx_desc *desc, void **buf);
+int msgqx_pool_timedalloc(void *handle, unsigned long long len, 
+			  struct msgqx_desc *desc, void **buf, int sec, 
+			  int nsec);
+
+/*
+ * Locate the buffer of a descriptor, add n references to a buffer (e.g.,
+ * before sending its descriptor to n more receivers), or drop a reference.
+ * The buffer is returned to the pool when its last reference is dropped.
+ *
+ * Input parameters:
+ *     handle: the handle to the message queue
+ *     desc: the descriptor of the buffer
+ *     n: the number of references to add
+ * Ouput parameters:
+ *     buf: the address of the buffer
+ * Return values:
+ *     0: success
+ *     1: invalid parameters or descriptor, or the buffer is free (ref and 
+ *        free)
+ */
+int msgqx_pool_get(void *handle, struct msgqx_desc *desc, void **buf);
+int msgqx_pool_ref(void *handle, struct msgqx_desc *desc, int n);
+int msgqx_pool_free(void *handle, struct msgqx_desc *desc);
+
+/*
+ * Wait for a queue with poll, select or epoll. A receiver creates an 
+ * eventfd for the queue, and every sender opens the same eventfd: it is
+ * copied from the process of the receiver (this needs the permission to
+ * ptrace that process), or it is passed to the sender by other means, e.g.,
+ * inherited or sent over a Unix socket, and attached to its handle. 
+ *
+ * The eventfd is signaled by the first message after it is created, and then
+ * by the first message after a receiver has found the queue empty. So once
+ * the fd is readable, read it to clear it, and receive with the try calls
+ * until they return 4. The eventfd is closed
+ * with the handle.
+ *
+ * Input parameters:
+ *     handle: the handle to the message queue
+ *     fd: the eventfd to attach
+ * Ouput parameters:
+ *     fd: the eventfd created or opened
+ * Return values:
+ *     0: success
+ *     1: invalid parameters, or the handle already has an eventfd
+ *     3: failed to create or open the eventfd, or the queue has none
+ */
+int msgqx_event_create(void *handle, int *fd);
+int msgqx_event_open(void *handle, int *fd);
+int msgqx_event_attach(void *handle, int fd);
+
+/*
+ * Change the length of a queue in the locked or the variable-length mode
+ * while it is in use, to absorb a burst or to give memory back. The messages
+ * in the queue are copied into a new shared memory segment, and the ring of 
+ * the old one is released. The other handles follow the queue into the new 
+ * segment the next time they use it. A slot reserved or a message peeked by
+ * another handle holds the queue, so the resize waits for its commit or 
+ * release.
+ *
+ * Input parameters:
+ *     handle: the handle to the message queue
+ *     len: the new length of the queue (of each lane)
+ * Return values:
+ *     0: success
+ *     1: invalid parameters, the queue is in another mode, or the handle has
+ *        a reserved slot or a peeked message
+ *     3: failed to create the new segment
+ *     4: the queue holds more messages than the new length
+ */
+int msgqx_resize(void *handle, int len);
+
+#define MSGQX_STAT_BUCKETS 24
+
+/*
+ * Live statistics of a queue, summed over all its handles. A wait is a call
+ * that found the queue full (send, reserve) or empty (receive, peek), and
+ * spun or slept until it was not, or until its time ran out. Bucket i of a
+ * wait-time histogram counts the waits from 2^(i-1) up to 2^i microseconds 
+ * (bucket 0 the ones under a microsecond), and the last bucket also counts
+ * all the longer ones.
+ */
+struct msgqx_stats{
+	unsigned long long sent; // messages sent
+	unsigned long long received; // messages received, by any subscriber
+	                             // or consumer in the broadcast and the
+	                             // journal modes
+	unsigned long long depth; // messages in the queue now, for the 
+	                          // slowest subscriber or consumer
+	unsigned long long max_depth; // the high-water mark of depth, kept at
+	                              // every send only with 
+	                              // MSGQX_TRACK_DEPTH
+	unsigned long long send_waits; // the number of waits of senders
+	unsigned long long send_wait_us; // the total time senders waited
+	unsigned long long recv_waits; // the number of waits of receivers
+	unsigned long long recv_wait_us; // the total time receivers waited
+	unsigned long long send_hist[MSGQX_STAT_BUCKETS];
+	unsigned long long recv_hist[MSGQX_STAT_BUCKETS];
+};
+
+/*
+ * Read or reset the statistics of a queue. The counters are kept in the 
+ * shared memory by every handle, without a lock, so any handle to the queue
+ * reads the same numbers, e.g., tests/msgqx_stat. The numbers are a snapshot
+ * taken while the queue is in use, and not consistent with each other to 
+ * the message. Resetting sets max_depth to the current depth.
+ *
+ * Input parameters:
+ *     handle: the handle to the message queue
+ * Ouput parameters:
+ *     stats: the statistics
+ * Return values:
+ *     0: success
+ *     1: invalid parameters
+ *     3: failed to follow a resized queue
+ */
+int msgqx_get_stats(void *handle, struct msgqx_stats *stats);
+int msgqx_reset_stats(void *handle);
+
+/*
+ * Return the number of messages dropped by a queue in the lossy mode, i.e.,
+ * overwritten before any receiver received them.
+ *
+ * Input parameters:
+ *     handle: the handle to the message queue
+ * Ouput parameters:
+ *     dropped: the number of messages dropped since the queue was created
+ * Return values:
+ *     0: success
+ *     1: invalid parameters, or the queue is not in the lossy mode
+ */
+int msgqx_dropped(void *handle, unsigned long long *dropped);
+
+/*
+ * Select the consumer of a queue in the journal mode that a handle receives
+ * for. Handles of the same consumer share its offset, so each message goes
+ * to one of them.
+ *
+ * Input parameters:
+ *     handle: the handle to the message queue
+ *     id: the consumer, from 0 to attr.subscribers - 1
+ * Return values:
+ *     0: success
+ *     1: invalid parameters, or the queue is not in the journal mode
+ */
+int msgqx_consumer(void *handle, int id);
+
+/*
+ * Write the messages and the consumer offsets of a queue in the journal mode
+ * to disk now, instead of waiting for attr.sync_us.
+ *
+ * Input parameters:
+ *     handle: the handle to the message queue
+ * Return values:
+ *     0: success
+ *     1: invalid parameters, or the queue is not in the journal mode
+ */
+int msgqx_sync(void *handle);
+
+/*
+ * Subscribe to a queue in the broadcast mode, or unsubscribe. A subscriber
+ * receives the messages sent after it subscribed, with the usual receive
+ * calls on the same handle. Closing the handle also unsubscribes.
+ *
+ * Input parameters:
+ *     handle: the handle to the message queue
+ * Return values:
+ *     0: success
+ *     1: invalid parameters, the queue is not in the broadcast mode, or the
+ *        handle has already subscribed (subscribe) or has not (unsubscribe)
+ *     3: all subscribers are taken
+ */
+int msgqx_subscribe(void *handle);
+int msgqx_unsubscribe(void *handle);
+
 /* 
  * Close the message queue.
  * Input parameters:
@@ -104,9 +690,9 @@ int msgqx_timedreceive(void *handle, void *buf, int sec, int nsec);
 int msgqx_close(void *handle);
 
 /* 
- * Destroy the message queue. Call close_msgqx before calling this function. The
- * will be marked to destroy, but it will only be destroyed after every user has
- * close the queue.
+ * Destroy the message queue and its payload pool. Call close_msgqx before 
+ * calling this function. The queue will be marked to destroy, but it will only
+ * be destroyed after every user has close the queue.
  * 
  * Input parameters:
  *     name: the name of the message queue
@@ -0,0 +1,446 @@
+/*
+ * An implementation of a fixed-size object pool. See object_poolx.h for help.
+ *
+ * The pool is a chunked version of the empty list of static_linked_listx:
+ * every slot has a "next" index, and the free slots are chained from
+ * free_head. Chunks are never reallocated, so object addresses are stable.
+ * Every thread caches up to mag_size free slot indices in a magazine; the
+ * magazine is refilled from, or flushed to, the shared free list in batches
+ * of half its size.
+ *
+ * Author: Wei Wang <wwang@virginia.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "object_poolx.h"
+#include "common_toolx.h"
+
+/*
+ * the slots are allocated by chunks, the chunk size (in slots) is
+ * 1 << OBJECT_POOLX_CHUNK_SHIFT. The chunk directory is allocated once, so
+ * the pool holds at most OBJECT_POOLX_MAX_CHUNKS chunks.
+ */
+#define OBJECT_POOLX_CHUNK_SHIFT 10
+#define OBJECT_POOLX_CHUNK_SIZE (1 << OBJECT_POOLX_CHUNK_SHIFT)
+#define OBJECT_POOLX_CHUNK_MASK (OBJECT_POOLX_CHUNK_SIZE - 1)
+#define OBJECT_POOLX_MAX_CHUNKS 65536
+
+/*
+ * the NULL pointer (index meaning a NULL)
+ */
+#define OBJECT_POOLX_NULL -1
+
+struct opx_slot{
+	int next; // array index of next free slot
+	unsigned int gen; // generation of this slot, bumped on every free
+};
+
+struct opx_magazine;
+
+struct object_poolx{
+	unsigned int obj_size; // the size of each object, rounded up to 8
+	int mag_size; // the capacity of each per-thread magazine
+	pthread_mutex_t lock; // protects everything below
+	int nchunks; // the number of allocated chunks
+	int free_head; // the index of the first free slot
+	char **objs; // chunk directory of the objects
+	struct opx_slot **slots; // chunk directory of the slot bookkeeping
+	pthread_key_t mag_key; // key to the magazine of the calling thread
+	struct opx_magazine *mags; // all magazines, released on destroy
+};
+
+struct opx_magazine{
+	struct object_poolx *pool; // the pool this magazine caches for
+	struct opx_magazine *prev; // all magazines of a pool are linked
+	struct opx_magazine *next; // together
+	int cnt; // the number of cached free slots
+	int idx[]; // the cached free slots, idx[cnt-1] is the warmest
+};
+
+static inline struct opx_slot * _opx_slot(struct object_poolx *pool, int idx)
+{
+	return &pool->slots[idx >> OBJECT_POOLX_CHUNK_SHIFT]
+		[idx & OBJECT_POOLX_CHUNK_MASK];
+}
+
+static inline void * _opx_obj(struct object_poolx *pool, int idx)
+{
+	return pool->objs[idx >> OBJECT_POOLX_CHUNK_SHIFT] +
+		(size_t)(idx & OBJECT_POOLX_CHUNK_MASK) * pool->obj_size;
+}
+
+/*
+ * Add one more chunk to the pool, and put its slots on the free list. Called
+ * with the pool lock held.
+ * Return value:
+ *     0: success
+ *     2: memory allocation error or pool is at its maximum size
+ */
+static int _opx_increase(struct object_poolx *pool)
+{
+	int i, base;
+	char *objs;
+	struct opx_slot *slots;
+
+	if(pool->nchunks == OBJECT_POOLX_MAX_CHUNKS){
+		CTX_LOGERR("object pool reached its maximum size\n");
+		return 2;
+	}
+
+	objs = (char*)malloc((size_t)OBJECT_POOLX_CHUNK_SIZE * pool->obj_size);
+	slots = (struct opx_slot*)malloc(OBJECT_POOLX_CHUNK_SIZE *
+					 sizeof(struct opx_slot));
+	if(objs == NULL || slots == NULL){
+		CTX_LOGERR("Unable to allocate space for object pool with "
+			   "error (%d): %s\n", errno, strerror(errno));
+		free(objs);
+		free(slots);
+		return 2;
+	}
+
+	/*
+	 * chain the new slots in index order in front of the free list
+	 */
+	base = pool->nchunks << OBJECT_POOLX_CHUNK_SHIFT;
+	for(i = 0; i < OBJECT_POOLX_CHUNK_SIZE; i++){
+		slots[i].next = base + i + 1;
+		slots[i].gen = 1;
+	}
+	slots[OBJECT_POOLX_CHUNK_SIZE - 1].next = pool->free_head;
+	pool->free_head = base;
+
+	/*
+	 * handles are checked against nchunks without the lock, so publish
+	 * the chunk before the new count
+	 */
+	pool->objs[pool->nchunks] = objs;
+	pool->slots[pool->nchunks] = slots;
+	__atomic_store_n(&pool->nchunks, pool->nchunks + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/*
+ * Take one slot off the shared free list. Called with the pool lock held.
+ * Return the slot index, or OBJECT_POOLX_NULL if the pool can not grow.
+ */
+static int _opx_pop_free(struct object_poolx *pool)
+{
+	int idx;
+
+	if(pool->free_head == OBJECT_POOLX_NULL && _opx_increase(pool))
+		return OBJECT_POOLX_NULL;
+
+	idx = pool->free_head;
+	pool->free_head = _opx_slot(pool, idx)->next;
+
+	return idx;
+}
+
+/*
+ * Put one slot on the front of the shared free list. Called with the pool
+ * lock held.
+ */
+static inline void _opx_push_free(struct object_poolx *pool, int idx)
+{
+	_opx_slot(pool, idx)->next = pool->free_head;
+	pool->free_head = idx;
+}
+
+/*
+ * Thread exit destructor of a magazine: return the cached slots to the shared
+ * free list and free the magazine.
+ */
+static void _opx_magazine_release(void *m)
+{
+	int i;
+	struct opx_magazine *mag = (struct opx_magazine*)m;
+	struct object_poolx *pool = mag->pool;
+
+	pthread_mutex_lock(&pool->lock);
+	for(i = 0; i < mag->cnt; i++)
+		_opx_push_free(pool, mag->idx[i]);
+	if(mag->prev != NULL)
+		mag->prev->next = mag->next;
+	else
+		pool->mags = mag->next;
+	if(mag->next != NULL)
+		mag->next->prev = mag->prev;
+	pthread_mutex_unlock(&pool->lock);
+
+	free(mag);
+}
+
+/*
+ * Return the magazine of the calling thread, create it on the first call.
+ * Return NULL if magazines are disabled, or the magazine can not be created.
+ */
+static struct opx_magazine * _opx_get_magazine(struct object_poolx *pool)
+{
+	struct opx_magazine *mag;
+
+	if(pool->mag_size == 0)
+		return NULL;
+
+	mag = (struct opx_magazine*)pthread_getspecific(pool->mag_key);
+	if(mag != NULL)
+		return mag;
+
+	mag = (struct opx_magazine*)malloc(sizeof(struct opx_magazine) +
+					   pool->mag_size * sizeof(int));
+	if(mag == NULL)
+		return NULL;
+	mag->pool = pool;
+	mag->cnt = 0;
+	mag->prev = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	mag->next = pool->mags;
+	if(pool->mags != NULL)
+		pool->mags->prev = mag;
+	pool->mags = mag;
+	pthread_mutex_unlock(&pool->lock);
+
+	if(pthread_setspecific(pool->mag_key, mag)){
+		_opx_magazine_release(mag);
+		return NULL;
+	}
+
+	return mag;
+}
+
+/*
+ * initialize an object pool
+ */
+int object_poolx_init(void **p, unsigned int obj_size, int mag_size)
+{
+	struct object_poolx *pool;
+
+	if(p == NULL || obj_size == 0 || mag_size < 0){
+		CTX_LOGERR("wrong parameters: pool (%p), obj_size (%u) and "
+			   "mag_size (%d)\n", p, obj_size, mag_size);
+		return 1;
+	}
+	*p = NULL;
+
+	pool = (struct object_poolx*)calloc(1, sizeof(struct object_poolx));
+	if(pool == NULL)
+		return 2;
+	pool->obj_size = (obj_size + 7) & ~7U;
+	pool->mag_size = mag_size;
+	pool->free_head = OBJECT_POOLX_NULL;
+	pool->objs = (char**)calloc(OBJECT_POOLX_MAX_CHUNKS, sizeof(char*));
+	pool->slots = (struct opx_slot**)calloc(OBJECT_POOLX_MAX_CHUNKS,
+						sizeof(struct opx_slot*));
+	if(pool->objs == NULL || pool->slots == NULL)
+		goto error;
+	if(pthread_mutex_init(&pool->lock, NULL))
+		goto error;
+	if(pthread_key_create(&pool->mag_key, _opx_magazine_release)){
+		pthread_mutex_destroy(&pool->lock);
+		goto error;
+	}
+
+	*p = (void*)pool;
+	return 0;
+
+ error:
+	CTX_LOGERR("Unable to initialize object pool with error %s\n",
+		   strerror(errno));
+	free(pool->objs);
+	free(pool->slots);
+	free(pool);
+	return 2;
+}
+
+/*
+ * allocate an object
+ */
+int object_poolx_alloc(void *p, unsigned long long *handle, void **obj)
+{
+	int i, idx, batch;
+	struct opx_magazine *mag;
+	struct object_poolx *pool = (struct object_poolx*)p;
+
+	if(pool == NULL || handle == NULL || obj == NULL){
+		CTX_LOGERR("wrong parameters: pool (%p), handle (%p) and "
+			   "obj (%p)\n", pool, handle, obj);
+		return 1;
+	}
+
+	mag = _opx_get_magazine(pool);
+	if(mag == NULL){
+		// no cache, go to the shared free list directly
+		pthread_mutex_lock(&pool->lock);
+		idx = _opx_pop_free(pool);
+		pthread_mutex_unlock(&pool->lock);
+	}
+	else{
+		if(mag->cnt == 0){
+			// refill half of the magazine in one lock round
+			batch = (pool->mag_size + 1) / 2;
+			pthread_mutex_lock(&pool->lock);
+			for(i = 0; i < batch; i++){
+				idx = _opx_pop_free(pool);
+				if(idx == OBJECT_POOLX_NULL)
+					break;
+				mag->idx[mag->cnt++] = idx;
+			}
+			pthread_mutex_unlock(&pool->lock);
+		}
+		idx = mag->cnt ? mag->idx[--mag->cnt] : OBJECT_POOLX_NULL;
+	}
+
+	if(idx == OBJECT_POOLX_NULL){
+		*handle = OBJECT_POOLX_NULL_HANDLE;
+		*obj = NULL;
+		return 2;
+	}
+
+	*handle = ((unsigned long long)_opx_slot(pool, idx)->gen << 32) |
+		(unsigned int)idx;
+	*obj = _opx_obj(pool, idx);
+
+	return 0;
+}
+
+/*
+ * check whether a handle refers to a live object. Return 0 if it does, 1 if
+ * the index is invalid and 2 if the handle is stale.
+ */
+static inline int _opx_check_handle(struct object_poolx *pool,
+				    unsigned long long handle)
+{
+	int idx = OBJECT_POOLX_HANDLE_IDX(handle);
+
+	if(idx < 0 || (idx >> OBJECT_POOLX_CHUNK_SHIFT) >=
+	   __atomic_load_n(&pool->nchunks, __ATOMIC_ACQUIRE))
+		return 1;
+	if(__atomic_load_n(&_opx_slot(pool, idx)->gen, __ATOMIC_RELAXED) != 
+	   OBJECT_POOLX_HANDLE_GEN(handle))
+		return 2;
+
+	return 0;
+}
+
+/*
+ * free an object
+ */
+int object_poolx_free(void *p, unsigned long long handle)
+{
+	int i, idx, half, ret_val;
+	unsigned int gen, next;
+	struct opx_slot *slot;
+	struct opx_magazine *mag;
+	struct object_poolx *pool = (struct object_poolx*)p;
+
+	if(pool == NULL){
+		CTX_LOGERR("wrong parameters: pool (%p)\n", pool);
+		return 1;
+	}
+
+	ret_val = _opx_check_handle(pool, handle);
+	if(ret_val){
+		CTX_DPRINTF("invalid or stale handle %llx\n", handle);
+		return ret_val;
+	}
+
+	/*
+	 * bump the generation, so that all copies of this handle are stale; 
+	 * of two threads freeing the same handle, only one moves it on
+	 */
+	idx = OBJECT_POOLX_HANDLE_IDX(handle);
+	slot = _opx_slot(pool, idx);
+	gen = OBJECT_POOLX_HANDLE_GEN(handle);
+	next = gen + 1 == 0 ? 1 : gen + 1;
+	if(!__atomic_compare_exchange_n(&slot->gen, &gen, next, 0, 
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+		CTX_DPRINTF("stale handle %llx\n", handle);
+		return 2;
+	}
+
+	mag = _opx_get_magazine(pool);
+	if(mag == NULL){
+		pthread_mutex_lock(&pool->lock);
+		_opx_push_free(pool, idx);
+		pthread_mutex_unlock(&pool->lock);
+		return 0;
+	}
+
+	if(mag->cnt == pool->mag_size){
+		// flush the coldest half of the magazine in one lock round
+		half = (pool->mag_size + 1) / 2;
+		pthread_mutex_lock(&pool->lock);
+		for(i = 0; i < half; i++)
+			_opx_push_free(pool, mag->idx[i]);
+		pthread_mutex_unlock(&pool->lock);
+		mag->cnt -= half;
+		memmove(mag->idx, mag->idx + half, mag->cnt * sizeof(int));
+	}
+	mag->idx[mag->cnt++] = idx;
+
+	return 0;
+}
+
+/*
+ * translate a handle
+ */
+int object_poolx_get(void *p, unsigned long long handle, void **obj)
+{
+	int ret_val;
+	struct object_poolx *pool = (struct object_poolx*)p;
+
+	if(pool == NULL || obj == NULL){
+		CTX_LOGERR("wrong parameters: pool (%p) and obj (%p)\n", pool,
+			   obj);
+		return 1;
+	}
+
+	*obj = NULL;
+	ret_val = _opx_check_handle(pool, handle);
+	if(ret_val)
+		return ret_val;
+
+	*obj = _opx_obj(pool, OBJECT_POOLX_HANDLE_IDX(handle));
+
+	return 0;
+}
+
+/*
+ * destroy an object pool
+ */
+int object_poolx_destroy(void *p)
+{
+	int i;
+	struct opx_magazine *mag;
+	struct object_poolx *pool = (struct object_poolx*)p;
+
+	if(pool == NULL){
+		CTX_LOGERR("wrong parameters: pool (%p)\n", pool);
+		return 1;
+	}
+
+	// after the key is deleted, the thread exit destructors do not run
+	pthread_key_delete(pool->mag_key);
+	while(pool->mags != NULL){
+		mag = pool->mags;
+		pool->mags = mag->next;
+		free(mag);
+	}
+
+	for(i = 0; i < pool->nchunks; i++){
+		free(pool->objs[i]);
+		free(pool->slots[i]);
+	}
+	free(pool->objs);
+	free(pool->slots);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+
+	return 0;
+}
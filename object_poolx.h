@@ -0,0 +1,103 @@
+/*
+ * A fixed-size object pool. The free slots are kept in an index-linked free
+ * list, the same way static_linked_listx keeps its empty slots, but the slots
+ * are allocated in chunks that never move, so the object addresses stay valid
+ * until the object is freed. Objects are referenced by handles that carry the
+ * slot index and a generation number, so stale handles (to objects that have
+ * been freed) are detected. Each thread keeps a small magazine of free slots,
+ * so that most allocations and frees do not touch the shared pool lock.
+ *
+ * Author: Wei Wang <wwang@virginia.edu>
+ */
+
+#ifndef __COMMON_TOOLX_OBJECT_POOLX_H__
+#define __COMMON_TOOLX_OBJECT_POOLX_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A handle is the slot index in the lower 32 bits and the generation of the
+ * slot in the higher 32 bits. Generations start from 1, so a handle of 0 is
+ * never valid.
+ */
+#define OBJECT_POOLX_NULL_HANDLE 0ULL
+#define OBJECT_POOLX_HANDLE_IDX(h) ((int)((h) & 0xffffffffULL))
+#define OBJECT_POOLX_HANDLE_GEN(h) ((unsigned int)((h) >> 32))
+
+/*
+ * Initialize an object pool.
+ * Input parameters:
+ *     obj_size: the size of each object
+ *     mag_size: the number of free slots cached by each thread; 0 disables
+ *               the per-thread caches, and every call takes the pool lock
+ * Output parameters:
+ *     pool: the handle to the pool
+ * Return values:
+ *     0: success
+ *     1: wrong parameter, pool is NULL, obj_size is 0 or mag_size < 0
+ *     2: unable to allocate space
+ */
+int object_poolx_init(void **pool, unsigned int obj_size, int mag_size);
+
+/*
+ * Allocate an object from the pool. The content of the object is not
+ * initialized. Free slots are reused LIFO, so the most recently freed object
+ * is handed out first.
+ * Input parameters:
+ *     pool: the object pool
+ * Output parameters:
+ *     handle: the handle to the object
+ *     obj: the address of the object
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ *     2: unable to allocate space, or the pool has reached its maximum size
+ */
+int object_poolx_alloc(void *pool, unsigned long long *handle, void **obj);
+
+/*
+ * Return an object to the pool. The handle, and every copy of it, becomes
+ * stale.
+ * Input parameters:
+ *     pool: the object pool
+ *     handle: the handle to the object
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ *     2: stale handle, the object has already been freed
+ */
+int object_poolx_free(void *pool, unsigned long long handle);
+
+/*
+ * Translate a handle into the address of its object.
+ * Input parameters:
+ *     pool: the object pool
+ *     handle: the handle to the object
+ * Output parameters:
+ *     obj: the address of the object, NULL if the handle is stale
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ *     2: stale handle, the object has already been freed
+ */
+int object_poolx_get(void *pool, unsigned long long handle, void **obj);
+
+/*
+ * Destroy an object pool, and free all its objects. The per-thread caches of
+ * all threads are released as well, so no thread should use the pool
+ * concurrently.
+ * Input parameters:
+ *     pool: the object pool
+ * Return values:
+ *     0: success
+ *     1: wrong parameter, pool is NULL
+ */
+int object_poolx_destroy(void *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,553 @@
+/*
+ * An implementation of a key-partitioned queue. See partition_queuex.h for
+ * help.
+ *
+ * The partitions are plain messageQx queues, used through the public API
+ * only. Next to them, a control object holds the consumers and, for every
+ * partition, its owner and its holder: the owner is where the partition
+ * should be, the holder is the consumer that receives from it now. A change
+ * of the consumers assigns new owners and bumps the epoch, under a robust
+ * process-shared mutex, so that a consumer dying with it held does not stop
+ * the others (changes are rare). A consumer that sees a new epoch lets go of the
+ * partitions it no longer owns, and takes the ones it owns as soon as their
+ * holders let go; until then it keeps checking at every receive.
+ *
+ * A consumer waits on all its partitions with msgqx_timedreceive_any, in
+ * slices of PARTITION_QUEUEX_SLICE_NS, so that it notices a new epoch while
+ * its partitions are empty.
+ *
+ * Author: Wei Wang <wwang@virginia.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "partition_queuex.h"
+#include "messageQx.h"
+#include "common_toolx.h"
+
+#define PARTITION_QUEUEX_MAGIC 0x50515843 // "PQXC"
+#define PARTITION_QUEUEX_NAME_SIZE 64
+#define PARTITION_QUEUEX_SLICE_NS 10000000 // 10ms
+#define PARTITION_QUEUEX_NONE -1
+
+// the control object of a partitioned queue
+struct pqx_ctl{
+	unsigned int magic; // PARTITION_QUEUEX_MAGIC once initialized
+	int nparts; // the number of partitions
+	int msg_size; // the size of each message
+	pthread_mutex_t lock; // protects the consumers and the owners
+	unsigned int epoch; // bumped whenever the owners change
+	int cons_pid[PARTITION_QUEUEX_MAX_CONSUMERS]; // 0 if the slot is free
+	int owner[PARTITION_QUEUEX_MAX_PARTS]; // the consumer of a partition
+	int holder[PARTITION_QUEUEX_MAX_PARTS]; // the consumer receiving from
+	                                        // a partition now
+};
+
+// the handle to a partitioned queue
+typedef struct _pqx_handle{
+	struct pqx_ctl *ctl; // the control object
+	int ctl_fd;
+	size_t ctl_size;
+	int nparts;
+	void *parts[PARTITION_QUEUEX_MAX_PARTS]; // the partitions
+	int slot; // the consumer slot, -1 if not joined
+	unsigned int epoch; // the epoch the held partitions are up to
+	int nheld; // the number of partitions held
+	int held[PARTITION_QUEUEX_MAX_PARTS]; // the partitions held
+	void *held_q[PARTITION_QUEUEX_MAX_PARTS]; // and their queues
+	int which; // the index in held of the last receive
+}pqx_h;
+
+typedef enum _pqx_wait_type{
+	pqx_blocked,
+	pqx_try,
+	pqx_timed,
+}pqx_wty;
+
+static void _pqx_ctl_name(char *buf, const char *name)
+{
+	snprintf(buf, PARTITION_QUEUEX_NAME_SIZE, "/PARTQX_%s", name);
+}
+
+static void _pqx_part_name(char *buf, const char *name, int part)
+{
+	snprintf(buf, PARTITION_QUEUEX_NAME_SIZE, "%s.%d", name, part);
+}
+
+// spread the partitions over the consumers round robin, and start a new
+// epoch; the lock is held
+static void _pqx_assign(struct pqx_ctl *ctl)
+{
+	int live[PARTITION_QUEUEX_MAX_CONSUMERS];
+	int i, n = 0;
+
+	for(i = 0; i < PARTITION_QUEUEX_MAX_CONSUMERS; i++)
+		if(ctl->cons_pid[i] != 0)
+			live[n++] = i;
+	for(i = 0; i < ctl->nparts; i++)
+		__atomic_store_n(&ctl->owner[i], n > 0 ? live[i % n] :
+				 PARTITION_QUEUEX_NONE, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ctl->epoch, 1, __ATOMIC_RELEASE);
+}
+
+// free a consumer slot, and let go of the partitions it holds; the lock is
+// held
+static void _pqx_remove(struct pqx_ctl *ctl, int slot)
+{
+	int i, holder;
+
+	ctl->cons_pid[slot] = 0;
+	for(i = 0; i < ctl->nparts; i++){
+		holder = slot;
+		__atomic_compare_exchange_n(&ctl->holder[i], &holder,
+					    PARTITION_QUEUEX_NONE, 0,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+	}
+}
+
+// lock the control object; return 0 on success, 3 if locking failed
+static int _pqx_lock(struct pqx_ctl *ctl)
+{
+	int ret_val = pthread_mutex_lock(&ctl->lock);
+
+	if(ret_val == EOWNERDEAD){
+		/*
+		 * a consumer died while changing the consumers; each of its
+		 * stores is whole, so spreading the partitions again makes
+		 * the owners agree with the consumers
+		 */
+		CTX_LOGERR("previous owner of the control lock died\n");
+		pthread_mutex_consistent(&ctl->lock);
+		_pqx_assign(ctl);
+		return 0;
+	}
+
+	return ret_val ? 3 : 0;
+}
+
+static void _pqx_unlock(struct pqx_ctl *ctl)
+{
+	pthread_mutex_unlock(&ctl->lock);
+}
+
+static void _pqx_init_lock(struct pqx_ctl *ctl)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&ctl->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+// catch up with the owners of the partitions: let go of the partitions the
+// consumer no longer owns, and take the ones it owns once they are free
+static void _pqx_sync(pqx_h *h)
+{
+	struct pqx_ctl *ctl = h->ctl;
+	unsigned int epoch = __atomic_load_n(&ctl->epoch, __ATOMIC_ACQUIRE);
+	int i, n = 0, holder, settled = 1;
+
+	if(epoch == h->epoch)
+		return;
+
+	for(i = 0; i < h->nparts; i++){
+		if(__atomic_load_n(&ctl->owner[i], __ATOMIC_RELAXED) !=
+		   h->slot){
+			// we are done with the messages received before
+			holder = h->slot;
+			__atomic_compare_exchange_n(&ctl->holder[i], &holder,
+						    PARTITION_QUEUEX_NONE, 0,
+						    __ATOMIC_RELEASE,
+						    __ATOMIC_RELAXED);
+			continue;
+		}
+		holder = PARTITION_QUEUEX_NONE;
+		if(!__atomic_compare_exchange_n(&ctl->holder[i], &holder,
+						h->slot, 0, __ATOMIC_ACQUIRE,
+						__ATOMIC_RELAXED) &&
+		   holder != h->slot){
+			// the old owner still holds it
+			settled = 0;
+			continue;
+		}
+		h->held[n] = i;
+		h->held_q[n] = h->parts[i];
+		n++;
+	}
+	h->nheld = n;
+	if(settled)
+		h->epoch = epoch;
+}
+
+// map the control object and open the partitions of a queue
+static int _pqx_open_parts(pqx_h *h, const char *name)
+{
+	char name_buf[PARTITION_QUEUEX_NAME_SIZE];
+	int i, size;
+
+	h->nparts = h->ctl->nparts;
+	for(i = 0; i < h->nparts; i++){
+		_pqx_part_name(name_buf, name, i);
+		if(msgqx_open(name_buf, &h->parts[i], &size) != 0)
+			return 3;
+	}
+
+	return 0;
+}
+
+static pqx_h * _pqx_new_handle(void)
+{
+	pqx_h *h = calloc(1, sizeof(pqx_h));
+
+	if(h == NULL)
+		return NULL;
+	h->ctl = MAP_FAILED;
+	h->ctl_fd = -1;
+	h->slot = PARTITION_QUEUEX_NONE;
+	h->which = -1;
+
+	return h;
+}
+
+int partition_queuex_create(const char *name, int size, int len, int nparts,
+			    struct msgqx_attr *attr, void **pq)
+{
+	pqx_h *h;
+	char name_buf[PARTITION_QUEUEX_NAME_SIZE];
+	struct msgqx_attr def_attr;
+	int i, ret_val;
+
+	if(attr == NULL){
+		msgqx_attr_init(&def_attr);
+		attr = &def_attr;
+	}
+	if(name == NULL || pq == NULL || size <= 0 || len <= 0 ||
+	   nparts <= 0 || nparts > PARTITION_QUEUEX_MAX_PARTS ||
+	   (attr->mode != MSGQX_MODE_LOCKED &&
+	    attr->mode != MSGQX_MODE_MPMC) || (attr->flags & MSGQX_PRIVATE)){
+		CTX_LOGERR("wrong parameters: name (%p), size (%d), len (%d) "
+			   "and nparts (%d)\n", name, size, len, nparts);
+		return 1;
+	}
+
+	h = _pqx_new_handle();
+	if(h == NULL)
+		return 3;
+
+	// the control object first, so that a queue is only created once
+	_pqx_ctl_name(name_buf, name);
+	h->ctl_size = sizeof(struct pqx_ctl);
+	if(map_shared_mem(name_buf, CTX_SHM_CREATE, &h->ctl_size, &h->ctl_fd,
+			  (void**)&h->ctl) != 0){
+		free(h);
+		return 3;
+	}
+	_pqx_init_lock(h->ctl);
+	h->ctl->nparts = nparts;
+	h->ctl->msg_size = size;
+	for(i = 0; i < nparts; i++)
+		h->ctl->owner[i] = h->ctl->holder[i] = PARTITION_QUEUEX_NONE;
+
+	h->nparts = nparts;
+	for(i = 0; i < nparts; i++){
+		_pqx_part_name(name_buf, name, i);
+		ret_val = msgqx_create_attr(name_buf, size, len, attr,
+					    &h->parts[i]);
+		if(ret_val != 0){
+			partition_queuex_close(h);
+			partition_queuex_destroy(name);
+			return 3;
+		}
+	}
+
+	// publish the queue to partition_queuex_open
+	__atomic_store_n(&h->ctl->magic, PARTITION_QUEUEX_MAGIC,
+			 __ATOMIC_RELEASE);
+	*pq = h;
+
+	return 0;
+}
+
+int partition_queuex_open(const char *name, void **pq, int *size)
+{
+	pqx_h *h;
+	char name_buf[PARTITION_QUEUEX_NAME_SIZE];
+
+	if(name == NULL || pq == NULL || size == NULL){
+		CTX_LOGERR("wrong parameters: name (%p), pq (%p) and size "
+			   "(%p)\n", name, pq, size);
+		return 1;
+	}
+
+	h = _pqx_new_handle();
+	if(h == NULL)
+		return 3;
+
+	_pqx_ctl_name(name_buf, name);
+	if(map_shared_mem(name_buf, 0, &h->ctl_size, &h->ctl_fd,
+			  (void**)&h->ctl) != 0 ||
+	   h->ctl_size < sizeof(struct pqx_ctl) ||
+	   __atomic_load_n(&h->ctl->magic, __ATOMIC_ACQUIRE) !=
+	   PARTITION_QUEUEX_MAGIC || _pqx_open_parts(h, name) != 0){
+		CTX_DPRINTF("Partitioned queue %s is not ready\n", name);
+		partition_queuex_close(h);
+		return 3;
+	}
+	*size = h->ctl->msg_size;
+	*pq = h;
+
+	return 0;
+}
+
+int partition_queuex_partition(void *pq, unsigned long long key)
+{
+	pqx_h *h = pq;
+
+	if(h == NULL)
+		return -1;
+
+	// the finalizer of splitmix64, so that close keys spread out
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+
+	return (int)(key % h->nparts);
+}
+
+// the partition queue of a key
+static inline void * _pqx_part(void *pq, unsigned long long key)
+{
+	return ((pqx_h*)pq)->parts[partition_queuex_partition(pq, key)];
+}
+
+int partition_queuex_send(void *pq, unsigned long long key, void *msg)
+{
+	if(pq == NULL)
+		return 1;
+	return msgqx_send(_pqx_part(pq, key), msg);
+}
+
+int partition_queuex_trysend(void *pq, unsigned long long key, void *msg)
+{
+	if(pq == NULL)
+		return 1;
+	return msgqx_trysend(_pqx_part(pq, key), msg);
+}
+
+int partition_queuex_timedsend(void *pq, unsigned long long key, void *msg,
+			       int sec, int nsec)
+{
+	if(pq == NULL)
+		return 1;
+	return msgqx_timedsend(_pqx_part(pq, key), msg, sec, nsec);
+}
+
+int partition_queuex_join(void *pq)
+{
+	pqx_h *h = pq;
+	int i;
+
+	if(h == NULL || h->slot != PARTITION_QUEUEX_NONE)
+		return 1;
+
+	if(_pqx_lock(h->ctl))
+		return 3;
+	for(i = 0; i < PARTITION_QUEUEX_MAX_CONSUMERS; i++)
+		if(h->ctl->cons_pid[i] == 0)
+			break;
+	if(i == PARTITION_QUEUEX_MAX_CONSUMERS){
+		_pqx_unlock(h->ctl);
+		return 3;
+	}
+	h->ctl->cons_pid[i] = getpid();
+	h->slot = i;
+	_pqx_assign(h->ctl);
+	_pqx_unlock(h->ctl);
+
+	h->epoch = 0;
+	h->nheld = 0;
+	h->which = -1;
+	_pqx_sync(h);
+
+	return 0;
+}
+
+int partition_queuex_leave(void *pq)
+{
+	pqx_h *h = pq;
+
+	if(h == NULL || h->slot == PARTITION_QUEUEX_NONE)
+		return 1;
+
+	if(_pqx_lock(h->ctl))
+		return 3;
+	_pqx_remove(h->ctl, h->slot);
+	_pqx_assign(h->ctl);
+	_pqx_unlock(h->ctl);
+	h->slot = PARTITION_QUEUEX_NONE;
+	h->nheld = 0;
+
+	return 0;
+}
+
+int partition_queuex_rebalance(void *pq)
+{
+	pqx_h *h = pq;
+	int i;
+
+	if(h == NULL)
+		return 1;
+
+	if(_pqx_lock(h->ctl))
+		return 3;
+	for(i = 0; i < PARTITION_QUEUEX_MAX_CONSUMERS; i++)
+		if(h->ctl->cons_pid[i] != 0 &&
+		   kill(h->ctl->cons_pid[i], 0) != 0 && errno == ESRCH)
+			_pqx_remove(h->ctl, i);
+	_pqx_assign(h->ctl);
+	_pqx_unlock(h->ctl);
+
+	return 0;
+}
+
+// the nanoseconds from now until a deadline, 0 if it has passed
+static long long _pqx_ns_left(struct timespec *deadline)
+{
+	struct timespec now;
+	long long left;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	left = (deadline->tv_sec - now.tv_sec) * 1000000000LL +
+		deadline->tv_nsec - now.tv_nsec;
+
+	return left > 0 ? left : 0;
+}
+
+// generic interface for receiving; wait in slices, and catch up with the
+// owners of the partitions between them
+static int _pqx_receive(pqx_h *h, void *buf, int *part, pqx_wty wait_type,
+			int sec, int nsec)
+{
+	struct timespec deadline, slice;
+	long long left = PARTITION_QUEUEX_SLICE_NS;
+	int ret_val;
+
+	if(h == NULL || buf == NULL || h->slot == PARTITION_QUEUEX_NONE)
+		return 1;
+	if(wait_type == pqx_timed){
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += sec + (deadline.tv_nsec + nsec) / 1000000000;
+		deadline.tv_nsec = (deadline.tv_nsec + nsec) % 1000000000;
+	}
+
+	for(;;){
+		_pqx_sync(h);
+		if(wait_type == pqx_timed){
+			left = _pqx_ns_left(&deadline);
+			if(left > PARTITION_QUEUEX_SLICE_NS)
+				left = PARTITION_QUEUEX_SLICE_NS;
+		}
+
+		if(h->nheld > 0 && wait_type == pqx_try)
+			ret_val = msgqx_tryreceive_any(h->held_q, h->nheld,
+						       buf, &h->which);
+		else if(h->nheld > 0)
+			ret_val = msgqx_timedreceive_any(h->held_q, h->nheld,
+							 buf, &h->which, 0,
+							 (int)left);
+		else{
+			ret_val = wait_type == pqx_try ? 4 : 5;
+			slice.tv_sec = 0;
+			slice.tv_nsec = left;
+			if(wait_type != pqx_try)
+				nanosleep(&slice, NULL);
+		}
+
+		if(ret_val == 0){
+			if(part != NULL)
+				*part = h->held[h->which];
+			return 0;
+		}
+		if(ret_val != 4 && ret_val != 5)
+			return ret_val;
+		if(wait_type == pqx_try)
+			return 4;
+		if(wait_type == pqx_timed && _pqx_ns_left(&deadline) == 0)
+			return 5;
+	}
+}
+
+int partition_queuex_receive(void *pq, void *buf, int *part)
+{
+	return _pqx_receive(pq, buf, part, pqx_blocked, 0, 0);
+}
+
+int partition_queuex_tryreceive(void *pq, void *buf, int *part)
+{
+	return _pqx_receive(pq, buf, part, pqx_try, 0, 0);
+}
+
+int partition_queuex_timedreceive(void *pq, void *buf, int *part, int sec,
+				  int nsec)
+{
+	return _pqx_receive(pq, buf, part, pqx_timed, sec, nsec);
+}
+
+int partition_queuex_close(void *pq)
+{
+	pqx_h *h = pq;
+	int i;
+
+	if(h == NULL)
+		return 1;
+
+	if(h->slot != PARTITION_QUEUEX_NONE)
+		partition_queuex_leave(h);
+	for(i = 0; i < h->nparts; i++)
+		if(h->parts[i] != NULL)
+			msgqx_close(h->parts[i]);
+	unmap_shared_mem(h->ctl, h->ctl_size, h->ctl_fd);
+	free(h);
+
+	return 0;
+}
+
+int partition_queuex_destroy(const char *name)
+{
+	char name_buf[PARTITION_QUEUEX_NAME_SIZE];
+	struct pqx_ctl *ctl;
+	size_t size = 0;
+	int i, fd, nparts = PARTITION_QUEUEX_MAX_PARTS, ret_val = 0;
+
+	if(name == NULL)
+		return 1;
+
+	// the number of partitions, if the control object is still there
+	_pqx_ctl_name(name_buf, name);
+	if(map_shared_mem(name_buf, 0, &size, &fd, (void**)&ctl) == 0){
+		if(size >= sizeof(struct pqx_ctl) && ctl->nparts > 0)
+			nparts = ctl->nparts;
+		unmap_shared_mem(ctl, size, fd);
+		ret_val |= destroy_shared_mem(name_buf, 0);
+	}
+
+	for(i = 0; i < nparts; i++){
+		_pqx_part_name(name_buf, name, i);
+		msgqx_destroy(name_buf);
+	}
+
+	return ret_val;
+}
@@ -0,0 +1,163 @@
+/*
+ * A key-partitioned queue over several messageQx queues. A message is sent
+ * with a key, and goes to the partition that the key hashes to, so messages
+ * of the same key stay in order. Every consumer joins the queue and receives
+ * from the partitions it owns; the partitions are spread again over the
+ * consumers whenever one joins or leaves.
+ *
+ * A partition changes hands only when its old owner lets go of it, at its
+ * next receive (or when it leaves), i.e., after it is done with the messages
+ * it has already received. The new owner does not receive from the
+ * partition before that, so the messages of a key are never processed by two
+ * consumers at once, and always in order.
+ *
+ * The queue is shared by processes like a messageQx queue. Partition i is the
+ * messageQx queue "name.i", and the owners of the partitions are kept in a
+ * small shared memory object of its own. A handle is not thread-safe; every
+ * thread opens its own.
+ *
+ * Author: Wei Wang <wwang@virginia.edu>
+ */
+
+#ifndef __COMMON_TOOLX_PARTITION_QUEUEX_H__
+#define __COMMON_TOOLX_PARTITION_QUEUEX_H__
+
+#include "messageQx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PARTITION_QUEUEX_MAX_PARTS MSGQX_MAX_ANY
+#define PARTITION_QUEUEX_MAX_CONSUMERS 64
+
+/*
+ * Create a partitioned queue and its partitions.
+ *
+ * Input parameters:
+ *     name: the name of the queue
+ *     size: the size of each message
+ *     len: the length of each partition
+ *     nparts: the number of partitions, up to PARTITION_QUEUEX_MAX_PARTS
+ *     attr: the attributes of the partitions, NULL for the default; only the
+ *           locked and MPMC modes, and not MSGQX_PRIVATE
+ * Output parameters:
+ *     pq: the handle to the queue
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ *     3: failed to create the shared memory, e.g., the queue exists
+ */
+int partition_queuex_create(const char *name, int size, int len, int nparts,
+			    struct msgqx_attr *attr, void **pq);
+
+/*
+ * Open an existing partitioned queue.
+ *
+ * Input parameters:
+ *     name: the name of the queue
+ * Output parameters:
+ *     pq: the handle to the queue
+ *     size: the size of each message
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ *     3: failed to open the shared memory, or the queue is not ready
+ */
+int partition_queuex_open(const char *name, void **pq, int *size);
+
+/*
+ * Send a message to the partition of its key. The three calls wait like
+ * msgqx_send, msgqx_trysend and msgqx_timedsend.
+ *
+ * Input parameters:
+ *     pq: the handle to the queue
+ *     key: the key of the message
+ *     msg: the message
+ * Return values:
+ *     as msgqx_send, msgqx_trysend and msgqx_timedsend
+ */
+int partition_queuex_send(void *pq, unsigned long long key, void *msg);
+int partition_queuex_trysend(void *pq, unsigned long long key, void *msg);
+int partition_queuex_timedsend(void *pq, unsigned long long key, void *msg,
+			       int sec, int nsec);
+
+/*
+ * Return the partition of a key.
+ * Return values:
+ *     the partition, or -1 if pq is NULL
+ */
+int partition_queuex_partition(void *pq, unsigned long long key);
+
+/*
+ * Join the queue as a consumer, or leave it. The partitions are spread
+ * again over the consumers. Closing the handle also leaves.
+ *
+ * Input parameters:
+ *     pq: the handle to the queue
+ * Return values:
+ *     0: success
+ *     1: wrong parameters, the handle has already joined (join) or has not
+ *        (leave)
+ *     3: all consumers are taken (join), or failed to lock the queue
+ */
+int partition_queuex_join(void *pq);
+int partition_queuex_leave(void *pq);
+
+/*
+ * Receive a message from one of the partitions of the consumer. A consumer
+ * that owns no partition yet waits too. The three calls wait like
+ * msgqx_receive, msgqx_tryreceive and msgqx_timedreceive.
+ *
+ * Input parameters:
+ *     pq: the handle to the queue, joined as a consumer
+ * Output parameters:
+ *     buf: the message
+ *     part: the partition of the message, can be NULL
+ * Return values:
+ *     0: success
+ *     1: wrong parameters, or the handle has not joined
+ *     3: failed to receive
+ *     4: tryreceive: no message
+ *     5: timedreceive: no message within the time span
+ */
+int partition_queuex_receive(void *pq, void *buf, int *part);
+int partition_queuex_tryreceive(void *pq, void *buf, int *part);
+int partition_queuex_timedreceive(void *pq, void *buf, int *part, int sec,
+				  int nsec);
+
+/*
+ * Remove the consumers whose processes have exited without leaving, and
+ * spread the partitions again. The messages they had received are lost. A
+ * process that has not been waited for by its parent has not exited yet.
+ * A consumer that died while joining or leaving does not block this.
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ *     3: failed to lock the queue
+ */
+int partition_queuex_rebalance(void *pq);
+
+/*
+ * Close a handle, leaving the queue if it has joined.
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ */
+int partition_queuex_close(void *pq);
+
+/*
+ * Destroy a partitioned queue and its partitions. Existing handles stay
+ * valid until closed.
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ *     other: failed to remove some shared memory
+ */
+int partition_queuex_destroy(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
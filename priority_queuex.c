@@ -0,0 +1,498 @@
+/*
+ * An implementation of an indexed 4-ary heap. See priority_queuex.h for help.
+ *
+ * The heap array holds (priority, slot) pairs. It is allocated on a cache
+ * line boundary and the root is stored at array index PQX_OFFSET, so the
+ * children of node i (4i+1 .. 4i+4) are stored at 4i+4 .. 4i+7, which is
+ * exactly one 64-byte cache line. Every slot of the item list starts with a
+ * small header that records the position of the slot in the heap and the
+ * generation of the item.
+ *
+ * Author: Wei Wang <wwang@virginia.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "priority_queuex.h"
+#include "static_linked_listx.h"
+#include "common_toolx.h"
+
+#define PQX_ARITY 4
+#define PQX_CACHE_LINE 64
+#define PQX_OFFSET (PQX_ARITY - 1)
+#define PQX_INIT_CAPACITY 128
+
+#define PQX_PARENT(i) (((i) - 1) / PQX_ARITY)
+#define PQX_CHILD(i) ((i) * PQX_ARITY + 1)
+
+struct pqx_entry{
+	long long prio; // the priority of the item
+	int slot; // the index of the item in the item list
+	int pad; // keep the entry 16 bytes, four entries per cache line
+};
+
+struct pqx_slot{
+	int pos; // the position of the item in the heap
+	unsigned int gen; // the generation of the item
+};
+
+struct priority_queuex{
+	void *items; // static linked list of struct pqx_slot + item
+	unsigned int item_size; // the size of an item
+	struct pqx_slot *scratch; // a new item is built here before insertion
+	struct pqx_entry *mem; // the allocated heap array
+	struct pqx_entry *heap; // the root of the heap, mem + PQX_OFFSET
+	int size; // the number of items in the heap
+	int capacity; // the number of entries the heap array can hold
+	unsigned int gen; // generation of the last inserted item
+};
+
+static inline void * _pqx_payload(struct pqx_slot *s)
+{
+	return (void*)(s + 1);
+}
+
+static inline struct pqx_slot * _pqx_slot(struct priority_queuex *pq,
+					  int slot)
+{
+	void *s;
+
+	static_linked_listx_get_item(pq->items, slot, &s);
+	return (struct pqx_slot*)s;
+}
+
+/*
+ * Make room for at least n entries in the heap array. The array is
+ * re-allocated with posix_memalign to keep its cache line alignment.
+ */
+static int _pqx_reserve(struct priority_queuex *pq, int n)
+{
+	int cap;
+	void *mem;
+
+	if(n <= pq->capacity)
+		return 0;
+
+	for(cap = pq->capacity ? pq->capacity : PQX_INIT_CAPACITY; cap < n;
+	    cap *= 2)
+		;
+
+	if(posix_memalign(&mem, PQX_CACHE_LINE,
+			  (cap + PQX_OFFSET) * sizeof(struct pqx_entry))){
+		CTX_LOGERR("Unable to allocate space for priority queue\n");
+		return 2;
+	}
+	if(pq->mem != NULL){
+		memcpy((struct pqx_entry*)mem + PQX_OFFSET, pq->heap,
+		       pq->size * sizeof(struct pqx_entry));
+		free(pq->mem);
+	}
+	pq->mem = (struct pqx_entry*)mem;
+	pq->heap = pq->mem + PQX_OFFSET;
+	pq->capacity = cap;
+
+	return 0;
+}
+
+/*
+ * Put entry e at position i, and record the position in its slot
+ */
+static inline void _pqx_place(struct priority_queuex *pq, int i,
+			      struct pqx_entry e)
+{
+	pq->heap[i] = e;
+	_pqx_slot(pq, e.slot)->pos = i;
+}
+
+/*
+ * Move the entry at position i up until its parent is not larger
+ */
+static void _pqx_sift_up(struct priority_queuex *pq, int i)
+{
+	int p;
+	struct pqx_entry e = pq->heap[i];
+
+	while(i > 0){
+		p = PQX_PARENT(i);
+		if(pq->heap[p].prio <= e.prio)
+			break;
+		_pqx_place(pq, i, pq->heap[p]);
+		i = p;
+	}
+	_pqx_place(pq, i, e);
+}
+
+/*
+ * Move the entry at position i down until no child is smaller
+ */
+static void _pqx_sift_down(struct priority_queuex *pq, int i)
+{
+	int c, min, last;
+	struct pqx_entry e = pq->heap[i];
+
+	while((c = PQX_CHILD(i)) < pq->size){
+		// find the smallest of up to four children
+		min = c;
+		last = c + PQX_ARITY < pq->size ? c + PQX_ARITY : pq->size;
+		for(c++; c < last; c++)
+			if(pq->heap[c].prio < pq->heap[min].prio)
+				min = c;
+
+		if(pq->heap[min].prio >= e.prio)
+			break;
+		_pqx_place(pq, i, pq->heap[min]);
+		i = min;
+	}
+	_pqx_place(pq, i, e);
+}
+
+/*
+ * Remove the entry at position i from the heap, and free its slot
+ */
+static void _pqx_remove_at(struct priority_queuex *pq, int i, void *buf)
+{
+	int slot = pq->heap[i].slot;
+	long long prio;
+
+	if(buf != NULL)
+		memcpy(buf, _pqx_payload(_pqx_slot(pq, slot)), pq->item_size);
+	static_linked_listx_remove(pq->items, slot);
+
+	pq->size--;
+	if(i == pq->size)
+		return;
+
+	// fill the hole with the last entry, and move it up or down
+	prio = pq->heap[i].prio;
+	pq->heap[i] = pq->heap[pq->size];
+	if(pq->heap[i].prio < prio)
+		_pqx_sift_up(pq, i);
+	else
+		_pqx_sift_down(pq, i);
+}
+
+/*
+ * Look up the slot of a handle. Return NULL if the handle is stale.
+ */
+static struct pqx_slot * _pqx_lookup(struct priority_queuex *pq,
+				     unsigned long long handle)
+{
+	struct pqx_slot *s;
+
+	if(static_linked_listx_get_item(pq->items,
+					(int)(handle & 0xffffffffULL),
+					(void**)&s))
+		return NULL;
+	if(s->gen != (unsigned int)(handle >> 32))
+		return NULL;
+
+	return s;
+}
+
+/*
+ * Copy an item into a new slot. Return the slot index, or -1 if the item
+ * list can not grow.
+ */
+static int _pqx_new_slot(struct priority_queuex *pq, void *item,
+			 unsigned long long *handle)
+{
+	int slot;
+	struct pqx_slot *s = pq->scratch;
+
+	if(++pq->gen == 0)
+		pq->gen = 1;
+	s->pos = -1;
+	s->gen = pq->gen;
+	if(pq->item_size)
+		memcpy(_pqx_payload(s), item, pq->item_size);
+
+	if(static_linked_listx_push_back(pq->items, s, &slot))
+		return -1;
+
+	if(handle != NULL)
+		*handle = ((unsigned long long)s->gen << 32) |
+			(unsigned int)slot;
+
+	return slot;
+}
+
+/*
+ * initialize a priority queue
+ */
+int priority_queuex_init(void **p, unsigned int item_size)
+{
+	unsigned int slot_size;
+	struct priority_queuex *pq;
+
+	if(p == NULL){
+		CTX_LOGERR("wrong parameters: pq (%p)\n", p);
+		return 1;
+	}
+	*p = NULL;
+
+	pq = (struct priority_queuex*)calloc(1, sizeof(struct priority_queuex));
+	if(pq == NULL)
+		return 2;
+	pq->item_size = item_size;
+	slot_size = (sizeof(struct pqx_slot) + item_size + 7) & ~7U;
+
+	pq->scratch = (struct pqx_slot*)calloc(1, slot_size);
+	if(pq->scratch == NULL ||
+	   static_linked_listx_init(&pq->items, slot_size) ||
+	   _pqx_reserve(pq, PQX_INIT_CAPACITY)){
+		if(pq->items != NULL)
+			static_linked_listx_free(pq->items);
+		free(pq->scratch);
+		free(pq);
+		return 2;
+	}
+
+	*p = (void*)pq;
+	return 0;
+}
+
+/*
+ * insert an item
+ */
+int priority_queuex_push(void *p, long long prio, void *item,
+			 unsigned long long *handle)
+{
+	int slot;
+	struct priority_queuex *pq = (struct priority_queuex*)p;
+
+	if(pq == NULL || (item == NULL && pq->item_size)){
+		CTX_LOGERR("wrong parameters: pq (%p) and item (%p)\n", pq,
+			   item);
+		return 1;
+	}
+
+	if(_pqx_reserve(pq, pq->size + 1))
+		return 2;
+	slot = _pqx_new_slot(pq, item, handle);
+	if(slot == -1)
+		return 2;
+
+	pq->heap[pq->size].prio = prio;
+	pq->heap[pq->size].slot = slot;
+	pq->size++;
+	_pqx_sift_up(pq, pq->size - 1);
+
+	return 0;
+}
+
+/*
+ * insert a batch of items
+ */
+int priority_queuex_heapify(void *p, int n, long long *prios, void *items,
+			    unsigned long long *handles)
+{
+	int i, slot;
+	struct priority_queuex *pq = (struct priority_queuex*)p;
+
+	if(pq == NULL || n < 0 || (n > 0 && prios == NULL) ||
+	   (n > 0 && items == NULL && pq->item_size)){
+		CTX_LOGERR("wrong parameters: pq (%p), n (%d), prios (%p) and "
+			   "items (%p)\n", pq, n, prios, items);
+		return 1;
+	}
+
+	if(_pqx_reserve(pq, pq->size + n))
+		return 2;
+
+	/*
+	 * append all items without ordering them
+	 */
+	for(i = 0; i < n; i++){
+		slot = _pqx_new_slot(pq, (char*)items + (size_t)i *
+				     pq->item_size,
+				     handles != NULL ? &handles[i] : NULL);
+		if(slot == -1){
+			// roll back the items appended so far
+			while(i-- > 0)
+				static_linked_listx_remove(pq->items,
+					pq->heap[pq->size + i].slot);
+			return 2;
+		}
+		pq->heap[pq->size + i].prio = prios[i];
+		pq->heap[pq->size + i].slot = slot;
+		_pqx_slot(pq, slot)->pos = pq->size + i;
+	}
+	pq->size += n;
+
+	/*
+	 * restore the heap bottom-up (Floyd), in O(size)
+	 */
+	if(pq->size > 1)
+		for(i = PQX_PARENT(pq->size - 1); i >= 0; i--)
+			_pqx_sift_down(pq, i);
+
+	return 0;
+}
+
+/*
+ * return the smallest item
+ */
+int priority_queuex_top(void *p, long long *prio, void **item,
+			unsigned long long *handle)
+{
+	struct pqx_slot *s;
+	struct priority_queuex *pq = (struct priority_queuex*)p;
+
+	if(pq == NULL){
+		CTX_LOGERR("wrong parameters: pq (%p)\n", pq);
+		return 1;
+	}
+
+	if(pq->size == 0)
+		return 2;
+
+	s = _pqx_slot(pq, pq->heap[0].slot);
+	if(prio != NULL)
+		*prio = pq->heap[0].prio;
+	if(item != NULL)
+		*item = _pqx_payload(s);
+	if(handle != NULL)
+		*handle = ((unsigned long long)s->gen << 32) |
+			(unsigned int)pq->heap[0].slot;
+
+	return 0;
+}
+
+/*
+ * remove the smallest item
+ */
+int priority_queuex_pop(void *p, long long *prio, void *buf)
+{
+	struct priority_queuex *pq = (struct priority_queuex*)p;
+
+	if(pq == NULL){
+		CTX_LOGERR("wrong parameters: pq (%p)\n", pq);
+		return 1;
+	}
+
+	if(pq->size == 0)
+		return 2;
+
+	if(prio != NULL)
+		*prio = pq->heap[0].prio;
+	_pqx_remove_at(pq, 0, buf);
+
+	return 0;
+}
+
+/*
+ * change the priority of an item
+ */
+int priority_queuex_update(void *p, unsigned long long handle,
+			   long long prio)
+{
+	int i;
+	long long old;
+	struct pqx_slot *s;
+	struct priority_queuex *pq = (struct priority_queuex*)p;
+
+	if(pq == NULL){
+		CTX_LOGERR("wrong parameters: pq (%p)\n", pq);
+		return 1;
+	}
+
+	s = _pqx_lookup(pq, handle);
+	if(s == NULL)
+		return 2;
+
+	i = s->pos;
+	old = pq->heap[i].prio;
+	pq->heap[i].prio = prio;
+	if(prio < old)
+		_pqx_sift_up(pq, i);
+	else if(prio > old)
+		_pqx_sift_down(pq, i);
+
+	return 0;
+}
+
+/*
+ * remove an item by its handle
+ */
+int priority_queuex_cancel(void *p, unsigned long long handle, void *buf)
+{
+	struct pqx_slot *s;
+	struct priority_queuex *pq = (struct priority_queuex*)p;
+
+	if(pq == NULL){
+		CTX_LOGERR("wrong parameters: pq (%p)\n", pq);
+		return 1;
+	}
+
+	s = _pqx_lookup(pq, handle);
+	if(s == NULL)
+		return 2;
+
+	_pqx_remove_at(pq, s->pos, buf);
+
+	return 0;
+}
+
+/*
+ * look up an item by its handle
+ */
+int priority_queuex_get(void *p, unsigned long long handle, void **item,
+			long long *prio)
+{
+	struct pqx_slot *s;
+	struct priority_queuex *pq = (struct priority_queuex*)p;
+
+	if(pq == NULL){
+		CTX_LOGERR("wrong parameters: pq (%p)\n", pq);
+		return 1;
+	}
+
+	s = _pqx_lookup(pq, handle);
+	if(s == NULL)
+		return 2;
+
+	if(item != NULL)
+		*item = _pqx_payload(s);
+	if(prio != NULL)
+		*prio = pq->heap[s->pos].prio;
+
+	return 0;
+}
+
+/*
+ * return the number of items
+ */
+int priority_queuex_size(void *p, int *size)
+{
+	struct priority_queuex *pq = (struct priority_queuex*)p;
+
+	if(pq == NULL || size == NULL)
+		return 1;
+
+	*size = pq->size;
+
+	return 0;
+}
+
+/*
+ * free a priority queue
+ */
+int priority_queuex_free(void *p)
+{
+	struct priority_queuex *pq = (struct priority_queuex*)p;
+
+	if(pq == NULL){
+		CTX_LOGERR("wrong parameters: pq (%p)\n", pq);
+		return 1;
+	}
+
+	static_linked_listx_free(pq->items);
+	free(pq->mem);
+	free(pq->scratch);
+	free(pq);
+
+	return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * An indexed priority queue, implemented as a 4-ary min-heap. The items are
+ * kept in the slots of a static linked list and never move inside the heap;
+ * the heap itself is a compact array of (priority, slot index) pairs, laid
+ * out so that the four children of a node share one cache line. Every item
+ * has a handle that stays valid until the item is popped or cancelled, so its
+ * priority can be changed, or the item cancelled, in O(log n) without a
+ * search.
+ *
+ * Smaller priorities are popped first. The queue is not thread-safe.
+ *
+ * Author: Wei Wang <wwang@virginia.edu>
+ */
+
+#ifndef __COMMON_TOOLX_PRIORITY_QUEUEX_H__
+#define __COMMON_TOOLX_PRIORITY_QUEUEX_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A handle is the slot index of the item in the lower 32 bits and a
+ * generation in the higher 32 bits, so the handle of an item that has left
+ * the queue is detected as stale.
+ */
+#define PRIORITY_QUEUEX_NULL_HANDLE 0ULL
+
+/*
+ * Initialize a priority queue.
+ * Input parameters:
+ *     item_size: the size of each item, can be 0 if only priorities and
+ *                handles are used
+ * Output parameters:
+ *     pq: the handle to the queue
+ * Return values:
+ *     0: success
+ *     1: wrong parameter, pq is NULL
+ *     2: unable to allocate space
+ */
+int priority_queuex_init(void **pq, unsigned int item_size);
+
+/*
+ * Insert an item.
+ * Input parameters:
+ *     pq: the priority queue
+ *     prio: the priority of the item
+ *     item: the item to copy into the queue, can be NULL if item_size is 0
+ * Output parameters:
+ *     handle: the handle to the item, can be NULL
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ *     2: unable to allocate space
+ */
+int priority_queuex_push(void *pq, long long prio, void *item,
+			 unsigned long long *handle);
+
+/*
+ * Insert n items in a batch and restore the heap once, in O(n + size).
+ * Input parameters:
+ *     pq: the priority queue
+ *     n: the number of items
+ *     prios: the priorities of the items
+ *     items: an array of n items, can be NULL if item_size is 0
+ * Output parameters:
+ *     handles: the handles of the items, can be NULL
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ *     2: unable to allocate space, no item is inserted
+ */
+int priority_queuex_heapify(void *pq, int n, long long *prios, void *items,
+			    unsigned long long *handles);
+
+/*
+ * Return the item with the smallest priority without removing it.
+ * Input parameters:
+ *     pq: the priority queue
+ * Output parameters:
+ *     prio: the priority of the item, can be NULL
+ *     item: the address of the item inside the queue, can be NULL; valid
+ *           until the next insertion
+ *     handle: the handle to the item, can be NULL
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ *     2: the queue is empty
+ */
+int priority_queuex_top(void *pq, long long *prio, void **item,
+			unsigned long long *handle);
+
+/*
+ * Remove the item with the smallest priority.
+ * Input parameters:
+ *     pq: the priority queue
+ * Output parameters:
+ *     prio: the priority of the item, can be NULL
+ *     buf: the item is copied here, can be NULL
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ *     2: the queue is empty
+ */
+int priority_queuex_pop(void *pq, long long *prio, void *buf);
+
+/*
+ * Change the priority of an item (decrease-key or increase-key).
+ * Input parameters:
+ *     pq: the priority queue
+ *     handle: the handle to the item
+ *     prio: the new priority
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ *     2: stale handle, the item is not in the queue
+ */
+int priority_queuex_update(void *pq, unsigned long long handle,
+			   long long prio);
+
+/*
+ * Remove an item by its handle.
+ * Input parameters:
+ *     pq: the priority queue
+ *     handle: the handle to the item
+ * Output parameters:
+ *     buf: the item is copied here, can be NULL
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ *     2: stale handle, the item is not in the queue
+ */
+int priority_queuex_cancel(void *pq, unsigned long long handle, void *buf);
+
+/*
+ * Return the address and the priority of an item by its handle.
+ * Output parameters:
+ *     item: the address of the item inside the queue, can be NULL
+ *     prio: the priority of the item, can be NULL
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ *     2: stale handle, the item is not in the queue
+ */
+int priority_queuex_get(void *pq, unsigned long long handle, void **item,
+			long long *prio);
+
+/*
+ * Return the number of items in the queue.
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ */
+int priority_queuex_size(void *pq, int *size);
+
+/*
+ * Free a priority queue and all its items.
+ * Return values:
+ *     0: success
+ *     1: wrong parameter, pq is NULL
+ */
+int priority_queuex_free(void *pq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,6 +2,12 @@
  * An implementation of a static linked list with the capability to 
  * automatically increase size. I kept two lists in the data structure,
  * one for the data, one for the empty slots.
+ *
+ * The bookkeeping information, the pointers and the items can also be placed
+ * in one contiguous region (caller-supplied memory, a shared memory object or
+ * a mapped file). All links are array indices, so such a list can be mapped
+ * at different addresses by different processes. A list in a region has a 
+ * fixed capacity.
  * 
  * Author: Wei Wang <wwang@virginia.edu>
  */ 
@@ -10,6 +16,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #include "static_linked_listx.h"
 #include "common_toolx.h"
@@ -25,13 +33,59 @@
  */
 #define STATIC_LINKED_LISTX_NULL -1
 
+/*
+ * The layout of a region: this header, followed by the pointer array at 
+ * pointers_off and the item array at items_off. Offsets are from the 
+ * beginning of the region.
+ */
+#define STATIC_LINKED_LISTX_MAGIC 0x534c4c53 /* "SLLS" */
+
+struct sllst_region{
+	unsigned int magic; // STATIC_LINKED_LISTX_MAGIC once initialized
+	unsigned int pointers_off; // offset of the pointer array
+	unsigned long long items_off; // offset of the item array
+	unsigned long long region_size; // the size of the whole region
+	pthread_mutex_t lock; // process-shared lock for the users of the list
+	struct sllst_header hdr; // the bookkeeping information
+};
+
+/*
+ * Link slots from first to last (exclusive) into one chain.
+ */
+static void _sllst_chain_empty(struct sllst_pointer *pointers, int first, 
+			       int last)
+{
+	int i;
+
+	for(i = first; i < last; i++){
+		pointers[i].next = i + 1;
+		pointers[i].prev = i - 1;
+		pointers[i].has_data = 0;
+	}
+	pointers[first].prev = STATIC_LINKED_LISTX_NULL;
+	pointers[last - 1].next = STATIC_LINKED_LISTX_NULL;
+}
+
+/*
+ * Initialize the bookkeeping of an empty list with size empty slots
+ */
+static void _sllst_init_header(struct sllst_header *hdr, 
+			       unsigned int item_size, int size)
+{
+	hdr->item_size = item_size;
+	hdr->size = size;
+	hdr->head = hdr->tail = STATIC_LINKED_LISTX_NULL;
+	hdr->len = 0;
+	hdr->empty_head = 0;
+	hdr->empty_tail = size - 1;
+}
+
 /*
  * initialized a static linked list
  */
 int static_linked_listx_init(void **l,
 			     unsigned int item_size)
 {
-	int i;
 	struct static_linked_listx *list;
 
 	if(l == NULL || item_size == 0){
@@ -44,12 +98,12 @@ int static_linked_listx_init(void **l,
 	 * initialized the pointers and bookkeeping information
 	 */
 	list = (struct static_linked_listx*)
-		malloc(sizeof(struct static_linked_listx));
+		calloc(1, sizeof(struct static_linked_listx));
 	*l = (void*)list;
-	list->item_size = item_size;
-	list->size = STATIC_LINKED_LISTX_CHUNK_SIZE;
-	list->head = list->tail = STATIC_LINKED_LISTX_NULL;
-	list->len = 0;
+	list->hdr = &list->local_hdr;
+	list->fd = -1;
+	_sllst_init_header(list->hdr, item_size, 
+			   STATIC_LINKED_LISTX_CHUNK_SIZE);
 
 	/*
 	 * allocate space for items and pointers
@@ -61,23 +115,14 @@ int static_linked_listx_init(void **l,
 
 	if(list->items == NULL || list->pointers == NULL){
 		CTX_LOGERR("Unable to allocate memory with error %s\n",
-			   sys_errlist[errno]);
+			   strerror(errno));
 		return 2;
 	}
 	
 	/*
 	 * assign pointers for the empty list
 	 */
-	for(i = 0; i < STATIC_LINKED_LISTX_CHUNK_SIZE; i++){
-		list->pointers[i].next = i+1;
-		list->pointers[i].prev = i-1;
-		list->pointers[i].has_data = 0;
-	}
-	list->pointers[0].prev = STATIC_LINKED_LISTX_NULL;
-	list->pointers[STATIC_LINKED_LISTX_CHUNK_SIZE-1].next = 
-		STATIC_LINKED_LISTX_NULL;
-	list->empty_head = 0;
-	list->empty_tail = STATIC_LINKED_LISTX_CHUNK_SIZE-1;
+	_sllst_chain_empty(list->pointers, 0, STATIC_LINKED_LISTX_CHUNK_SIZE);
 
 	return 0;
 }
@@ -89,134 +134,325 @@ int static_linked_listx_init(void **l,
  * Return value:
  *     0: success
  *     1: list is NULL
- *     2: memory allocation error
+ *     2: memory allocation error, or the list lives in a region
  */
 int static_linked_listx_increase(struct static_linked_listx *list)
 {
-	char *new_items, *new_pointers;
-	int i;
+	struct sllst_header *hdr;
+	int old_size;
 
 	if(list == NULL)
 		return 1;
+
+	if(list->region != NULL){
+		CTX_DPRINTF("list in a region is full (%d items)\n", 
+			    list->hdr->size);
+		return 2;
+	}
 	
 	/*
 	 * allocate more memory
 	 */
-	list->size += STATIC_LINKED_LISTX_CHUNK_SIZE;
-	list->items = realloc(list->items, list->size * list->item_size);
-	list->pointers = realloc(list->pointers, list->size * 
+	hdr = list->hdr;
+	old_size = hdr->size;
+	hdr->size += STATIC_LINKED_LISTX_CHUNK_SIZE;
+	list->items = realloc(list->items, 
+			      (size_t)hdr->size * hdr->item_size);
+	list->pointers = realloc(list->pointers, hdr->size * 
 				 sizeof(struct sllst_pointer));
 	if(list->items == NULL || list->pointers == NULL){
 		CTX_LOGERR("Unable to reallocate space for static linked list"
-			   "with error (%d): %s\n", errno, sys_errlist[errno]);
-		return 0;
+			   "with error (%d): %s\n", errno, strerror(errno));
+		return 2;
 	}
-	new_items = (char*)list->items + 
-		(list->size - STATIC_LINKED_LISTX_CHUNK_SIZE) * list->item_size;
-	new_pointers = (char*)list->pointers + 
-		(list->size - STATIC_LINKED_LISTX_CHUNK_SIZE) * 
-		sizeof(struct sllst_pointer);
-	memset(new_items, 0, STATIC_LINKED_LISTX_CHUNK_SIZE * list->item_size);
-	memset(new_pointers, 0, STATIC_LINKED_LISTX_CHUNK_SIZE * 
-	       sizeof(struct sllst_pointer));
-	
+	memset((char*)list->items + (size_t)old_size * hdr->item_size, 0, 
+	       (size_t)STATIC_LINKED_LISTX_CHUNK_SIZE * hdr->item_size);
 	
 	/*
 	 * adjust empty list pointers
 	 */
-	for(i = list->size - STATIC_LINKED_LISTX_CHUNK_SIZE; i < list->size; 
-	    i++){
-		list->pointers[i].next = i + 1;
-		list->pointers[i].prev = i - 1;
-		list->pointers[i].has_data = 0;
-	}
-	if(list->empty_head == STATIC_LINKED_LISTX_NULL){
+	_sllst_chain_empty(list->pointers, old_size, hdr->size);
+	if(hdr->empty_head == STATIC_LINKED_LISTX_NULL){
 		// list is full, empty head has to reset as well
-		list->empty_head = list->size - STATIC_LINKED_LISTX_CHUNK_SIZE;
-		list->empty_tail = list->size - 1;
-		list->pointers[list->empty_head].prev = 
-			STATIC_LINKED_LISTX_NULL;
-		list->pointers[list->empty_tail].next = 
-			STATIC_LINKED_LISTX_NULL;
+		hdr->empty_head = old_size;
 	}
 	else{
-		list->pointers[list->empty_tail].next = list->size - 
-			STATIC_LINKED_LISTX_CHUNK_SIZE;
-		list->empty_tail = list->size - 1;
-		list->pointers[list->empty_tail].next = 
-			STATIC_LINKED_LISTX_NULL;
+		list->pointers[hdr->empty_tail].next = old_size;
+		list->pointers[old_size].prev = hdr->empty_tail;
 	}
+	hdr->empty_tail = hdr->size - 1;
 	
 	return 0;
 }
 
 /*
- * insert a new item into the list
+ * Helper macros for the pointers and the data of slot idx
  */
-int static_linked_listx_insert(void *l, void * item)
+#define SLLST_NEXT(list, idx) ((list)->pointers[(idx)].next)
+#define SLLST_PREV(list, idx) ((list)->pointers[(idx)].prev)
+#define SLLST_ITEM(list, idx)						\
+	((void*)((char*)(list)->items + (size_t)(idx) * (list)->hdr->item_size))
+
+/*
+ * Take the first slot of the empty list, increase the list space if there is
+ * no empty slot left. The slot is marked as having data, but it is not linked
+ * into the data list.
+ * Return the index of the slot, or STATIC_LINKED_LISTX_NULL if the list space
+ * can not be increased.
+ */
+static int _sllst_take_empty(struct static_linked_listx *list)
 {
-	char *dest;
 	int idx;
-	struct static_linked_listx *list = (struct static_linked_listx*)l;
-
-	if(list == NULL || item == NULL){
-		CTX_LOGERR("wrong parameter: list (%p) and item (%p)\n", list,
-			   item);
-		return 1;
-	}
 
 	/*
 	 * there is no room left in the linked list
 	 */
-	if(list->empty_head == STATIC_LINKED_LISTX_NULL){
+	if(list->hdr->empty_head == STATIC_LINKED_LISTX_NULL){
 		CTX_DPRINTF("allocating more space\n");
 		if(static_linked_listx_increase(list))
-			return 2;
+			return STATIC_LINKED_LISTX_NULL;
 	}
 
 	/*
-	 * save into the first empty space
+	 * remove the first item from empty list
 	 */
-	idx = list->empty_head;
-	dest = (char*)list->items + idx * list->item_size;
-	CTX_DPRINTF("dest is %p, list is %p\n", dest, list->items);
-	memcpy(dest, item, list->item_size);
+	idx = list->hdr->empty_head;
+	list->hdr->empty_head = SLLST_NEXT(list, idx);
+	if(list->hdr->empty_head != STATIC_LINKED_LISTX_NULL)
+		SLLST_PREV(list, list->hdr->empty_head) = 
+			STATIC_LINKED_LISTX_NULL;
+	else
+		list->hdr->empty_tail = STATIC_LINKED_LISTX_NULL;
 	list->pointers[idx].has_data = 1;
+
+	return idx;
+}
+
+/*
+ * Add a slot back to the front of the empty list, so that the most recently
+ * freed (and still cache-warm) slot is reused first. The slot must have been
+ * unlinked from the data list.
+ */
+static void _sllst_put_empty(struct static_linked_listx *list, int idx)
+{
+	list->pointers[idx].has_data = 0;
+	SLLST_PREV(list, idx) = STATIC_LINKED_LISTX_NULL;
+	SLLST_NEXT(list, idx) = list->hdr->empty_head;
+	if(list->hdr->empty_head != STATIC_LINKED_LISTX_NULL)
+		// empty list still has slots
+		SLLST_PREV(list, list->hdr->empty_head) = idx;
+	else
+		// empty list is empty
+		list->hdr->empty_tail = idx;
+	list->hdr->empty_head = idx;
+}
+
+/*
+ * Link the slots from first to last into the chain (head, tail) after slot
+ * pidx. If pidx is STATIC_LINKED_LISTX_NULL, the slots become the beginning
+ * of the chain. The length of the chain is not changed.
+ */
+static void _sllst_chain_link_after(struct static_linked_listx *list, 
+				    int *head, int *tail, int pidx, 
+				    int first, int last)
+{
+	int next;
+
+	next = (pidx == STATIC_LINKED_LISTX_NULL) ? 
+		*head : SLLST_NEXT(list, pidx);
+
+	SLLST_PREV(list, first) = pidx;
+	SLLST_NEXT(list, last) = next;
+	if(pidx == STATIC_LINKED_LISTX_NULL)
+		*head = first;
+	else
+		SLLST_NEXT(list, pidx) = first;
+	if(next == STATIC_LINKED_LISTX_NULL)
+		*tail = last;
+	else
+		SLLST_PREV(list, next) = last;
+}
+
+/*
+ * Unlink the slots from first to last from the chain (head, tail). The 
+ * length of the chain is not changed.
+ */
+static void _sllst_chain_unlink(struct static_linked_listx *list, 
+				int *head, int *tail, int first, int last)
+{
+	int prev, next; // previous and next item of the chain
+
+	prev = SLLST_PREV(list, first);
+	next = SLLST_NEXT(list, last);
+
+	if(prev == STATIC_LINKED_LISTX_NULL)
+		// removing the first item in the list
+		*head = next;
+	else
+		SLLST_NEXT(list, prev) = next;
+
+	if(next == STATIC_LINKED_LISTX_NULL)
+		// removing the last item
+		*tail = prev;
+	else
+		SLLST_PREV(list, next) = prev;
+
+	SLLST_PREV(list, first) = STATIC_LINKED_LISTX_NULL;
+	SLLST_NEXT(list, last) = STATIC_LINKED_LISTX_NULL;
+}
+
+/*
+ * Link or unlink slots from first to last to or from the data list
+ */
+static inline void _sllst_link_after(struct static_linked_listx *list, 
+				     int pidx, int first, int last)
+{
+	_sllst_chain_link_after(list, &list->hdr->head, &list->hdr->tail, 
+				pidx, first, last);
+}
+
+static inline void _sllst_unlink(struct static_linked_listx *list, int first,
+				 int last)
+{
+	_sllst_chain_unlink(list, &list->hdr->head, &list->hdr->tail, first, 
+			    last);
+}
+
+/*
+ * Check whether the empty list has at least cnt slots, walking at most cnt
+ * slots of it
+ */
+static int _sllst_has_empty(struct static_linked_listx *list, int cnt)
+{
+	int idx;
+
+	for(idx = list->hdr->empty_head; idx != STATIC_LINKED_LISTX_NULL && 
+		    cnt > 0; idx = SLLST_NEXT(list, idx))
+		cnt--;
+
+	return (cnt == 0);
+}
+
+/*
+ * Check whether idx is a valid index that holds data
+ */
+static inline int _sllst_check_idx(struct static_linked_listx *list, int idx)
+{
+	return (idx >= 0 && idx < list->hdr->size && 
+		list->pointers[idx].has_data);
+}
+
+/*
+ * Copy item into a new slot, and link the new slot after pidx. 
+ */
+static int _sllst_insert_after(struct static_linked_listx *list, int pidx, 
+			       void *item, int *nidx)
+{
+	int idx;
 	
+	idx = _sllst_take_empty(list);
+	if(idx == STATIC_LINKED_LISTX_NULL)
+		return 2;
+
 	/*
-	 * remove the first item from empty list
+	 * save into the empty slot
 	 */
-	list->empty_head = list->pointers[list->empty_head].next;
-	if(list->empty_head != STATIC_LINKED_LISTX_NULL)
-		list->pointers[list->empty_head].prev = 
-			STATIC_LINKED_LISTX_NULL;
-	else
-		list->empty_tail = STATIC_LINKED_LISTX_NULL;
+	CTX_DPRINTF("dest is %p, list is %p\n", SLLST_ITEM(list, idx), 
+		    list->items);
+	memcpy(SLLST_ITEM(list, idx), item, list->hdr->item_size);
 
 	/*
 	 * insert the new item to data list
 	 */
-	if(list->tail != STATIC_LINKED_LISTX_NULL)
-		list->pointers[list->tail].next = idx;
-	list->pointers[idx].prev = list->tail;
-	list->pointers[idx].next = STATIC_LINKED_LISTX_NULL;
-	list->tail = idx;
-	if(list->head == STATIC_LINKED_LISTX_NULL)
-		list->head = idx;
-	list->len++;
-	
+	_sllst_link_after(list, pidx, idx, idx);
+	list->hdr->len++;
+
+	if(nidx != NULL)
+		*nidx = idx;
+
 	return 0;
 }
 
+/*
+ * insert a new item into the list
+ */
+int static_linked_listx_insert(void *l, void * item)
+{
+	return static_linked_listx_push_back(l, item, NULL);
+}
+
+/*
+ * insert a new item at the end of the list
+ */
+int static_linked_listx_push_back(void *l, void *item, int *idx)
+{
+	struct static_linked_listx *list = (struct static_linked_listx*)l;
+
+	if(list == NULL || item == NULL){
+		CTX_LOGERR("wrong parameter: list (%p) and item (%p)\n", list,
+			   item);
+		return 1;
+	}
+
+	return _sllst_insert_after(list, list->hdr->tail, item, idx);
+}
+
+/*
+ * insert a new item at the beginning of the list
+ */
+int static_linked_listx_push_front(void *l, void *item, int *idx)
+{
+	struct static_linked_listx *list = (struct static_linked_listx*)l;
+
+	if(list == NULL || item == NULL){
+		CTX_LOGERR("wrong parameter: list (%p) and item (%p)\n", list,
+			   item);
+		return 1;
+	}
+
+	return _sllst_insert_after(list, STATIC_LINKED_LISTX_NULL, item, idx);
+}
+
+/*
+ * insert a new item after pidx
+ */
+int static_linked_listx_insert_after(void *l, int pidx, void *item, int *idx)
+{
+	struct static_linked_listx *list = (struct static_linked_listx*)l;
+
+	if(list == NULL || item == NULL || !_sllst_check_idx(list, pidx)){
+		CTX_LOGERR("wrong parameter: list (%p), pidx (%d) and item "
+			   "(%p)\n", list, pidx, item);
+		return 1;
+	}
+
+	return _sllst_insert_after(list, pidx, item, idx);
+}
+
+/*
+ * insert a new item before nidx
+ */
+int static_linked_listx_insert_before(void *l, int nidx, void *item, int *idx)
+{
+	struct static_linked_listx *list = (struct static_linked_listx*)l;
+
+	if(list == NULL || item == NULL || !_sllst_check_idx(list, nidx)){
+		CTX_LOGERR("wrong parameter: list (%p), nidx (%d) and item "
+			   "(%p)\n", list, nidx, item);
+		return 1;
+	}
+
+	return _sllst_insert_after(list, SLLST_PREV(list, nidx), item, idx);
+}
+
 /*
  * remove an item from the list
  */
 int static_linked_listx_remove(void *l, int idx)
 {
-	int prev, next; //previous and next item of idx
 	struct static_linked_listx *list = (struct static_linked_listx*)l;
 
-	if(list == NULL || idx >= list->size || idx < 0){
+	if(list == NULL || idx >= list->hdr->size || idx < 0){
 		CTX_LOGERR("wrong parameters: list (%p) and idx (%d)\n", list, 
 			   idx);
 		return 1;
@@ -228,49 +464,371 @@ int static_linked_listx_remove(void *l, int idx)
 	}
 	
 	/*
-	 * remove the item for data list
+	 * remove the item for data list and add it back to the empty list
 	 */
-	prev = list->pointers[idx].prev;
-	next = list->pointers[idx].next;
-	
-	if(idx == list->head){
-		// removing the first item in the list
-		list->head = next;
-		if(list->head == STATIC_LINKED_LISTX_NULL)
-			// this is also the last item
-			list->tail = STATIC_LINKED_LISTX_NULL;
-		else
-			list->pointers[next].prev = STATIC_LINKED_LISTX_NULL;
-	}
-	else if(idx == list->tail){
-		// removing the last item
-		list->tail = list->pointers[idx].prev;
-		list->pointers[prev].next = STATIC_LINKED_LISTX_NULL;
+	_sllst_unlink(list, idx, idx);
+	list->hdr->len--;
+	_sllst_put_empty(list, idx);
+
+	return 0;
+}
+
+/*
+ * remove the first or the last item, and copy it to buf
+ */
+static int _sllst_pop(struct static_linked_listx *list, int idx, void *buf)
+{
+	if(idx == STATIC_LINKED_LISTX_NULL)
+		return 2;
+
+	if(buf != NULL)
+		memcpy(buf, SLLST_ITEM(list, idx), list->hdr->item_size);
+	_sllst_unlink(list, idx, idx);
+	list->hdr->len--;
+	_sllst_put_empty(list, idx);
+
+	return 0;
+}
+
+int static_linked_listx_pop_front(void *l, void *buf)
+{
+	struct static_linked_listx *list = (struct static_linked_listx*)l;
+
+	if(list == NULL){
+		CTX_LOGERR("wrong parameters: list (%p)\n", list);
+		return 1;
 	}
-	else{
-		// removing an item inside the list
-		list->pointers[prev].next = next;
-		list->pointers[next].prev = prev;
+
+	return _sllst_pop(list, list->hdr->head, buf);
+}
+
+int static_linked_listx_pop_back(void *l, void *buf)
+{
+	struct static_linked_listx *list = (struct static_linked_listx*)l;
+
+	if(list == NULL){
+		CTX_LOGERR("wrong parameters: list (%p)\n", list);
+		return 1;
 	}
-	list->len--;
-	
+
+	return _sllst_pop(list, list->hdr->tail, buf);
+}
+
+/*
+ * move an item to the beginning or the end of the list
+ */
+int static_linked_listx_move_to_front(void *l, int idx)
+{
+	struct static_linked_listx *list = (struct static_linked_listx*)l;
+
+	if(list == NULL || !_sllst_check_idx(list, idx)){
+		CTX_LOGERR("wrong parameters: list (%p) and idx (%d)\n", list, 
+			   idx);
+		return 1;
+	}
+
+	if(idx != list->hdr->head){
+		_sllst_unlink(list, idx, idx);
+		_sllst_link_after(list, STATIC_LINKED_LISTX_NULL, idx, idx);
+	}
+
+	return 0;
+}
+
+int static_linked_listx_move_to_back(void *l, int idx)
+{
+	struct static_linked_listx *list = (struct static_linked_listx*)l;
+
+	if(list == NULL || !_sllst_check_idx(list, idx)){
+		CTX_LOGERR("wrong parameters: list (%p) and idx (%d)\n", list, 
+			   idx);
+		return 1;
+	}
+
+	if(idx != list->hdr->tail){
+		_sllst_unlink(list, idx, idx);
+		_sllst_link_after(list, list->hdr->tail, idx, idx);
+	}
+
+	return 0;
+}
+
+/*
+ * move the items from first to last of src after pidx of dst
+ */
+int static_linked_listx_splice(void *d, int pidx, void *s, int first, 
+			       int last)
+{
+	int idx, next, cnt, nidx;
+	struct static_linked_listx *dst = (struct static_linked_listx*)d;
+	struct static_linked_listx *src = (struct static_linked_listx*)s;
+
+	if(dst == NULL || src == NULL || 
+	   dst->hdr->item_size != src->hdr->item_size ||
+	   !_sllst_check_idx(src, first) || !_sllst_check_idx(src, last) ||
+	   (pidx != STATIC_LINKED_LISTX_NULL && !_sllst_check_idx(dst, pidx))){
+		CTX_LOGERR("wrong parameters: dst (%p), pidx (%d), src (%p), "
+			   "first (%d) and last (%d)\n", dst, pidx, src, first,
+			   last);
+		return 1;
+	}
+
+	if(dst == src){
+		/*
+		 * same storage, just relink the chain
+		 */
+		if(pidx != SLLST_PREV(src, first)){
+			_sllst_unlink(src, first, last);
+			_sllst_link_after(src, pidx, first, last);
+		}
+		return 0;
+	}
+
 	/*
-	 * add the item back to the empty list
+	 * different storage; count the items and make sure dst has room for
+	 * all of them, so that the splice either happens as a whole or not at
+	 * all
 	 */
-	if(list->empty_tail != STATIC_LINKED_LISTX_NULL){
-		// empty list still has slots
-		list->pointers[list->empty_tail].next = idx;
-		list->pointers[idx].prev = list->empty_tail;
-		list->pointers[idx].next = STATIC_LINKED_LISTX_NULL;
-		list->empty_tail = idx;
+	cnt = 1;
+	for(idx = first; idx != last; idx = SLLST_NEXT(src, idx)){
+		if(idx == STATIC_LINKED_LISTX_NULL){
+			CTX_LOGERR("last (%d) does not follow first (%d)\n",
+				   last, first);
+			return 1;
+		}
+		cnt++;
 	}
-	else{
-		// empty list is empty
-		list->pointers[idx].prev = STATIC_LINKED_LISTX_NULL;
-		list->pointers[idx].next = STATIC_LINKED_LISTX_NULL;
-		list->empty_tail = list->empty_head = idx;
+	while(!_sllst_has_empty(dst, cnt))
+		if(static_linked_listx_increase(dst))
+			return 2;
+
+	idx = first;
+	do{
+		next = SLLST_NEXT(src, idx);
+		_sllst_insert_after(dst, pidx, SLLST_ITEM(src, idx), &nidx);
+		pidx = nidx;
+		_sllst_unlink(src, idx, idx);
+		src->hdr->len--;
+		_sllst_put_empty(src, idx);
+	}while(idx != last && (idx = next) != STATIC_LINKED_LISTX_NULL);
+
+	return 0;
+}
+
+/*
+ * sort the list with a stable bottom-up merge sort on the links
+ */
+int static_linked_listx_sort(void *l, int (*cmp)(const void *, const void *))
+{
+	int p, q, e, head, tail;
+	int insize, nmerges, psize, qsize, i;
+	struct static_linked_listx *list = (struct static_linked_listx*)l;
+
+	if(list == NULL || cmp == NULL){
+		CTX_LOGERR("wrong parameters: list (%p) and cmp (%p)\n", list,
+			   cmp);
+		return 1;
+	}
+
+	if(list->hdr->head == STATIC_LINKED_LISTX_NULL)
+		return 0;
+
+	/*
+	 * merge runs of insize items pairwise, doubling insize every pass,
+	 * until one pass does a single merge
+	 */
+	head = list->hdr->head;
+	insize = 1;
+	while(1){
+		p = head;
+		head = tail = STATIC_LINKED_LISTX_NULL;
+		nmerges = 0;
+
+		while(p != STATIC_LINKED_LISTX_NULL){
+			nmerges++;
+			// step q insize items past p
+			q = p;
+			psize = 0;
+			for(i = 0; i < insize; i++){
+				psize++;
+				q = SLLST_NEXT(list, q);
+				if(q == STATIC_LINKED_LISTX_NULL)
+					break;
+			}
+			qsize = insize;
+
+			// merge the run at p with the run at q
+			while(psize > 0 || 
+			      (qsize > 0 && q != STATIC_LINKED_LISTX_NULL)){
+				if(psize == 0 || 
+				   (qsize > 0 && 
+				    q != STATIC_LINKED_LISTX_NULL &&
+				    cmp(SLLST_ITEM(list, p), 
+					SLLST_ITEM(list, q)) > 0)){
+					e = q;
+					q = SLLST_NEXT(list, q);
+					qsize--;
+				}
+				else{
+					e = p;
+					p = SLLST_NEXT(list, p);
+					psize--;
+				}
+
+				if(tail != STATIC_LINKED_LISTX_NULL)
+					SLLST_NEXT(list, tail) = e;
+				else
+					head = e;
+				SLLST_PREV(list, e) = tail;
+				tail = e;
+			}
+			p = q;
+		}
+		SLLST_NEXT(list, tail) = STATIC_LINKED_LISTX_NULL;
+
+		if(nmerges <= 1)
+			break;
+		insize *= 2;
+	}
+
+	list->hdr->head = head;
+	list->hdr->tail = tail;
+
+	return 0;
+}
+
+/*
+ * initialize a chain
+ */
+int static_linked_listx_chain_init(struct sllst_chain *chain)
+{
+	if(chain == NULL)
+		return 1;
+
+	chain->head = chain->tail = STATIC_LINKED_LISTX_NULL;
+	chain->len = 0;
+
+	return 0;
+}
+
+/*
+ * insert an item at the end of a chain
+ */
+int static_linked_listx_chain_insert(void *l, struct sllst_chain *chain, 
+				     void *item, int *nidx)
+{
+	int idx;
+	struct static_linked_listx *list = (struct static_linked_listx*)l;
+
+	if(list == NULL || chain == NULL || item == NULL){
+		CTX_LOGERR("wrong parameters: list (%p), chain (%p) and item "
+			   "(%p)\n", list, chain, item);
+		return 1;
+	}
+
+	idx = _sllst_take_empty(list);
+	if(idx == STATIC_LINKED_LISTX_NULL)
+		return 2;
+	memcpy(SLLST_ITEM(list, idx), item, list->hdr->item_size);
+	_sllst_chain_link_after(list, &chain->head, &chain->tail, chain->tail,
+				idx, idx);
+	chain->len++;
+
+	if(nidx != NULL)
+		*nidx = idx;
+
+	return 0;
+}
+
+/*
+ * remove an item from a chain
+ */
+int static_linked_listx_chain_remove(void *l, struct sllst_chain *chain, 
+				     int idx)
+{
+	struct static_linked_listx *list = (struct static_linked_listx*)l;
+
+	if(list == NULL || chain == NULL || !_sllst_check_idx(list, idx)){
+		CTX_LOGERR("wrong parameters: list (%p), chain (%p) and idx "
+			   "(%d)\n", list, chain, idx);
+		return 1;
+	}
+
+	_sllst_chain_unlink(list, &chain->head, &chain->tail, idx, idx);
+	chain->len--;
+	_sllst_put_empty(list, idx);
+
+	return 0;
+}
+
+/*
+ * move an item from one chain to the end of another
+ */
+int static_linked_listx_chain_move(void *l, struct sllst_chain *from, 
+				   struct sllst_chain *to, int idx)
+{
+	struct static_linked_listx *list = (struct static_linked_listx*)l;
+
+	if(list == NULL || from == NULL || to == NULL || 
+	   !_sllst_check_idx(list, idx)){
+		CTX_LOGERR("wrong parameters: list (%p), from (%p), to (%p) "
+			   "and idx (%d)\n", list, from, to, idx);
+		return 1;
+	}
+
+	_sllst_chain_unlink(list, &from->head, &from->tail, idx, idx);
+	from->len--;
+	_sllst_chain_link_after(list, &to->head, &to->tail, to->tail, idx, 
+				idx);
+	to->len++;
+
+	return 0;
+}
+
+/*
+ * move all items of one chain to the end of another
+ */
+int static_linked_listx_chain_take(void *l, struct sllst_chain *from, 
+				   struct sllst_chain *to)
+{
+	struct static_linked_listx *list = (struct static_linked_listx*)l;
+
+	if(list == NULL || from == NULL || to == NULL || from == to){
+		CTX_LOGERR("wrong parameters: list (%p), from (%p) and to "
+			   "(%p)\n", list, from, to);
+		return 1;
+	}
+
+	if(from->head == STATIC_LINKED_LISTX_NULL)
+		return 0;
+
+	_sllst_chain_link_after(list, &to->head, &to->tail, to->tail, 
+				from->head, from->tail);
+	to->len += from->len;
+	static_linked_listx_chain_init(from);
+
+	return 0;
+}
+
+/*
+ * return the item at idx
+ */
+int static_linked_listx_get_item(void *l, int idx, void **item)
+{
+	struct static_linked_listx *list = (struct static_linked_listx*)l;
+
+	if(list == NULL || item == NULL){
+		CTX_LOGERR("wrong parameters: list (%p) and item (%p)\n", list,
+			   item);
+		return 1;
 	}
-	
+
+	if(!_sllst_check_idx(list, idx)){
+		*item = NULL;
+		return 2;
+	}
+
+	*item = SLLST_ITEM(list, idx);
 
 	return 0;
 }
@@ -282,7 +840,8 @@ int static_linked_listx_get_next(void *l, int pidx, int *nidx, void **item)
 {
 	struct static_linked_listx *list = (struct static_linked_listx*)l;
 	
-	if(list == NULL || pidx >= list->size || pidx < 0 || item == NULL || 
+	if(list == NULL || pidx >= list->hdr->size || pidx < 0 || 
+	   item == NULL || 
 	   nidx == NULL){
 		CTX_LOGERR("wrong parameters: list (%p) and pidx (%d) "
 			   "and item (%p) and nidx (%p)\n", 
@@ -300,7 +859,7 @@ int static_linked_listx_get_next(void *l, int pidx, int *nidx, void **item)
 	
 	*nidx = list->pointers[pidx].next;
 	if(*nidx != STATIC_LINKED_LISTX_NULL)
-		*item = (void*)((char*)list->items + *nidx * list->item_size);
+		*item = SLLST_ITEM(list, *nidx);
 
 	return 0;
 }
@@ -319,11 +878,11 @@ int static_linked_listx_get_first(void *l, int *nidx, void **item)
 		return 1;
 	}
 
-	*nidx = list->head;
+	*nidx = list->hdr->head;
 	*item = NULL;
 
 	if(*nidx != STATIC_LINKED_LISTX_NULL)
-		*item = (void*)((char*)list->items + *nidx * list->item_size);
+		*item = SLLST_ITEM(list, *nidx);
 
 	return 0;
 }
@@ -340,15 +899,252 @@ int static_linked_listx_free(void *l)
 		return 1;
 	}
 
+	if(list->region != NULL){
+		/*
+		 * the list lives in a region, and other users may still be 
+		 * attached to it; only unmap what we have mapped
+		 */
+		if(list->fd != -1)
+			unmap_shared_mem(list->region, list->region_size, 
+					 list->fd);
+		free(l);
+		return 0;
+	}
+
 	if(list->items != NULL)
 		free(list->items);
 	if(list->pointers != NULL)
 		free(list->pointers);
 
-	list->head = list->tail = STATIC_LINKED_LISTX_NULL;
-	list->empty_head = list->empty_tail = STATIC_LINKED_LISTX_NULL;
+	list->hdr->head = list->hdr->tail = STATIC_LINKED_LISTX_NULL;
+	list->hdr->empty_head = list->hdr->empty_tail = 
+		STATIC_LINKED_LISTX_NULL;
 	
 	free(l);
 
 	return 0;
 }
+
+/*
+ * the size of a region that holds capacity items
+ */
+size_t static_linked_listx_region_size(unsigned int item_size, int capacity)
+{
+	size_t items_off;
+
+	if(item_size == 0 || capacity <= 0)
+		return 0;
+
+	items_off = sizeof(struct sllst_region) + 
+		(size_t)capacity * sizeof(struct sllst_pointer);
+	items_off = (items_off + 7) & ~(size_t)7;
+
+	return items_off + (size_t)capacity * item_size;
+}
+
+/*
+ * initialize the process-shared lock of a region
+ */
+static void _sllst_init_lock(struct sllst_region *region)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&region->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+/*
+ * initialize, or attach to, a list in a region
+ */
+int static_linked_listx_init_region(void **l, void *mem, size_t mem_size,
+				    unsigned int item_size, int create)
+{
+	int capacity;
+	size_t items_off;
+	struct static_linked_listx *list;
+	struct sllst_region *region = (struct sllst_region*)mem;
+
+	if(l == NULL || region == NULL || 
+	   mem_size < sizeof(struct sllst_region) || (create && item_size == 0)){
+		CTX_LOGERR("wrong parameters: list (%p), region (%p), "
+			   "region_size (%lu) and item_size (%u)\n", l, region,
+			   (unsigned long)mem_size, item_size);
+		return 1;
+	}
+
+	if(create){
+		/*
+		 * fit as many items as possible in the region
+		 */
+		capacity = (mem_size - sizeof(struct sllst_region)) / 
+			(sizeof(struct sllst_pointer) + item_size);
+		while(capacity > 0 && 
+		      static_linked_listx_region_size(item_size, capacity) > 
+		      mem_size)
+			capacity--;
+		if(capacity <= 0){
+			CTX_LOGERR("region (%lu bytes) too small\n", 
+				   (unsigned long)mem_size);
+			return 1;
+		}
+		items_off = static_linked_listx_region_size(item_size, 
+							    capacity) - 
+			(size_t)capacity * item_size;
+
+		region->magic = 0;
+		region->pointers_off = sizeof(struct sllst_region);
+		region->items_off = items_off;
+		region->region_size = mem_size;
+		_sllst_init_lock(region);
+		_sllst_init_header(&region->hdr, item_size, capacity);
+		_sllst_chain_empty((struct sllst_pointer*)
+				   ((char*)region + region->pointers_off), 
+				   0, capacity);
+		// publish the region only after it is fully initialized
+		__atomic_store_n(&region->magic, STATIC_LINKED_LISTX_MAGIC,
+				 __ATOMIC_RELEASE);
+	}
+	else if(__atomic_load_n(&region->magic, __ATOMIC_ACQUIRE) != 
+		STATIC_LINKED_LISTX_MAGIC || region->region_size > mem_size ||
+		(item_size != 0 && item_size != region->hdr.item_size)){
+		CTX_LOGERR("region (%p) does not hold a valid list\n", region);
+		return 3;
+	}
+
+	list = (struct static_linked_listx*)
+		calloc(1, sizeof(struct static_linked_listx));
+	if(list == NULL)
+		return 2;
+	list->hdr = &region->hdr;
+	list->pointers = (struct sllst_pointer*)
+		((char*)region + region->pointers_off);
+	list->items = (char*)region + region->items_off;
+	list->region = region;
+	list->region_size = mem_size;
+	list->fd = -1;
+	*l = (void*)list;
+
+	return 0;
+}
+
+/*
+ * create or open a list in a named shared memory object or a file
+ */
+int static_linked_listx_open_shared(void **l, const char *name, 
+				    unsigned int item_size, int capacity, 
+				    int flags)
+{
+	int fd, ret_val, map_flags = 0;
+	size_t size = 0;
+	void *mem;
+
+	if(l == NULL || name == NULL || 
+	   ((flags & STATIC_LINKED_LISTX_CREATE) && 
+	    (item_size == 0 || capacity <= 0))){
+		CTX_LOGERR("wrong parameters: list (%p), name (%p), item_size "
+			   "(%u) and capacity (%d)\n", l, name, item_size, 
+			   capacity);
+		return 1;
+	}
+	*l = NULL;
+
+	if(flags & STATIC_LINKED_LISTX_CREATE){
+		map_flags |= CTX_SHM_CREATE;
+		size = static_linked_listx_region_size(item_size, capacity);
+	}
+	if(flags & STATIC_LINKED_LISTX_FILE)
+		map_flags |= CTX_SHM_FILE;
+
+	if(map_shared_mem(name, map_flags, &size, &fd, &mem))
+		return 2;
+
+	ret_val = static_linked_listx_init_region(l, mem, size, item_size,
+						  flags & 
+						  STATIC_LINKED_LISTX_CREATE);
+	if(ret_val){
+		unmap_shared_mem(mem, size, fd);
+		return ret_val == 1 ? 3 : ret_val;
+	}
+	((struct static_linked_listx*)*l)->fd = fd;
+	if(flags & STATIC_LINKED_LISTX_RESET_LOCK)
+		_sllst_init_lock((struct sllst_region*)mem);
+
+	return 0;
+}
+
+/*
+ * flush a file-backed list to its file
+ */
+int static_linked_listx_sync(void *l)
+{
+	struct static_linked_listx *list = (struct static_linked_listx*)l;
+
+	if(list == NULL || list->region == NULL){
+		CTX_LOGERR("wrong parameters: list (%p)\n", list);
+		return 1;
+	}
+
+	if(msync(list->region, list->region_size, MS_SYNC)){
+		CTX_DPRINTF("Cannot sync list: %s\n", strerror(errno));
+		return 2;
+	}
+
+	return 0;
+}
+
+/*
+ * lock and unlock a list in a region
+ */
+int static_linked_listx_lock(void *l)
+{
+	int ret_val;
+	struct static_linked_listx *list = (struct static_linked_listx*)l;
+	struct sllst_region *region;
+
+	if(list == NULL || list->region == NULL){
+		CTX_LOGERR("wrong parameters: list (%p)\n", list);
+		return 1;
+	}
+	region = (struct sllst_region*)list->region;
+
+	ret_val = pthread_mutex_lock(&region->lock);
+	if(ret_val == EOWNERDEAD){
+		/*
+		 * the previous owner died while holding the lock; the links
+		 * may be half updated, but the lock itself is usable again
+		 */
+		CTX_LOGERR("previous owner of list (%p) died\n", list);
+		pthread_mutex_consistent(&region->lock);
+		return 3;
+	}
+
+	return ret_val ? 2 : 0;
+}
+
+int static_linked_listx_unlock(void *l)
+{
+	struct static_linked_listx *list = (struct static_linked_listx*)l;
+
+	if(list == NULL || list->region == NULL){
+		CTX_LOGERR("wrong parameters: list (%p)\n", list);
+		return 1;
+	}
+
+	return pthread_mutex_unlock(&((struct sllst_region*)list->region)->lock)
+		? 2 : 0;
+}
+
+/*
+ * remove a named shared list
+ */
+int static_linked_listx_destroy_shared(const char *name, int flags)
+{
+	if(name == NULL)
+		return 1;
+
+	return destroy_shared_mem(name, (flags & STATIC_LINKED_LISTX_FILE) ?
+				  CTX_SHM_FILE : 0) ? 2 : 0;
+}
@@ -8,6 +8,8 @@
 #ifndef __COMMON_TOOLX_STATIC_LINKED_LISTX_H__
 #define __COMMON_TOOLX_STATIC_LINKED_LISTX_H__
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -18,10 +20,10 @@ struct sllst_pointer{
 	int prev; // array index of previous item
 };
 
-struct static_linked_listx{
+// the bookkeeping information of a list; it only holds indices, so for a 
+// list in a region it is kept inside the region
+struct sllst_header{
 	unsigned int item_size; // the size of the item
-	void * items; // the array of the data items
-	struct sllst_pointer * pointers; // the array of the pointers;
 	int len; // the number of items
 	int size; // the size of the items array
 	int head; // the index of the first data
@@ -30,6 +32,16 @@ struct static_linked_listx{
 	int empty_tail; // the index of the last empty item
 };
 
+struct static_linked_listx{
+	struct sllst_header *hdr; // points to local_hdr, or into the region
+	void * items; // the array of the data items
+	struct sllst_pointer * pointers; // the array of the pointers;
+	struct sllst_header local_hdr; // bookkeeping of a private list
+	void * region; // the region holding the list, NULL if private
+	size_t region_size; // the size of the region
+	int fd; // file descriptor if the region is mapped by us, or -1
+};
+
 /*
  * Initialized a static linked list.
  * Input parameters:
@@ -55,6 +67,104 @@ int static_linked_listx_init(void **list,
  */
 int static_linked_listx_insert(void *list, void * item);
 
+/*
+ * Insert an item at the end (push_back) or the beginning (push_front) of the 
+ * linked list. Together with the pop functions below, these make the list a
+ * double-ended queue.
+ * Input parameters:
+ *     list: the list to which insert
+ *     item: the item to be inserted
+ * Output parameters:
+ *     idx: the index of the new item, can be NULL
+ * Return values:
+ *     0: success
+ *     1: wrong parameter, list and/or item is NULL
+ *     2: unable to increase list space
+ */
+int static_linked_listx_push_back(void *list, void *item, int *idx);
+int static_linked_listx_push_front(void *list, void *item, int *idx);
+
+/*
+ * Insert an item after item pidx, or before item nidx.
+ * Input parameters:
+ *     list: the list to which insert
+ *     pidx/nidx: the index of the item to insert after/before
+ *     item: the item to be inserted
+ * Output parameters:
+ *     idx: the index of the new item, can be NULL
+ * Return values:
+ *     0: success
+ *     1: wrong parameter, list and/or item is NULL, or pidx/nidx has no item
+ *     2: unable to increase list space
+ */
+int static_linked_listx_insert_after(void *list, int pidx, void *item, 
+				     int *idx);
+int static_linked_listx_insert_before(void *list, int nidx, void *item, 
+				      int *idx);
+
+/*
+ * Remove the first (pop_front) or the last (pop_back) item from the linked 
+ * list.
+ * Input parameters:
+ *     list: the list from which to remove
+ * Output parameters:
+ *     buf: the removed item is copied here, can be NULL
+ * Return values:
+ *     0: success
+ *     1: wrong parameter, list is NULL
+ *     2: the list is empty
+ */
+int static_linked_listx_pop_front(void *list, void *buf);
+int static_linked_listx_pop_back(void *list, void *buf);
+
+/*
+ * Move an item to the beginning or the end of the linked list. Only the links
+ * are changed, so the index of the item stays the same.
+ * Input parameters:
+ *     list: the list
+ *     idx: the index of the item
+ * Return values:
+ *     0: success
+ *     1: wrong parameter, list is NULL or idx has no item
+ */
+int static_linked_listx_move_to_front(void *list, int idx);
+int static_linked_listx_move_to_back(void *list, int idx);
+
+/*
+ * Move the items from first to last (inclusive) of list src to list dst, and
+ * insert them after item pidx of dst. If pidx is -1, the items are inserted
+ * at the beginning of dst. Both lists must have the same item_size.
+ * When src and dst are the same list, only the links are changed, which is
+ * O(1) and keeps the indices of the items; pidx must not be inside the moved
+ * range in this case. Otherwise, the items are copied into new slots of dst
+ * (their indices change), which is O(number of items); dst is grown before
+ * any item is moved, so a failed splice leaves both lists unchanged.
+ * Input parameters:
+ *     dst: the list to insert to
+ *     pidx: the item of dst to insert after, or -1
+ *     src: the list to remove from
+ *     first, last: the range of items of src, last must follow first
+ * Return values:
+ *     0: success
+ *     1: wrong parameter
+ *     2: unable to increase the space of dst
+ */
+int static_linked_listx_splice(void *dst, int pidx, void *src, int first, 
+			       int last);
+
+/*
+ * Sort the linked list in place with a stable merge sort. Only the next/prev
+ * links are changed; the items are not moved and keep their indices.
+ * Input parameters:
+ *     list: the list to sort
+ *     cmp: the comparison function, as in qsort
+ * Return values:
+ *     0: success
+ *     1: wrong parameter, list and/or cmp is NULL
+ */
+int static_linked_listx_sort(void *list, 
+			     int (*cmp)(const void *, const void *));
+
 /*
  * Remove an item into the linked list
  * Input parameters:
@@ -87,7 +197,92 @@ int static_linked_listx_get_next(void *list,
 				 int pidx, int *nidx, void **item);
 
 /*
- * free a static linked list.
+ * Return the item at index idx.
+ * Input parameters:
+ *     list: the static linked list
+ *     idx: the index of the item
+ * Output parameters:
+ *     item: the address of the item, NULL if idx has no item. The address
+ *           is only valid until the list space is increased.
+ * Return value:
+ *     0: success
+ *     1: wrong parameters
+ *     2: idx has no item
+ */
+int static_linked_listx_get_item(void *list, int idx, void **item);
+
+/*
+ * Chains. Besides its own data list, the storage of a list can hold any 
+ * number of chains, each a separate doubly linked list of items. The chain
+ * heads are kept by the caller, and the items of all chains share the empty
+ * slots of the list. Items on chains are not on the data list, and are not
+ * counted in its length. An item keeps its index while it moves between 
+ * chains, so the index can be used as a handle.
+ */
+struct sllst_chain{
+	int head; // the index of the first item of the chain
+	int tail; // the index of the last item of the chain
+	int len; // the number of items on the chain
+};
+
+/*
+ * Initialize an empty chain.
+ * Return values:
+ *     0: success
+ *     1: wrong parameter, chain is NULL
+ */
+int static_linked_listx_chain_init(struct sllst_chain *chain);
+
+/*
+ * Insert an item at the end of a chain.
+ * Input parameters:
+ *     list: the list whose storage is used
+ *     chain: the chain
+ *     item: the item to be inserted
+ * Output parameters:
+ *     idx: the index of the new item, can be NULL
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ *     2: unable to increase list space
+ */
+int static_linked_listx_chain_insert(void *list, struct sllst_chain *chain,
+				     void *item, int *idx);
+
+/*
+ * Remove the item at idx from a chain, and free its slot. The item must be 
+ * on the chain.
+ * Return values:
+ *     0: success
+ *     1: wrong parameters, or idx has no item
+ */
+int static_linked_listx_chain_remove(void *list, struct sllst_chain *chain,
+				     int idx);
+
+/*
+ * Move the item at idx from chain from to the end of chain to, in O(1). The
+ * item must be on chain from.
+ * Return values:
+ *     0: success
+ *     1: wrong parameters, or idx has no item
+ */
+int static_linked_listx_chain_move(void *list, struct sllst_chain *from, 
+				   struct sllst_chain *to, int idx);
+
+/*
+ * Move all items of chain from to the end of chain to, in O(1). Chain from
+ * becomes empty.
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ */
+int static_linked_listx_chain_take(void *list, struct sllst_chain *from, 
+				   struct sllst_chain *to);
+
+/*
+ * free a static linked list. For a list in a region, only the handle is freed
+ * (and the region unmapped if static_linked_listx_open_shared mapped it); the
+ * list itself stays in the region.
  * Input parameters:
  *     list: the list to initialized, caller should allocate space for it
  * Return values:
@@ -95,6 +290,104 @@ int static_linked_listx_get_next(void *list,
  *     1: wrong parameter, list
  */
 int static_linked_listx_free(void *list);
+
+/*
+ * Lists in a region. The bookkeeping information, the pointers and the items 
+ * of such a list are all placed in one region, and are linked by indices 
+ * only, so the region can be shared by processes that map it at different 
+ * addresses, or saved to a file and mapped again later. A list in a region 
+ * has a fixed capacity; inserting into a full list returns 2.
+ *
+ * The list functions do no locking. Processes sharing a list should bracket
+ * their operations with static_linked_listx_lock/unlock.
+ */
+
+/*
+ * Return the size of a region that holds capacity items of item_size bytes,
+ * or 0 if the parameters are invalid.
+ */
+size_t static_linked_listx_region_size(unsigned int item_size, int capacity);
+
+/*
+ * Create a list in caller-supplied memory, or attach to a list that has been
+ * created in it.
+ * Input parameters:
+ *     region: the memory of the list
+ *     region_size: the size of the memory; a new list gets as many items 
+ *                  as fit in it
+ *     item_size: the size of each item; when attaching, 0 skips the check
+ *     create: 1 to create a new list, 0 to attach to an existing one
+ * Output parameters:
+ *     list: the handle to the list
+ * Return values:
+ *     0: success
+ *     1: wrong parameter, or the region is too small
+ *     2: unable to allocate the handle
+ *     3: the region does not hold a list of this item_size
+ */
+int static_linked_listx_init_region(void **list, void *region, 
+				    size_t region_size, unsigned int item_size,
+				    int create);
+
+/*
+ * Create or open a list in a named shared memory object or a file.
+ * Input parameters:
+ *     name: the name of the shared memory object (with a leading slash), or 
+ *           the path of the file with STATIC_LINKED_LISTX_FILE
+ *     item_size: the size of each item; when opening, 0 skips the check
+ *     capacity: the maximum number of items of a new list
+ *     flags: STATIC_LINKED_LISTX_CREATE: create a new list, fail if exists
+ *            STATIC_LINKED_LISTX_FILE: name is a file path
+ *            STATIC_LINKED_LISTX_RESET_LOCK: re-initialize the lock, for a 
+ *                 file that was saved while the lock was held
+ * Output parameters:
+ *     list: the handle to the list
+ * Return values:
+ *     0: success
+ *     1: wrong parameter
+ *     2: unable to open or map the object
+ *     3: the object does not hold a list of this item_size
+ */
+#define STATIC_LINKED_LISTX_CREATE 0x1
+#define STATIC_LINKED_LISTX_FILE 0x2
+#define STATIC_LINKED_LISTX_RESET_LOCK 0x4
+int static_linked_listx_open_shared(void **list, const char *name, 
+				    unsigned int item_size, int capacity, 
+				    int flags);
+
+/*
+ * Flush a list in a mapped file to the file (msync).
+ * Return values:
+ *     0: success
+ *     1: wrong parameter, list is NULL or not in a region
+ *     2: msync failed
+ */
+int static_linked_listx_sync(void *list);
+
+/*
+ * Lock and unlock a list in a region against the other users of the region.
+ * Return values:
+ *     0: success
+ *     1: wrong parameter, list is NULL or not in a region
+ *     2: locking failed
+ *     3: lock acquired, but its previous owner died while holding it, the 
+ *        list may be inconsistent
+ */
+int static_linked_listx_lock(void *list);
+int static_linked_listx_unlock(void *list);
+
+/*
+ * Remove a named list created by static_linked_listx_open_shared. Handles 
+ * that are still open stay valid.
+ * Input parameters:
+ *     name: the name or path of the list
+ *     flags: STATIC_LINKED_LISTX_FILE if name is a file path
+ * Return values:
+ *     0: success
+ *     1: wrong parameter
+ *     2: unable to remove the object
+ */
+int static_linked_listx_destroy_shared(const char *name, int flags);
 	
 #ifdef __cplusplus
 }
@@ -0,0 +1,426 @@
+/*
+ * Benchmarks the message queue between processes. Measures the one-way
+ * latency with a ping-pong between two processes, as percentiles of the time
+ * from the send of a ping to its receive, and the throughput over a matrix of
+ * message sizes, queue lengths, and numbers of senders and receivers. Every
+ * test is run for the queue modes that fit it, with every wait type (blocked,
+ * try, timed), without and with CPU pinning. The results are printed as CSV,
+ * or as JSON with -j.
+ *
+ * Options:
+ *     -n msgs: the number of messages of each test (default 100000)
+ *     -w b|t|d: only the blocked, try or timed wait type
+ *     -l: only the latency tests
+ *     -t: only the throughput tests
+ *     -p: only with CPU pinning
+ *     -j: print JSON
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <signal.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <messageQx.h>
+#include <common_toolx.h>
+
+#define QNAME_PING "msgqx_bench_ping"
+#define QNAME_PONG "msgqx_bench_pong"
+#define MAX_MSG_SIZE 512
+#define WARMUP 1000
+
+// the head of every message
+struct bench_msg{
+	unsigned long long stamp; // latency: the ticks when it was sent
+	int stop; // throughput: the receiver stops
+};
+
+static const int sizes[] = {16, 64, 512};
+static const int qlens[] = {64, 1024};
+static const int workers[][2] = {{1, 1}, {1, 2}, {2, 1}, {2, 2}};
+static const int modes[] = {MSGQX_MODE_LOCKED, MSGQX_MODE_SPSC,
+			    MSGQX_MODE_MPMC};
+static const char *mode_names[] = {"locked", "spsc", "mpmc"};
+static const char *wait_names[] = {"blocked", "try", "timed"};
+
+#define ARRAY_LEN(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+static double ticks_per_ns = 1.0; // rdtsc ticks, see calibrate_rdtsc
+static int json;
+static int results;
+static int ncpus = 1;
+static cpu_set_t all_cpus; // the CPUs the benchmark may run on
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// pin the calling process to the cpu-th CPU it may run on, if pinning; a
+// negative cpu unpins it
+static void pin(int pinned, int cpu)
+{
+	cpu_set_t set;
+	int i, k = -1;
+
+	if(!pinned)
+		return;
+	if(cpu < 0)
+		set = all_cpus;
+	else{
+		CPU_ZERO(&set);
+		for(i = 0; i < CPU_SETSIZE; i++)
+			if(CPU_ISSET(i, &all_cpus) && ++k == cpu % ncpus)
+				break;
+		CPU_SET(i, &set);
+	}
+	if(sched_setaffinity(0, sizeof(set), &set) != 0)
+		perror("sched_setaffinity");
+}
+
+static int bench_send(void *h, void *msg, int wait_type)
+{
+	int ret_val;
+
+	switch(wait_type){
+	case 1:
+		while((ret_val = msgqx_trysend(h, msg)) == 4)
+			;
+		return ret_val;
+	case 2:
+		while((ret_val = msgqx_timedsend(h, msg, 0, 1000000)) == 5)
+			;
+		return ret_val;
+	default:
+		return msgqx_send(h, msg);
+	}
+}
+
+static int bench_receive(void *h, void *msg, int wait_type)
+{
+	int ret_val;
+
+	switch(wait_type){
+	case 1:
+		while((ret_val = msgqx_tryreceive(h, msg)) == 4)
+			;
+		return ret_val;
+	case 2:
+		while((ret_val = msgqx_timedreceive(h, msg, 0, 1000000)) == 5)
+			;
+		return ret_val;
+	default:
+		return msgqx_receive(h, msg);
+	}
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long*)a;
+	unsigned long long y = *(const unsigned long long*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+// the p-th percentile of n sorted samples, in nanoseconds
+static double percentile(unsigned long long *lat, int n, double p)
+{
+	int i = (int)(p / 100.0 * (n - 1) + 0.5);
+
+	return lat[i] / ticks_per_ns;
+}
+
+static void print_header(void)
+{
+	if(json)
+		printf("[\n");
+	else
+		printf("test,mode,wait,size,qlen,senders,receivers,pinned,msgs,"
+		       "msgs_per_sec,mb_per_sec,p50_ns,p90_ns,p99_ns,p999_ns,"
+		       "max_ns\n");
+	// not to be printed again by the children
+	fflush(stdout);
+}
+
+static void print_footer(void)
+{
+	if(json)
+		printf("\n]\n");
+}
+
+// print one result; latencies are not printed if lat is NULL, and the rates
+// are not printed if secs is 0
+static void print_result(const char *test, int mode, int wait_type, int size,
+			 int qlen, int senders, int receivers, int pinned,
+			 int msgs, double secs, unsigned long long *lat)
+{
+	double rate = secs > 0 ? msgs / secs : 0;
+	double p[5] = {0, 0, 0, 0, 0};
+
+	if(lat != NULL){
+		qsort(lat, msgs, sizeof(unsigned long long), cmp_ull);
+		p[0] = percentile(lat, msgs, 50);
+		p[1] = percentile(lat, msgs, 90);
+		p[2] = percentile(lat, msgs, 99);
+		p[3] = percentile(lat, msgs, 99.9);
+		p[4] = lat[msgs - 1] / ticks_per_ns;
+	}
+
+	if(json)
+		printf("%s  {\"test\": \"%s\", \"mode\": \"%s\", \"wait\": "
+		       "\"%s\", \"size\": %d, \"qlen\": %d, \"senders\": %d, "
+		       "\"receivers\": %d, \"pinned\": %d, \"msgs\": %d, "
+		       "\"msgs_per_sec\": %.0f, \"mb_per_sec\": %.2f, "
+		       "\"p50_ns\": %.0f, \"p90_ns\": %.0f, \"p99_ns\": %.0f, "
+		       "\"p999_ns\": %.0f, \"max_ns\": %.0f}",
+		       results ? ",\n" : "", test, mode_names[mode],
+		       wait_names[wait_type], size, qlen, senders, receivers,
+		       pinned, msgs, rate, rate * size / 1e6, p[0], p[1],
+		       p[2], p[3], p[4]);
+	else
+		printf("%s,%s,%s,%d,%d,%d,%d,%d,%d,%.0f,%.2f,%.0f,%.0f,%.0f,"
+		       "%.0f,%.0f\n", test, mode_names[mode],
+		       wait_names[wait_type], size, qlen, senders, receivers,
+		       pinned, msgs, rate, rate * size / 1e6, p[0], p[1],
+		       p[2], p[3], p[4]);
+	fflush(stdout);
+	results++;
+}
+
+static int create_queue(const char *name, int mode, int size, int qlen,
+			void **h)
+{
+	struct msgqx_attr attr;
+
+	msgqx_attr_init(&attr);
+	attr.mode = mode;
+	return msgqx_create_attr(name, size, qlen, &attr, h);
+}
+
+// one-way latency: a child receives the pings and stamps them, and sends
+// them back as pongs, so that one ping is in flight at a time
+static int bench_latency(int mode, int wait_type, int size, int pinned,
+			 int msgs)
+{
+	void *ping, *pong;
+	unsigned long long *lat;
+	unsigned char buf[MAX_MSG_SIZE] = {0};
+	struct bench_msg *m = (struct bench_msg*)buf;
+	int i, status, ret_val = 0;
+	pid_t pid;
+
+	// the samples are written by the child
+	lat = mmap(NULL, sizeof(unsigned long long) * msgs,
+		   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(lat == MAP_FAILED)
+		return 3;
+	if(create_queue(QNAME_PING, modes[mode], size, 64, &ping) ||
+	   create_queue(QNAME_PONG, modes[mode], size, 64, &pong)){
+		munmap(lat, sizeof(unsigned long long) * msgs);
+		return 3;
+	}
+
+	pid = fork();
+	if(pid == 0){
+		pin(pinned, 1);
+		for(i = 0; i < WARMUP + msgs; i++){
+			if(bench_receive(ping, buf, wait_type) != 0)
+				_exit(2);
+			if(i >= WARMUP)
+				lat[i - WARMUP] = rdtsc() - m->stamp;
+			if(bench_send(pong, buf, wait_type) != 0)
+				_exit(2);
+		}
+		_exit(0);
+	}
+
+	pin(pinned, 0);
+	for(i = 0; i < WARMUP + msgs && pid > 0; i++){
+		m->stamp = rdtsc();
+		if(bench_send(ping, buf, wait_type) != 0 ||
+		   bench_receive(pong, buf, wait_type) != 0){
+			ret_val = 2;
+			kill(pid, SIGKILL);
+			break;
+		}
+	}
+	if(pid < 0 || waitpid(pid, &status, 0) != pid ||
+	   !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		ret_val = 2;
+	pin(pinned, -1);
+	if(ret_val == 0)
+		print_result("latency", mode, wait_type, size, 64, 1, 1,
+			     pinned, msgs, 0, lat);
+
+	msgqx_close(ping);
+	msgqx_close(pong);
+	msgqx_destroy(QNAME_PING);
+	msgqx_destroy(QNAME_PONG);
+	munmap(lat, sizeof(unsigned long long) * msgs);
+	return ret_val;
+}
+
+// throughput: the senders share the messages and start together, and the
+// receivers stop at the stop messages sent after the last message
+static int bench_throughput(int mode, int wait_type, int size, int qlen,
+			    int senders, int receivers, int pinned, int msgs)
+{
+	void *h;
+	unsigned char buf[MAX_MSG_SIZE] = {0};
+	struct bench_msg *m = (struct bench_msg*)buf;
+	pid_t pids[4];
+	int i, k, n, status, nprocs = 0, ret_val = 0, go[2];
+	double start;
+
+	if(create_queue(QNAME_PING, modes[mode], size, qlen, &h))
+		return 3;
+	// the children wait until the write end of the pipe is closed
+	if(pipe(go) != 0){
+		msgqx_close(h);
+		msgqx_destroy(QNAME_PING);
+		return 3;
+	}
+
+	for(k = 0; k < senders + receivers; k++){
+		pids[k] = fork();
+		if(pids[k] < 0){
+			ret_val = 3;
+			break;
+		}
+		nprocs++;
+		if(pids[k] > 0)
+			continue;
+
+		close(go[1]);
+		pin(pinned, k);
+		if(read(go[0], buf, 1) != 0)
+			_exit(3);
+		if(k < senders){
+			n = msgs / senders + (k < msgs % senders);
+			for(i = 0; i < n; i++)
+				if(bench_send(h, buf, wait_type) != 0)
+					_exit(2);
+		}
+		else
+			do{
+				if(bench_receive(h, buf, wait_type) != 0)
+					_exit(2);
+			}while(!m->stop);
+		_exit(0);
+	}
+
+	close(go[0]);
+	start = now_sec();
+	close(go[1]);
+	for(k = 0; k < nprocs; k++){
+		// stop the receivers once the senders are done
+		if(k == senders)
+			for(i = 0; i < receivers && ret_val == 0; i++){
+				m->stop = 1;
+				if(bench_send(h, buf, wait_type) != 0)
+					ret_val = 2;
+			}
+		if(ret_val != 0)
+			kill(pids[k], SIGKILL);
+		if(waitpid(pids[k], &status, 0) != pids[k] ||
+		   !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			ret_val = 2;
+	}
+	if(ret_val == 0)
+		print_result("throughput", mode, wait_type, size, qlen, senders,
+			     receivers, pinned, msgs, now_sec() - start, NULL);
+
+	msgqx_close(h);
+	msgqx_destroy(QNAME_PING);
+	return ret_val;
+}
+
+int main(int argc, char **argv)
+{
+	int opt, msgs = 100000, only_wait = -1, latency = 1, throughput = 1;
+	int min_pin = 0, mode, wait_type, pinned, s, l, w, ret_val;
+	unsigned long long hz;
+
+	while((opt = getopt(argc, argv, "n:w:ltpj")) != -1){
+		switch(opt){
+		case 'n':
+			msgs = atoi(optarg);
+			break;
+		case 'w':
+			only_wait = optarg[0] == 't' ? 1 :
+				optarg[0] == 'd' ? 2 : 0;
+			break;
+		case 'l':
+			throughput = 0;
+			break;
+		case 't':
+			latency = 0;
+			break;
+		case 'p':
+			min_pin = 1;
+			break;
+		case 'j':
+			json = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n msgs] [-w b|t|d] [-l] "
+				"[-t] [-p] [-j]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(msgs <= 0){
+		fprintf(stderr, "the number of messages must be positive\n");
+		return 1;
+	}
+	if(sched_getaffinity(0, sizeof(all_cpus), &all_cpus) == 0)
+		ncpus = CPU_COUNT(&all_cpus);
+	calibrate_rdtsc(&hz);
+	ticks_per_ns = hz / 1e9;
+
+	print_header();
+	for(pinned = min_pin; pinned <= 1; pinned++)
+	for(wait_type = 0; wait_type < 3; wait_type++){
+		if(only_wait >= 0 && wait_type != only_wait)
+			continue;
+		for(mode = 0; mode < ARRAY_LEN(modes); mode++)
+		for(s = 0; s < ARRAY_LEN(sizes); s++){
+			if(latency){
+				ret_val = bench_latency(mode, wait_type,
+							sizes[s], pinned, msgs);
+				if(ret_val != 0)
+					fprintf(stderr, "latency test failed: "
+						"%d\n", ret_val);
+			}
+			if(!throughput)
+				continue;
+			for(l = 0; l < ARRAY_LEN(qlens); l++)
+			for(w = 0; w < ARRAY_LEN(workers); w++){
+				// one sender and one receiver at a time
+				if(modes[mode] == MSGQX_MODE_SPSC && w > 0)
+					continue;
+				ret_val = bench_throughput(mode, wait_type,
+							   sizes[s], qlens[l],
+							   workers[w][0],
+							   workers[w][1],
+							   pinned, msgs);
+				if(ret_val != 0)
+					fprintf(stderr, "throughput test failed:"
+						" %d\n", ret_val);
+			}
+		}
+	}
+	print_footer();
+
+	return 0;
+}
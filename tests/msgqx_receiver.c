@@ -1,7 +1,8 @@
  /*
  * Takes four interger parameters: whether to create the queue, the quene 
  * length, the wait type (blocked:0, try:1, timed:2), seconds to sleep 
- * between receives.
+ * between receives. An optional fifth parameter selects the mode of a created
+ * queue (locked:0, spsc:1, mpmc:2, var:3).
  */
 
 #include <stdio.h>
@@ -26,18 +27,21 @@ int main(int argc, char **argv)
 	int wait_type;
 	struct msgqx_data d;
 	int sleept;
+	struct msgqx_attr attr;
 
 	create = atoi(argv[1]);
 	qlen = atoi(argv[2]);
 	pid = getpid();
 	wait_type = atoi(argv[3]);
 	sleept = atoi(argv[4]);
+	msgqx_attr_init(&attr);
+	if(argc > 5)
+		attr.mode = atoi(argv[5]);
 
 	printf("New receiver with pid %d\n", pid);
 
 	if(create)
-		ret_val = msgqx_create(QNAME, size, qlen, 
-				       &h);
+		ret_val = msgqx_create_attr(QNAME, size, qlen, &attr, &h);
 	else
 		ret_val = msgqx_open(QNAME, &h, &size);
 
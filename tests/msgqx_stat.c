@@ -0,0 +1,112 @@
+/*
+ * Prints the statistics of a message queue. Takes the name of the queue, and
+ * optionally an interval in seconds and a count: the rates are then printed
+ * every interval, count times or until interrupted. With "-r" as the name of
+ * the queue, followed by the name, the statistics are reset instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include <messageQx.h>
+#include <common_toolx.h>
+
+// print the buckets of a wait-time histogram that are not empty
+static void print_hist(const char *side, unsigned long long *hist)
+{
+	int i;
+
+	for(i = 0; i < MSGQX_STAT_BUCKETS; i++){
+		if(hist[i] == 0)
+			continue;
+		if(i == MSGQX_STAT_BUCKETS - 1)
+			printf("  %s wait >= %llu us: %llu\n", side,
+			       1ULL << (i - 1), hist[i]);
+		else
+			printf("  %s wait < %llu us: %llu\n", side, 1ULL << i,
+			       hist[i]);
+	}
+}
+
+static void print_stats(struct msgqx_stats *st)
+{
+	printf("sent %llu, received %llu, depth %llu, max depth %llu\n",
+	       st->sent, st->received, st->depth, st->max_depth);
+	printf("senders waited %llu times, %llu us\n", st->send_waits,
+	       st->send_wait_us);
+	print_hist("send", st->send_hist);
+	printf("receivers waited %llu times, %llu us\n", st->recv_waits,
+	       st->recv_wait_us);
+	print_hist("recv", st->recv_hist);
+}
+
+// one line of rates over an interval of sec seconds
+static void print_rates(struct msgqx_stats *st, struct msgqx_stats *last,
+			int sec)
+{
+	printf("%8llu %8llu %10llu %10llu %10llu %10llu\n", st->depth,
+	       st->max_depth, (st->sent - last->sent) / sec,
+	       (st->received - last->received) / sec,
+	       (st->send_wait_us - last->send_wait_us) / sec / 1000,
+	       (st->recv_wait_us - last->recv_wait_us) / sec / 1000);
+}
+
+int main(int argc, char **argv)
+{
+	int ret_val, size, sec = 0, count = -1, reset = 0;
+	void *h;
+	struct msgqx_stats st, last;
+
+	if(argc > 2 && strcmp(argv[1], "-r") == 0){
+		reset = 1;
+		argv++;
+		argc--;
+	}
+	if(argc < 2){
+		printf("usage: %s [-r] name [interval [count]]\n", argv[0]);
+		return 1;
+	}
+	if(argc > 2)
+		sec = atoi(argv[2]);
+	if(argc > 3)
+		count = atoi(argv[3]);
+
+	ret_val = msgqx_open(argv[1], &h, &size);
+	if(ret_val != 0){
+		printf("cannot open queue %s: %d\n", argv[1], ret_val);
+		return ret_val;
+	}
+
+	if(reset)
+		ret_val = msgqx_reset_stats(h);
+	else if(sec <= 0){
+		ret_val = msgqx_get_stats(h, &st);
+		if(ret_val == 0)
+			print_stats(&st);
+	}
+	else{
+		ret_val = msgqx_get_stats(h, &last);
+		printf("%8s %8s %10s %10s %10s %10s\n", "depth", "max",
+		       "sent/s", "recv/s", "swait ms/s", "rwait ms/s");
+		while(ret_val == 0 && count != 0){
+			sleep(sec);
+			ret_val = msgqx_get_stats(h, &st);
+			if(ret_val != 0)
+				break;
+			print_rates(&st, &last, sec);
+			fflush(stdout);
+			last = st;
+			if(count > 0)
+				count--;
+		}
+	}
+	if(ret_val != 0)
+		printf("cannot read the statistics of %s: %d\n", argv[1],
+		       ret_val);
+
+	msgqx_close(h);
+	return ret_val;
+}
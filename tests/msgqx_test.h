@@ -0,0 +1,16 @@
+/*
+ * Common definitions of the messageQx sender and receiver tests.
+ */
+
+#ifndef __MSGQX_TEST_H__
+#define __MSGQX_TEST_H__
+
+#define QNAME "msgqx_test"
+
+struct msgqx_data{
+	int val; // the value sent
+	int pid; // the pid of the sender
+	int stop; // whether the receiver should stop
+};
+
+#endif
@@ -0,0 +1,205 @@
+/*
+ * Tester of static_linked_listx. Takes one integer parameter: the number of
+ * items to insert.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <static_linked_listx.h>
+#include <common_toolx.h>
+
+static int cmp_int(const void *a, const void *b)
+{
+	int x = *(const int*)a, y = *(const int*)b;
+
+	return (x > y) - (x < y);
+}
+
+// walk the list, check that it is sorted and has n items
+static int check_sorted(void *list, int n)
+{
+	int idx, cnt = 0, last = -1;
+	int *item;
+
+	static_linked_listx_get_first(list, &idx, (void**)&item);
+	while(item != NULL){
+		if(*item < last){
+			printf("list not sorted at %d\n", cnt);
+			return 1;
+		}
+		last = *item;
+		cnt++;
+		static_linked_listx_get_next(list, idx, &idx, (void**)&item);
+	}
+
+	if(cnt != n){
+		printf("wrong item count %d, expecting %d\n", cnt, n);
+		return 1;
+	}
+
+	return 0;
+}
+
+// create a named list, fill it under its lock, close it, then open it again
+// and find the items there without having saved them anywhere else
+static int check_shared(const char *name, int flags, int n)
+{
+	void *list;
+	int i;
+
+	static_linked_listx_destroy_shared(name, flags);
+	if(static_linked_listx_open_shared(&list, name, sizeof(int), n,
+					   flags | STATIC_LINKED_LISTX_CREATE)){
+		printf("cannot create shared list %s\n", name);
+		return 1;
+	}
+	if(static_linked_listx_lock(list)){
+		printf("cannot lock shared list %s\n", name);
+		return 1;
+	}
+	for(i = 0; i < n; i++)
+		static_linked_listx_push_back(list, &i, NULL);
+	if(static_linked_listx_unlock(list) || static_linked_listx_sync(list)){
+		printf("cannot unlock or sync shared list %s\n", name);
+		return 1;
+	}
+	static_linked_listx_free(list);
+
+	if(static_linked_listx_open_shared(&list, name, sizeof(long), 0, 
+					   flags) != 3 ||
+	   static_linked_listx_open_shared(&list, name, sizeof(int), 0, flags)){
+		printf("cannot reopen shared list %s\n", name);
+		return 1;
+	}
+	if(static_linked_listx_lock(list) || check_sorted(list, n) ||
+	   static_linked_listx_unlock(list))
+		return 1;
+	static_linked_listx_free(list);
+
+	if(static_linked_listx_destroy_shared(name, flags) ||
+	   static_linked_listx_open_shared(&list, name, sizeof(int), 0, 
+					   flags) != 2){
+		printf("cannot destroy shared list %s\n", name);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	void *list, *other, *region;
+	int i, n, val, idx, first, last;
+	int *item;
+
+	if(argc != 2){
+		printf("needs parameters");
+		exit(-1);
+	}
+	n = atoi(argv[1]);
+
+	static_linked_listx_init(&list, sizeof(int));
+	static_linked_listx_init(&other, sizeof(int));
+
+	/*
+	 * fill the list from both ends, then sort it
+	 */
+	for(i = 0; i < n; i++){
+		val = rand() % n;
+		if(i % 2)
+			static_linked_listx_push_back(list, &val, NULL);
+		else
+			static_linked_listx_push_front(list, &val, NULL);
+	}
+	static_linked_listx_sort(list, cmp_int);
+	if(check_sorted(list, n))
+		return 1;
+
+	/*
+	 * the smallest item moved to the back, and back to the front again
+	 */
+	static_linked_listx_get_first(list, &idx, (void**)&item);
+	static_linked_listx_move_to_back(list, idx);
+	static_linked_listx_move_to_front(list, idx);
+	static_linked_listx_get_first(list, &first, (void**)&item);
+	if(first != idx){
+		printf("move to front/back failed\n");
+		return 1;
+	}
+
+	/*
+	 * insert around the first item
+	 */
+	val = -1;
+	static_linked_listx_insert_before(list, idx, &val, NULL);
+	val = *item;
+	static_linked_listx_insert_after(list, idx, &val, NULL);
+	if(check_sorted(list, n + 2))
+		return 1;
+
+	/*
+	 * splice the first half to the other list, sort and splice it back
+	 */
+	static_linked_listx_get_first(list, &first, (void**)&item);
+	last = first;
+	for(i = 1; i < (n + 2) / 2; i++)
+		static_linked_listx_get_next(list, last, &last, (void**)&item);
+	static_linked_listx_splice(other, -1, list, first, last);
+	if(check_sorted(other, (n + 2) / 2) ||
+	   check_sorted(list, n + 2 - (n + 2) / 2))
+		return 1;
+	static_linked_listx_get_first(other, &first, (void**)&item);
+	last = ((struct static_linked_listx*)other)->hdr->tail;
+	static_linked_listx_splice(list, -1, other, first, last);
+	if(check_sorted(list, n + 2))
+		return 1;
+
+	/*
+	 * drain it as a queue
+	 */
+	for(i = 0; i < n + 2; i++)
+		if(static_linked_listx_pop_front(list, &val)){
+			printf("pop front failed at %d\n", i);
+			return 1;
+		}
+	if(static_linked_listx_pop_back(list, &val) != 2){
+		printf("list should be empty\n");
+		return 1;
+	}
+
+	static_linked_listx_free(list);
+	static_linked_listx_free(other);
+
+	/*
+	 * a list in a region: fill it up, attach a second handle and read the
+	 * items back through it
+	 */
+	region = malloc(static_linked_listx_region_size(sizeof(int), n));
+	static_linked_listx_init_region(&list, region, 
+		static_linked_listx_region_size(sizeof(int), n), sizeof(int), 1);
+	for(i = 0; i < n; i++)
+		static_linked_listx_push_back(list, &i, NULL);
+	if(static_linked_listx_push_back(list, &i, NULL) != 2){
+		printf("region list should be full\n");
+		return 1;
+	}
+	static_linked_listx_init_region(&other, region, 
+		static_linked_listx_region_size(sizeof(int), n), sizeof(int), 0);
+	if(check_sorted(other, n))
+		return 1;
+	static_linked_listx_free(list);
+	static_linked_listx_free(other);
+	free(region);
+
+	/*
+	 * lists in a shared memory object and in a file outlive their handles
+	 */
+	if(check_shared("/sllst_tester", 0, n) || 
+	   check_shared("./sllst_tester.list", STATIC_LINKED_LISTX_FILE, n))
+		return 1;
+
+	printf("static linked list passed with %d items\n", n);
+
+	return 0;
+}
@@ -1,8 +1,60 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include "common_toolx.h"
+#include "messageQx.h"
 #include "simple_hashx.h"
+#include "object_poolx.h"
+#include "timer_wheelx.h"
+#include "priority_queuex.h"
+#include "partition_queuex.h"
+
+static int timer_fired;
+static void timer_cb(void *arg)
+{
+	timer_fired += (int)(long)arg;
+}
+
+/* free every handle of pool_handles, racing another thread doing the same;
+   return the number of frees that succeeded */
+static void *pool;
+static unsigned long long *pool_handles;
+static int pool_n;
+static void * pool_freer(void *arg)
+{
+	long i, freed = 0;
+
+	for(i = 0; i < pool_n; i++)
+		freed += object_poolx_free(pool, pool_handles[i]) == 0;
+	return (void*)freed;
+}
+
+static int cmp_handle_idx(const void *a, const void *b)
+{
+	int x = OBJECT_POOLX_HANDLE_IDX(*(const unsigned long long*)a);
+	int y = OBJECT_POOLX_HANDLE_IDX(*(const unsigned long long*)b);
+
+	return (x > y) - (x < y);
+}
+
+/* receive private_n values in order from a private queue */
+static int private_n;
+static void * private_receiver(void *q)
+{
+	int i, val;
+
+	for(i = 0; i < private_n; i++)
+		if(msgqx_receive(q, &val) || val != i)
+			break;
+	msgqx_close(q);
+	return (void*)(long)(i != private_n);
+}
 
 int main(int argc, char ** argv)
 {  
@@ -116,6 +168,922 @@ int main(int argc, char ** argv)
 	  }
 	  
   }
+  else if(call_number == 5){
+	  int i, n, ret;
+	  unsigned long long *handles, stale;
+	  long long *obj;
+	  void *freed;
+	  pthread_t thread;
+
+	  n = atoi(argv[2]);
+	  handles = (unsigned long long*)malloc(n * sizeof(unsigned long long));
+
+	  ret = object_poolx_init(&pool, sizeof(long long), 16);
+	  if(ret != 0){
+		  printf("Init Error: %d\n", ret);
+		  return ret;
+	  }
+
+	  for(i = 0; i < n; i++){
+		  ret = object_poolx_alloc(pool, &handles[i], (void**)&obj);
+		  if(ret != 0){
+			  printf("Alloc Error %d\n", ret);
+			  return ret;
+		  }
+		  *obj = i;
+	  }
+
+	  for(i = 0; i < n; i++){
+		  ret = object_poolx_get(pool, handles[i], (void**)&obj);
+		  if(ret != 0 || *obj != i){
+			  printf("Wrong data: %d->%lld\n", i, *obj);
+			  return 4;
+		  }
+	  }
+
+	  /* a freed handle is stale, and its slot is the next one reused */
+	  stale = handles[n / 2];
+	  object_poolx_free(pool, stale);
+	  if(object_poolx_get(pool, stale, (void**)&obj) != 2 ||
+	     object_poolx_free(pool, stale) != 2){
+		  printf("Stale handle not detected\n");
+		  return 5;
+	  }
+	  object_poolx_alloc(pool, &handles[n / 2], (void**)&obj);
+	  if(OBJECT_POOLX_HANDLE_IDX(handles[n / 2]) != 
+	     OBJECT_POOLX_HANDLE_IDX(stale)){
+		  printf("Freed slot not reused first\n");
+		  return 6;
+	  }
+
+	  /* two threads free the same handles: every handle is freed once,
+	     and every slot is handed out once again */
+	  pool_handles = handles;
+	  pool_n = n;
+	  if(pthread_create(&thread, NULL, pool_freer, NULL)){
+		  printf("Thread Error\n");
+		  return 1;
+	  }
+	  ret = (int)(long)pool_freer(NULL);
+	  pthread_join(thread, &freed);
+	  if(ret + (int)(long)freed != n){
+		  printf("Double free not detected: %d frees\n", 
+			 ret + (int)(long)freed);
+		  return 5;
+	  }
+	  for(i = 0; i < n; i++)
+		  object_poolx_alloc(pool, &handles[i], (void**)&obj);
+	  qsort(handles, n, sizeof(unsigned long long), cmp_handle_idx);
+	  for(i = 1; i < n; i++)
+		  if(cmp_handle_idx(&handles[i - 1], &handles[i]) == 0){
+			  printf("Slot %d handed out twice\n", 
+				 OBJECT_POOLX_HANDLE_IDX(handles[i]));
+			  return 6;
+		  }
+
+	  for(i = 0; i < n; i++)
+		  object_poolx_free(pool, handles[i]);
+	  object_poolx_destroy(pool);
+	  free(handles);
+	  printf("object pool passed with %d objects\n", n);
+  }
+  else if(call_number == 6){
+	  int i, n, expired, total = 0;
+	  void *wheel = NULL;
+	  unsigned long long t, first = 0;
+
+	  n = atoi(argv[2]);
+	  timer_wheelx_init(&wheel, 1000);
+
+	  /* timer i expires at tick i + 1; every third one is cancelled */
+	  for(i = 0; i < n; i++){
+		  timer_wheelx_arm(wheel, (i + 1) * 1000ULL, timer_cb, 
+				   (void*)1L, &t);
+		  if(i == 0)
+			  first = t;
+		  if(i % 3 == 0 && timer_wheelx_cancel(wheel, t) != 0){
+			  printf("Cancel Error\n");
+			  return 1;
+		  }
+	  }
+	  if(timer_wheelx_cancel(wheel, first) != 2){
+		  printf("Stale timer not detected\n");
+		  return 2;
+	  }
+
+	  for(i = 0; i < n; i++){
+		  timer_wheelx_advance(wheel, 1, &expired);
+		  if(expired != (i % 3 != 0) || timer_fired != total + expired){
+			  printf("Wrong expiry at tick %d\n", i + 1);
+			  return 3;
+		  }
+		  total += expired;
+	  }
+	  timer_wheelx_free(wheel);
+	  printf("timer wheel passed with %d timers\n", n);
+  }
+  else if(call_number == 7){
+	  int i, n, val, cnt = 0;
+	  long long prio, last;
+	  void *pq = NULL;
+	  long long *prios;
+	  int *vals;
+	  unsigned long long *handles;
+
+	  n = atoi(argv[2]);
+	  prios = (long long*)malloc(n * sizeof(long long));
+	  vals = (int*)malloc(n * sizeof(int));
+	  handles = (unsigned long long*)malloc(n * sizeof(unsigned long long));
+	  priority_queuex_init(&pq, sizeof(int));
+
+	  /* half pushed one by one, half heapified; items equal priorities */
+	  for(i = 0; i < n; i++){
+		  prios[i] = vals[i] = (i * 7919) % n;
+		  if(i < n / 2)
+			  priority_queuex_push(pq, prios[i], &vals[i], 
+					       &handles[i]);
+	  }
+	  priority_queuex_heapify(pq, n - n / 2, prios + n / 2, vals + n / 2,
+				  handles + n / 2);
+
+	  /* cancel every fourth item, move every fourth+1 to the end */
+	  for(i = 0; i < n; i += 4)
+		  if(priority_queuex_cancel(pq, handles[i], NULL) != 0 ||
+		     priority_queuex_cancel(pq, handles[i], NULL) != 2){
+			  printf("Cancel Error\n");
+			  return 1;
+		  }
+	  for(i = 1; i < n; i += 4)
+		  priority_queuex_update(pq, handles[i], n + prios[i]);
+
+	  last = -1;
+	  while(priority_queuex_pop(pq, &prio, &val) == 0){
+		  if(prio < last || (prio < n && val != prio) ||
+		     (prio >= n && val != prio - n)){
+			  printf("Wrong order at priority %lld\n", prio);
+			  return 2;
+		  }
+		  last = prio;
+		  cnt++;
+	  }
+	  if(cnt != n - (n + 3) / 4){
+		  printf("Wrong item count %d\n", cnt);
+		  return 3;
+	  }
+	  priority_queuex_free(pq);
+	  free(prios);
+	  free(vals);
+	  free(handles);
+	  printf("priority queue passed with %d items\n", n);
+  }
+  else if(call_number == 8){
+	  int i, j, n, val, size, ret, mode, status, cnt, efd;
+	  int batch[7];
+	  unsigned long long dropped;
+	  void *q, *sq, *slot, *qs[3];
+	  char qname[32];
+	  pid_t pid;
+	  struct msgqx_attr attr;
+	  struct msgqx_stats st;
+	  pthread_t thread;
+
+	  n = atoi(argv[2]);
+	  for(mode = MSGQX_MODE_LOCKED; mode <= MSGQX_MODE_MPMC; mode++){
+		  msgqx_attr_init(&attr);
+		  attr.mode = mode;
+		  /* padded slots for the modes that copy runs of slots */
+		  if(mode == MSGQX_MODE_MPMC){
+			  attr.flags = MSGQX_HUGEPAGE | MSGQX_PREFAULT;
+			  attr.numa_node = 0;
+		  }
+		  else
+			  attr.flags = MSGQX_ALIGN_SLOTS;
+		  msgqx_destroy("ctx_test8");
+		  if(msgqx_create_attr("ctx_test8", sizeof(int), 16, &attr, 
+				       &q)){
+			  printf("Create Error in mode %d\n", mode);
+			  return 1;
+		  }
+
+		  /* a forked sender, rotating blocked, try and timed sends */
+		  pid = fork();
+		  if(pid == 0){
+			  if(msgqx_open("ctx_test8", &sq, &size) || 
+			     size != sizeof(int))
+				  exit(1);
+			  for(i = 0; i < n; i++){
+				  if(i % 3 == 1)
+					  while((ret = msgqx_trysend(sq, &i)) 
+						== 4)
+						  sched_yield();
+				  else if(i % 3 == 2)
+					  while((ret = msgqx_timedsend(sq, &i, 0,
+						1000000)) == 5)
+						  ;
+				  else
+					  ret = msgqx_send(sq, &i);
+				  if(ret)
+					  exit(2);
+			  }
+			  /* then the same numbers again, in batches */
+			  for(i = 0; i < n; i += cnt){
+				  for(j = 0; j < 7; j++)
+					  batch[j] = i + j;
+				  if(msgqx_send_batch(sq, batch, n - i < 7 ? 
+						      n - i : 7, &cnt))
+					  exit(3);
+			  }
+			  /* and once more, built in place */
+			  for(i = 0; i < n; i++){
+				  if(msgqx_reserve(sq, &slot))
+					  exit(4);
+				  *(int*)slot = i;
+				  if(msgqx_commit(sq))
+					  exit(4);
+			  }
+			  msgqx_close(sq);
+			  exit(0);
+		  }
+
+		  for(i = 0; i < n; i++){
+			  if(i % 3 == 1)
+				  while((ret = msgqx_tryreceive(q, &val)) == 4)
+					  sched_yield();
+			  else if(i % 3 == 2)
+				  while((ret = msgqx_timedreceive(q, &val, 0, 
+					1000000)) == 5)
+					  ;
+			  else
+				  ret = msgqx_receive(q, &val);
+			  if(ret || val != i){
+				  printf("Receive Error %d in mode %d at %d\n",
+					 ret, mode, i);
+				  return 2;
+			  }
+		  }
+		  for(i = 0; i < n; i += cnt){
+			  ret = msgqx_receive_batch(q, batch, n - i < 5 ? 
+						    n - i : 5, &cnt);
+			  for(j = 0; j < cnt; j++)
+				  if(batch[j] != i + j)
+					  ret = -1;
+			  if(ret || cnt < 1 || i + cnt > n){
+				  printf("Batch Error %d in mode %d at %d\n",
+					 ret, mode, i);
+				  return 2;
+			  }
+		  }
+		  for(i = 0; i < n; i++){
+			  ret = msgqx_peek(q, &slot);
+			  if(ret || *(int*)slot != i || msgqx_release(q)){
+				  printf("Peek Error %d in mode %d at %d\n",
+					 ret, mode, i);
+				  return 2;
+			  }
+		  }
+		  waitpid(pid, &status, 0);
+		  if(!WIFEXITED(status) || WEXITSTATUS(status)){
+			  printf("Send Error in mode %d\n", mode);
+			  return 3;
+		  }
+		  msgqx_close(q);
+		  msgqx_destroy("ctx_test8");
+	  }
+
+	  /* variable-length messages of 1 to 64 bytes, in a ring that only
+	     holds 4 of the largest ones */
+	  msgqx_attr_init(&attr);
+	  attr.mode = MSGQX_MODE_VAR;
+	  if(msgqx_create_attr("ctx_test8", 64, 4, &attr, &q)){
+		  printf("Create Error in variable-length mode\n");
+		  return 1;
+	  }
+	  pid = fork();
+	  if(pid == 0){
+		  unsigned char msg[64];
+
+		  if(msgqx_open("ctx_test8", &sq, &size) || size != 64)
+			  exit(1);
+		  for(i = 0; i < n; i++){
+			  memset(msg, i & 0xff, i % 64 + 1);
+			  if(msgqx_send_len(sq, msg, i % 64 + 1))
+				  exit(2);
+		  }
+		  msgqx_close(sq);
+		  exit(0);
+	  }
+	  for(i = 0; i < n; i++){
+		  unsigned char msg[64];
+
+		  /* a short buffer leaves the message in the queue */
+		  ret = msgqx_receive_len(q, msg, i % 64, &size);
+		  if(ret == 6 && size == i % 64 + 1)
+			  ret = msgqx_receive_len(q, msg, sizeof(msg), &size);
+		  else
+			  ret = -1;
+		  if(ret || size != i % 64 + 1 || 
+		     msg[size - 1] != (i & 0xff)){
+			  printf("Receive Error %d in variable-length mode at "
+				 "%d\n", ret, i);
+			  return 2;
+		  }
+	  }
+	  waitpid(pid, &status, 0);
+	  if(!WIFEXITED(status) || WEXITSTATUS(status)){
+		  printf("Send Error in variable-length mode\n");
+		  return 3;
+	  }
+	  msgqx_close(q);
+	  msgqx_destroy("ctx_test8");
+
+	  /* broadcast to two subscribers */
+	  for(mode = 0; mode < 2; mode++){
+		  void *sub[2];
+
+		  msgqx_attr_init(&attr);
+		  attr.mode = MSGQX_MODE_BCAST;
+		  attr.subscribers = 2;
+		  attr.flags = mode ? MSGQX_DROP_SLOW : 0;
+		  if(msgqx_create_attr("ctx_test8", sizeof(int), 16, &attr, 
+				       &q) ||
+		     msgqx_open("ctx_test8", &sub[0], &size) ||
+		     msgqx_open("ctx_test8", &sub[1], &size) ||
+		     msgqx_subscribe(sub[0]) || msgqx_subscribe(sub[1])){
+			  printf("Create Error in broadcast mode\n");
+			  return 1;
+		  }
+		  if(mode){
+			  /* fill the queue, let only the first subscriber
+			     catch up, and the next send drops the second */
+			  ret = 0;
+			  for(i = 0; i < 17; i++){
+				  if(msgqx_trysend(q, &i))
+					  ret = -1;
+				  if(i < 16 && (msgqx_receive(sub[0], &val) ||
+						val != i))
+					  ret = -1;
+			  }
+			  if(ret || msgqx_receive(sub[0], &val) || val != 16 ||
+			     msgqx_tryreceive(sub[1], &val) != 7 ||
+			     msgqx_subscribe(sub[1]) || msgqx_send(q, &i) ||
+			     msgqx_receive(sub[0], &val) || val != 17 ||
+			     msgqx_receive(sub[1], &val) || val != 17){
+				  printf("Drop Error in broadcast mode\n");
+				  return 3;
+			  }
+		  }
+		  else{
+			  pid = fork();
+			  if(pid == 0){
+				  for(i = 0; i < n; i++)
+					  if(msgqx_send(q, &i))
+						  exit(2);
+				  exit(0);
+			  }
+			  for(i = 0; i < n; i++){
+				  for(j = 0; j < 2; j++){
+					  ret = msgqx_receive(sub[j], &val);
+					  if(ret || val != i){
+						  printf("Receive Error %d in "
+							 "broadcast mode at "
+							 "%d\n", ret, i);
+						  return 2;
+					  }
+				  }
+			  }
+			  waitpid(pid, &status, 0);
+			  if(!WIFEXITED(status) || WEXITSTATUS(status)){
+				  printf("Send Error in broadcast mode\n");
+				  return 3;
+			  }
+		  }
+		  msgqx_close(sub[0]);
+		  msgqx_close(sub[1]);
+		  msgqx_close(q);
+		  msgqx_destroy("ctx_test8");
+	  }
+
+	  /* three lanes: strict priority, then a lane is served after it
+	     has been passed over twice */
+	  for(mode = 0; mode < 2; mode++){
+		  int lane, order[2][9] = {{0, 0, 0, 1, 1, 1, 2, 2, 2},
+					   {0, 0, 1, 2, 0, 1, 2, 1, 2}};
+
+		  msgqx_attr_init(&attr);
+		  attr.lanes = 3;
+		  attr.starve = mode ? 2 : 0;
+		  if(msgqx_create_attr("ctx_test8", sizeof(int), 4, &attr, 
+				       &q)){
+			  printf("Create Error with lanes\n");
+			  return 1;
+		  }
+		  for(i = 0; i < 9; i++)
+			  if(msgqx_trysend_lane(q, &i, 2 - i / 3)){
+				  printf("Send Error with lanes\n");
+				  return 3;
+			  }
+		  for(i = 0; i < 9; i++){
+			  ret = msgqx_tryreceive_lane(q, &val, &lane);
+			  if(ret || lane != order[mode][i] || 
+			     val / 3 != 2 - lane){
+				  printf("Receive Error %d with lanes at %d\n",
+					 ret, i);
+				  return 2;
+			  }
+		  }
+		  if(msgqx_trysend_lane(q, &i, 3) != 1){
+			  printf("Lane Error\n");
+			  return 2;
+		  }
+		  msgqx_close(q);
+		  msgqx_destroy("ctx_test8");
+	  }
+
+	  /* a lossy queue overwrites the oldest messages */
+	  msgqx_attr_init(&attr);
+	  attr.mode = MSGQX_MODE_LOSSY;
+	  if(msgqx_create_attr("ctx_test8", sizeof(int), 16, &attr, &q)){
+		  printf("Create Error in lossy mode\n");
+		  return 1;
+	  }
+	  for(i = 0; i < 40; i++)
+		  if(msgqx_trysend(q, &i)){
+			  printf("Send Error in lossy mode\n");
+			  return 3;
+		  }
+	  for(i = 24; i < 40; i++)
+		  if(msgqx_tryreceive(q, &val) || val != i){
+			  printf("Receive Error in lossy mode at %d\n", i);
+			  return 2;
+		  }
+	  if(msgqx_tryreceive(q, &val) != 4 || msgqx_dropped(q, &dropped) ||
+	     dropped != 24){
+		  printf("Drop Error in lossy mode\n");
+		  return 2;
+	  }
+	  /* a sender that never waits: every message is either received, in
+	     order, or dropped */
+	  pid = fork();
+	  if(pid == 0){
+		  for(i = 0; i < n; i++)
+			  if(msgqx_send(q, &i))
+				  exit(2);
+		  exit(0);
+	  }
+	  cnt = 0;
+	  for(j = -1; j < n - 1; j = val, cnt++)
+		  if(msgqx_receive(q, &val) || val <= j){
+			  printf("Receive Error in lossy mode after %d\n", j);
+			  return 2;
+		  }
+	  waitpid(pid, &status, 0);
+	  if(!WIFEXITED(status) || WEXITSTATUS(status) || 
+	     msgqx_dropped(q, &dropped) || cnt + dropped != 24 + n){
+		  printf("Send Error in lossy mode, %d received, %llu "
+			 "dropped\n", cnt, dropped);
+		  return 3;
+	  }
+	  msgqx_close(q);
+	  msgqx_destroy("ctx_test8");
+
+	  /* payloads in a pool of 4 buffers, only descriptors are sent */
+	  msgqx_attr_init(&attr);
+	  attr.mode = MSGQX_MODE_MPMC;
+	  if(msgqx_create_attr("ctx_test8", sizeof(struct msgqx_desc), 16, 
+			       &attr, &q) || 
+	     msgqx_pool_create("ctx_test8", 4096, 4, q)){
+		  printf("Create Error with payload pool\n");
+		  return 1;
+	  }
+	  pid = fork();
+	  if(pid == 0){
+		  struct msgqx_desc desc;
+
+		  if(msgqx_open("ctx_test8", &sq, &size) || 
+		     msgqx_pool_open("ctx_test8", sq))
+			  exit(1);
+		  for(i = 0; i < n; i++){
+			  if(msgqx_pool_alloc(sq, i % 4096 + 1, &desc, &slot))
+				  exit(2);
+			  memset(slot, i & 0xff, desc.len);
+			  /* one reference for the receiver, one for us */
+			  if(msgqx_pool_ref(sq, &desc, 1) || 
+			     msgqx_send(sq, &desc) || 
+			     msgqx_pool_free(sq, &desc))
+				  exit(3);
+		  }
+		  msgqx_close(sq);
+		  exit(0);
+	  }
+	  for(i = 0; i < n; i++){
+		  struct msgqx_desc desc;
+
+		  ret = msgqx_receive(q, &desc);
+		  if(ret == 0 && (desc.len != i % 4096 + 1 || 
+				  msgqx_pool_get(q, &desc, &slot) ||
+				  ((unsigned char*)slot)[desc.len - 1] != 
+				  (i & 0xff) ||
+				  msgqx_pool_free(q, &desc)))
+			  ret = -1;
+		  if(ret){
+			  printf("Receive Error %d with payload pool at %d\n",
+				 ret, i);
+			  return 2;
+		  }
+	  }
+	  waitpid(pid, &status, 0);
+	  if(!WIFEXITED(status) || WEXITSTATUS(status)){
+		  printf("Send Error with payload pool\n");
+		  return 3;
+	  }
+	  msgqx_close(q);
+	  msgqx_destroy("ctx_test8");
+
+	  /* a receiver polling the eventfd of the queue */
+	  if(msgqx_create("ctx_test8", sizeof(int), 16, &q) || 
+	     msgqx_event_create(q, &efd)){
+		  printf("Create Error with eventfd\n");
+		  return 1;
+	  }
+	  pid = fork();
+	  if(pid == 0){
+		  /* the eventfd is inherited */
+		  if(msgqx_open("ctx_test8", &sq, &size) || 
+		     msgqx_event_attach(sq, efd))
+			  exit(1);
+		  for(i = 0; i < n; i++)
+			  if(msgqx_send(sq, &i))
+				  exit(2);
+		  msgqx_close(sq);
+		  exit(0);
+	  }
+	  for(i = 0, cnt = 0; i < n; cnt++){
+		  struct pollfd pfd = {efd, POLLIN, 0};
+		  unsigned long long events;
+
+		  if(poll(&pfd, 1, 10000) != 1 || 
+		     read(efd, &events, sizeof(events)) != sizeof(events)){
+			  printf("Poll Error with eventfd at %d\n", i);
+			  return 2;
+		  }
+		  while((ret = msgqx_tryreceive(q, &val)) == 0)
+			  if(val != i++){
+				  printf("Receive Error with eventfd at %d\n",
+					 i);
+				  return 2;
+			  }
+		  if(ret != 4){
+			  printf("Receive Error %d with eventfd\n", ret);
+			  return 2;
+		  }
+	  }
+	  waitpid(pid, &status, 0);
+	  if(!WIFEXITED(status) || WEXITSTATUS(status)){
+		  printf("Send Error with eventfd\n");
+		  return 3;
+	  }
+	  msgqx_close(q);
+	  msgqx_destroy("ctx_test8");
+
+	  /* receive from any of three queues, taking turns */
+	  for(i = 0; i < 3; i++){
+		  sprintf(qname, "ctx_test8_%d", i);
+		  if(msgqx_create(qname, sizeof(int), 16, &qs[i])){
+			  printf("Create Error for any of queues\n");
+			  return 1;
+		  }
+	  }
+	  for(i = 0; i < 9; i++)
+		  if(msgqx_trysend(qs[i / 3], &i)){
+			  printf("Send Error to any of queues\n");
+			  return 3;
+		  }
+	  for(i = 0, j = -1; i < 9; i++)
+		  if(msgqx_tryreceive_any(qs, 3, &val, &j) || j != i % 3 ||
+		     val != j * 3 + i / 3){
+			  printf("Receive Error from any of queues at %d\n", i);
+			  return 2;
+		  }
+	  if(msgqx_timedreceive_any(qs, 3, &val, &j, 0, 1000000) != 5){
+		  printf("Timed Receive Error from any of queues\n");
+		  return 2;
+	  }
+	  pid = fork();
+	  if(pid == 0){
+		  for(i = 0; i < n; i++)
+			  if(msgqx_send(qs[i % 3], &i))
+				  exit(2);
+		  exit(0);
+	  }
+	  batch[0] = batch[1] = batch[2] = -1;
+	  for(i = 0; i < n; i++)
+		  if(msgqx_receive_any(qs, 3, &val, &j) || val % 3 != j ||
+		     val <= batch[j]){
+			  printf("Receive Error from any of queues at %d\n", i);
+			  return 2;
+		  }
+		  else
+			  batch[j] = val;
+	  waitpid(pid, &status, 0);
+	  if(!WIFEXITED(status) || WEXITSTATUS(status)){
+		  printf("Send Error to any of queues\n");
+		  return 3;
+	  }
+	  for(i = 0; i < 3; i++){
+		  sprintf(qname, "ctx_test8_%d", i);
+		  msgqx_close(qs[i]);
+		  msgqx_destroy(qname);
+	  }
+
+	  /* a sender coalescing up to 8 messages */
+	  if(msgqx_create("ctx_test8", sizeof(int), 16, &q) ||
+	     msgqx_set_coalesce(q, 8, 1000000)){
+		  printf("Create Error with coalescing\n");
+		  return 1;
+	  }
+	  for(i = 0; i < 9; i++){
+		  if(msgqx_trysend(q, &i) || 
+		     msgqx_tryreceive(q, &val) != (i == 7 ? 0 : 4)){
+			  printf("Coalescing Error at %d\n", i);
+			  return 3;
+		  }
+		  if(i == 7)
+			  for(j = 1; j < 8; j++)
+				  if(msgqx_tryreceive(q, &val) || val != j){
+					  printf("Flush Error at %d\n", j);
+					  return 2;
+				  }
+	  }
+	  if(msgqx_flush_timeout(q, &j) || j <= 0 || msgqx_flush(q) ||
+	     msgqx_tryreceive(q, &val) || val != 8 || 
+	     msgqx_flush_timeout(q, &j) || j != -1){
+		  printf("Flush Error\n");
+		  return 2;
+	  }
+	  pid = fork();
+	  if(pid == 0){
+		  if(msgqx_open("ctx_test8", &sq, &size) || 
+		     msgqx_set_coalesce(sq, 8, 100))
+			  exit(1);
+		  for(i = 0; i < n; i++)
+			  if(msgqx_send(sq, &i))
+				  exit(2);
+		  if(msgqx_flush(sq))
+			  exit(3);
+		  msgqx_close(sq);
+		  exit(0);
+	  }
+	  for(i = 0; i < n; i++)
+		  if(msgqx_receive(q, &val) || val != i){
+			  printf("Receive Error with coalescing at %d\n", i);
+			  return 2;
+		  }
+	  waitpid(pid, &status, 0);
+	  if(!WIFEXITED(status) || WEXITSTATUS(status)){
+		  printf("Send Error with coalescing\n");
+		  return 3;
+	  }
+	  msgqx_close(q);
+	  msgqx_destroy("ctx_test8");
+
+	  /* resize a queue while another handle uses it, after coalescing has
+	     been set up and turned off again; a queue named like a generation
+	     of it is in the way of nothing */
+	  if(msgqx_create("ctx_test8", sizeof(int), 4, &q) ||
+	     msgqx_open("ctx_test8", &sq, &size) ||
+	     msgqx_create("ctx_test8.1", sizeof(int), 4, &slot) ||
+	     msgqx_set_coalesce(q, 8, 100) || msgqx_set_coalesce(q, 0, 0)){
+		  printf("Create Error for resizing\n");
+		  return 1;
+	  }
+	  for(i = 0; i < 4; i++)
+		  msgqx_trysend(sq, &i);
+	  if(msgqx_resize(q, 2) != 4 || msgqx_resize(q, 16)){
+		  printf("Resize Error\n");
+		  return 2;
+	  }
+	  for(i = 4; i < 16; i++)
+		  if(msgqx_trysend(sq, &i)){
+			  printf("Send Error after resizing at %d\n", i);
+			  return 3;
+		  }
+	  for(i = 0; i < 16; i++)
+		  if(msgqx_tryreceive(q, &val) || val != i){
+			  printf("Receive Error after resizing at %d\n", i);
+			  return 2;
+		  }
+	  if(msgqx_resize(sq, 2) || msgqx_trysend(q, &i) || 
+	     msgqx_trysend(q, &i) || msgqx_trysend(q, &i) != 4){
+		  printf("Shrink Error\n");
+		  return 2;
+	  }
+	  msgqx_close(sq);
+	  msgqx_close(q);
+	  msgqx_close(slot);
+	  msgqx_destroy("ctx_test8");
+	  msgqx_destroy("ctx_test8.1");
+	  if(msgqx_create("ctx_test8_with_a_name_longer_than_"
+			  "MSGQX_MAX_NAME___", sizeof(int), 4, &q) != 1){
+		  printf("Create Error with a long name\n");
+		  return 1;
+	  }
+
+	  /* a journal of segments of 4 messages, read by two consumers, and 
+	     found again after the queue is gone */
+	  msgqx_attr_init(&attr);
+	  attr.mode = MSGQX_MODE_JOURNAL;
+	  attr.path = ".";
+	  attr.subscribers = 2;
+	  if(msgqx_create_attr("ctx_test8", sizeof(int), 4, &attr, &q) || 
+	     msgqx_open("ctx_test8", &sq, &size) || msgqx_consumer(q, 0) ||
+	     msgqx_consumer(sq, 1) || msgqx_set_coalesce(sq, 0, 0)){
+		  printf("Create Error with journal\n");
+		  return 1;
+	  }
+	  for(i = 0; i < 10; i++)
+		  if(msgqx_send(sq, &i)){
+			  printf("Send Error to journal\n");
+			  return 3;
+		  }
+	  for(i = 0; i < 10; i++)
+		  if(msgqx_receive(q, &val) || val != i ||
+		     (i < 5 && (msgqx_receive(sq, &val) || val != i))){
+			  printf("Receive Error from journal at %d\n", i);
+			  return 2;
+		  }
+	  /* segment 0 is passed by both consumers */
+	  if(msgqx_tryreceive(q, &val) != 4 || 
+	     access("./ctx_test8.0", F_OK) == 0 ||
+	     access("./ctx_test8.1", F_OK) != 0){
+		  printf("Trim Error in journal\n");
+		  return 2;
+	  }
+	  msgqx_close(sq);
+	  msgqx_close(q);
+	  msgqx_destroy("ctx_test8");
+	  if(msgqx_create_attr("ctx_test8", sizeof(int), 4, &attr, &q) || 
+	     msgqx_consumer(q, 1)){
+		  printf("Recover Error with journal\n");
+		  return 1;
+	  }
+	  for(i = 5; i < 10; i++)
+		  if(msgqx_receive(q, &val) || val != i){
+			  printf("Receive Error from journal at %d\n", i);
+			  return 2;
+		  }
+	  if(msgqx_tryreceive(q, &val) != 4 || 
+	     access("./ctx_test8.1", F_OK) == 0){
+		  printf("Trim Error in journal\n");
+		  return 2;
+	  }
+	  msgqx_close(q);
+	  msgqx_destroy("ctx_test8");
+	  unlink("./ctx_test8.2");
+	  unlink("./ctx_test8.meta");
+
+	  /* a private queue between two threads */
+	  msgqx_attr_init(&attr);
+	  attr.flags = MSGQX_PRIVATE;
+	  private_n = n;
+	  if(msgqx_create_attr(NULL, sizeof(int), 16, &attr, &q) ||
+	     msgqx_dup(q, &sq) || msgqx_open("ctx_test8", &slot, &size) != 3 ||
+	     msgqx_resize(q, 32) != 1 || 
+	     pthread_create(&thread, NULL, private_receiver, sq)){
+		  printf("Create Error with private queue\n");
+		  return 1;
+	  }
+	  for(i = 0; i < n; i++)
+		  if(msgqx_send(q, &i)){
+			  printf("Send Error to private queue\n");
+			  return 3;
+		  }
+	  if(pthread_join(thread, &slot) || slot != NULL){
+		  printf("Receive Error from private queue\n");
+		  return 2;
+	  }
+	  msgqx_close(q);
+
+	  /* the statistics count the messages, the depth and a wait */
+	  msgqx_attr_init(&attr);
+	  attr.flags = MSGQX_TRACK_DEPTH;
+	  if(msgqx_create_attr("ctx_test8", sizeof(int), 4, &attr, &q) || 
+	     msgqx_open("ctx_test8", &sq, &size)){
+		  printf("Create Error with statistics\n");
+		  return 1;
+	  }
+	  for(i = 0; i < 3; i++)
+		  msgqx_send(sq, &i);
+	  msgqx_receive(q, &val);
+	  if(msgqx_timedreceive(q, &val, 0, 0) ||
+	     msgqx_timedreceive(q, &val, 0, 0) ||
+	     msgqx_timedreceive(q, &val, 0, 1000) != 5 ||
+	     msgqx_get_stats(sq, &st) || st.sent != 3 || st.received != 3 ||
+	     st.depth != 0 || st.max_depth != 3 || st.send_waits != 0 ||
+	     st.recv_waits != 1){
+		  printf("Statistics Error\n");
+		  return 2;
+	  }
+	  for(i = 0, val = 0; i < MSGQX_STAT_BUCKETS; i++)
+		  val += st.recv_hist[i];
+	  if(val != 1 || msgqx_reset_stats(q) || msgqx_get_stats(q, &st) || 
+	     st.received != 0 || st.max_depth != 0){
+		  printf("Statistics Error\n");
+		  return 2;
+	  }
+	  msgqx_close(sq);
+	  msgqx_close(q);
+	  msgqx_destroy("ctx_test8");
+
+	  /* without MSGQX_TRACK_DEPTH, a sender waiting keeps the depth */
+	  if(msgqx_create("ctx_test8", sizeof(int), 4, &q)){
+		  printf("Create Error with statistics\n");
+		  return 1;
+	  }
+	  for(i = 0; i < 4; i++)
+		  msgqx_send(q, &i);
+	  if(msgqx_timedsend(q, &i, 0, 1000) != 5){
+		  printf("Send Error to a full queue\n");
+		  return 3;
+	  }
+	  for(i = 0; i < 4; i++)
+		  msgqx_receive(q, &val);
+	  if(msgqx_get_stats(q, &st) || st.depth != 0 || st.max_depth != 4 ||
+	     st.send_waits != 1){
+		  printf("Statistics Error\n");
+		  return 2;
+	  }
+	  msgqx_close(q);
+	  msgqx_destroy("ctx_test8");
+	  printf("message queue passed with %d messages, %d wakeups\n", n, 
+		 cnt);
+  }
+  else if(call_number == 9){
+	  int i, k, n, size, part, idle, ret, joined = 0, got[2] = {0, 0};
+	  void *pq, *c[2];
+	  long long msg[2], last[16];
+
+	  n = atoi(argv[2]);
+	  if(partition_queuex_create("ctx_test9", sizeof(msg), 64, 8, NULL, 
+				     &pq) ||
+	     partition_queuex_open("ctx_test9", &c[0], &size) ||
+	     partition_queuex_open("ctx_test9", &c[1], &size) ||
+	     size != sizeof(msg) || partition_queuex_join(c[0])){
+		  printf("Create Error with partitioned queue\n");
+		  return 1;
+	  }
+	  for(k = 0; k < 16; k++)
+		  last[k] = -1;
+
+	  /* 16 keys; a second consumer joins at n / 3 and leaves at 
+	     2n / 3, and the messages of every key come in order */
+	  for(i = 0; i < n; i++){
+		  msg[0] = i % 16;
+		  msg[1] = i / 16;
+		  if(partition_queuex_send(pq, msg[0], msg)){
+			  printf("Send Error to partitioned queue\n");
+			  return 3;
+		  }
+		  if(i == n / 3)
+			  joined = !partition_queuex_join(c[1]);
+		  if(i == 2 * n / 3)
+			  joined = partition_queuex_leave(c[1]);
+		  if(i % 32 != 31 && i != n - 1)
+			  continue;
+		  do{
+			  for(k = 0, idle = 0; k < 2; k++){
+				  if(k == 1 && !joined){
+					  idle++;
+					  continue;
+				  }
+				  ret = partition_queuex_tryreceive(c[k], msg, 
+								    &part);
+				  if(ret == 4){
+					  idle++;
+					  continue;
+				  }
+				  if(ret || part != 
+				     partition_queuex_partition(pq, msg[0]) ||
+				     msg[1] != last[msg[0]] + 1){
+					  printf("Receive Error from partitioned "
+						 "queue\n");
+					  return 2;
+				  }
+				  last[msg[0]] = msg[1];
+				  got[k]++;
+			  }
+		  }while(idle < 2);
+	  }
+	  if(got[0] + got[1] != n || (n >= 96 && got[1] == 0)){
+		  printf("Rebalance Error with partitioned queue\n");
+		  return 2;
+	  }
+	  partition_queuex_close(c[0]);
+	  partition_queuex_close(c[1]);
+	  partition_queuex_close(pq);
+	  partition_queuex_destroy("ctx_test9");
+	  printf("partitioned queue passed with %d messages, %d by the second "
+		 "consumer\n", n, got[1]);
+  }
 	  
       
   return 0;
@@ -0,0 +1,331 @@
+/*
+ * An implementation of a hierarchical timer wheel. See timer_wheelx.h for
+ * help.
+ *
+ * A timer expiring at tick "expires" is kept in level 0 if it expires within
+ * 256 ticks, at bucket (expires & 255). Otherwise, it is kept in the lowest
+ * level k whose range covers it, at bucket ((expires >> 8k) & 255). When the
+ * level 0 index wraps around, the current bucket of level 1 is cascaded, i.e.
+ * its timers are re-inserted according to the current tick; the same happens
+ * for higher levels. Timers only expire from level 0, where every timer of
+ * the current bucket expires at the current tick.
+ *
+ * Author: Wei Wang <wwang@virginia.edu>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timer_wheelx.h"
+#include "static_linked_listx.h"
+#include "common_toolx.h"
+
+#define TWX_LEVELS 4
+#define TWX_BITS 8
+#define TWX_SLOTS (1 << TWX_BITS)
+#define TWX_MASK (TWX_SLOTS - 1)
+
+/*
+ * the largest distance (in ticks) covered by the top level
+ */
+#define TWX_MAX_DELTA ((1ULL << (TWX_LEVELS * TWX_BITS)) - 1)
+
+struct twx_timer{
+	unsigned long long expires; // the tick to expire at
+	timer_wheelx_cb cb; // the callback
+	void *arg; // the argument of the callback
+	unsigned int gen; // generation of the timer, part of its handle
+	int bucket; // the bucket (chain) holding the timer
+};
+
+struct timer_wheelx{
+	void *timers; // static linked list holding struct twx_timer
+	struct sllst_chain buckets[TWX_LEVELS * TWX_SLOTS]; // the wheel
+	unsigned long long now; // the current tick
+	unsigned int tick_us; // the length of a tick in microseconds
+	unsigned int gen; // generation of the last armed timer
+	int count; // the number of armed timers
+	unsigned long long start_tsc; // rdtsc value of tick 0
+	unsigned long long cycles_per_tick; // rdtsc cycles per tick
+};
+
+/*
+ * Select the bucket of a timer expiring at tick expires
+ */
+static int _twx_bucket(struct timer_wheelx *wheel, unsigned long long expires)
+{
+	int level;
+	unsigned long long delta = expires - wheel->now;
+
+	if(delta > TWX_MAX_DELTA){
+		// out of the range of the wheel; park it in the farthest
+		// bucket of the top level, it will be cascaded again
+		expires = wheel->now + TWX_MAX_DELTA;
+		delta = TWX_MAX_DELTA;
+	}
+
+	for(level = 0; level < TWX_LEVELS - 1; level++)
+		if(delta < (1ULL << ((level + 1) * TWX_BITS)))
+			break;
+
+	return level * TWX_SLOTS +
+		(int)((expires >> (level * TWX_BITS)) & TWX_MASK);
+}
+
+/*
+ * Re-insert all timers of a bucket according to the current tick
+ */
+static void _twx_cascade(struct timer_wheelx *wheel, int level)
+{
+	int idx, bucket;
+	struct sllst_chain pending;
+	struct twx_timer *t;
+
+	bucket = level * TWX_SLOTS +
+		(int)((wheel->now >> (level * TWX_BITS)) & TWX_MASK);
+
+	static_linked_listx_chain_init(&pending);
+	static_linked_listx_chain_take(wheel->timers, &wheel->buckets[bucket],
+				       &pending);
+
+	while(pending.head != -1){
+		idx = pending.head;
+		static_linked_listx_get_item(wheel->timers, idx, (void**)&t);
+		t->bucket = _twx_bucket(wheel, t->expires);
+		static_linked_listx_chain_move(wheel->timers, &pending,
+					       &wheel->buckets[t->bucket], idx);
+	}
+}
+
+/*
+ * Advance the wheel by one tick, and expire the timers of the new tick
+ */
+static int _twx_tick(struct timer_wheelx *wheel)
+{
+	int level, idx, expired = 0;
+	struct sllst_chain *b;
+	struct twx_timer *t;
+	timer_wheelx_cb cb;
+	void *arg;
+
+	wheel->now++;
+
+	/*
+	 * cascade the levels whose lower levels all wrapped around
+	 */
+	for(level = 1; level < TWX_LEVELS; level++)
+		if((wheel->now >> ((level - 1) * TWX_BITS)) & TWX_MASK)
+			break;
+	for(level--; level > 0; level--)
+		_twx_cascade(wheel, level);
+
+	/*
+	 * every timer in the current level 0 bucket expires now. Callbacks
+	 * can only arm timers into other buckets, but they may cancel the
+	 * timers of this bucket, so always take the current head.
+	 */
+	b = &wheel->buckets[wheel->now & TWX_MASK];
+	while(b->head != -1){
+		idx = b->head;
+		static_linked_listx_get_item(wheel->timers, idx, (void**)&t);
+		cb = t->cb;
+		arg = t->arg;
+		static_linked_listx_chain_remove(wheel->timers, b, idx);
+		wheel->count--;
+		expired++;
+
+		cb(arg);
+	}
+
+	return expired;
+}
+
+/*
+ * initialize a timer wheel
+ */
+int timer_wheelx_init(void **w, unsigned int tick_us)
+{
+	int i;
+	unsigned long long hz;
+	struct timer_wheelx *wheel;
+
+	if(w == NULL || tick_us == 0){
+		CTX_LOGERR("wrong parameters: wheel (%p) and tick_us (%u)\n",
+			   w, tick_us);
+		return 1;
+	}
+	*w = NULL;
+
+	wheel = (struct timer_wheelx*)calloc(1, sizeof(struct timer_wheelx));
+	if(wheel == NULL)
+		return 2;
+	if(static_linked_listx_init(&wheel->timers, sizeof(struct twx_timer))){
+		free(wheel);
+		return 2;
+	}
+	for(i = 0; i < TWX_LEVELS * TWX_SLOTS; i++)
+		static_linked_listx_chain_init(&wheel->buckets[i]);
+
+	calibrate_rdtsc(&hz);
+	wheel->tick_us = tick_us;
+	wheel->cycles_per_tick = (unsigned long long)
+		((double)hz * tick_us / 1000000.0);
+	if(wheel->cycles_per_tick == 0)
+		wheel->cycles_per_tick = 1;
+	wheel->start_tsc = rdtsc();
+
+	*w = (void*)wheel;
+	return 0;
+}
+
+/*
+ * arm a timer
+ */
+int timer_wheelx_arm(void *w, unsigned long long timeout_us,
+		     timer_wheelx_cb cb, void *arg, unsigned long long *timer)
+{
+	int idx;
+	unsigned long long ticks;
+	struct twx_timer t;
+	struct timer_wheelx *wheel = (struct timer_wheelx*)w;
+
+	if(wheel == NULL || cb == NULL){
+		CTX_LOGERR("wrong parameters: wheel (%p) and cb (%p)\n", wheel,
+			   cb);
+		return 1;
+	}
+
+	ticks = (timeout_us + wheel->tick_us - 1) / wheel->tick_us;
+	if(ticks == 0)
+		ticks = 1;
+
+	if(++wheel->gen == 0)
+		wheel->gen = 1;
+	t.expires = wheel->now + ticks;
+	t.cb = cb;
+	t.arg = arg;
+	t.gen = wheel->gen;
+	t.bucket = _twx_bucket(wheel, t.expires);
+
+	if(static_linked_listx_chain_insert(wheel->timers,
+					    &wheel->buckets[t.bucket], &t,
+					    &idx))
+		return 2;
+	wheel->count++;
+
+	if(timer != NULL)
+		*timer = ((unsigned long long)t.gen << 32) | (unsigned int)idx;
+
+	return 0;
+}
+
+/*
+ * cancel a timer
+ */
+int timer_wheelx_cancel(void *w, unsigned long long timer)
+{
+	int idx = (int)(timer & 0xffffffffULL);
+	struct twx_timer *t;
+	struct timer_wheelx *wheel = (struct timer_wheelx*)w;
+
+	if(wheel == NULL){
+		CTX_LOGERR("wrong parameters: wheel (%p)\n", wheel);
+		return 1;
+	}
+
+	if(static_linked_listx_get_item(wheel->timers, idx, (void**)&t) ||
+	   t->gen != (unsigned int)(timer >> 32))
+		return 2;
+
+	static_linked_listx_chain_remove(wheel->timers,
+					 &wheel->buckets[t->bucket], idx);
+	wheel->count--;
+
+	return 0;
+}
+
+/*
+ * advance the wheel by nticks
+ */
+int timer_wheelx_advance(void *w, unsigned long long nticks, int *expired)
+{
+	int cnt = 0;
+	struct timer_wheelx *wheel = (struct timer_wheelx*)w;
+
+	if(wheel == NULL){
+		CTX_LOGERR("wrong parameters: wheel (%p)\n", wheel);
+		return 1;
+	}
+
+	while(nticks > 0){
+		if(wheel->count == 0){
+			// nothing to expire or cascade, jump to the end
+			wheel->now += nticks;
+			break;
+		}
+		cnt += _twx_tick(wheel);
+		nticks--;
+	}
+
+	if(expired != NULL)
+		*expired = cnt;
+
+	return 0;
+}
+
+/*
+ * advance the wheel to the current time
+ */
+int timer_wheelx_run(void *w, int *expired)
+{
+	unsigned long long target;
+	struct timer_wheelx *wheel = (struct timer_wheelx*)w;
+
+	if(wheel == NULL){
+		CTX_LOGERR("wrong parameters: wheel (%p)\n", wheel);
+		return 1;
+	}
+
+	target = (rdtsc() - wheel->start_tsc) / wheel->cycles_per_tick;
+	if(target <= wheel->now){
+		if(expired != NULL)
+			*expired = 0;
+		return 0;
+	}
+
+	return timer_wheelx_advance(w, target - wheel->now, expired);
+}
+
+/*
+ * return the number of armed timers
+ */
+int timer_wheelx_count(void *w, int *count)
+{
+	struct timer_wheelx *wheel = (struct timer_wheelx*)w;
+
+	if(wheel == NULL || count == NULL)
+		return 1;
+
+	*count = wheel->count;
+
+	return 0;
+}
+
+/*
+ * free a timer wheel
+ */
+int timer_wheelx_free(void *w)
+{
+	struct timer_wheelx *wheel = (struct timer_wheelx*)w;
+
+	if(wheel == NULL){
+		CTX_LOGERR("wrong parameters: wheel (%p)\n", wheel);
+		return 1;
+	}
+
+	static_linked_listx_free(wheel->timers);
+	free(wheel);
+
+	return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * A hierarchical timer wheel. Timers are kept in the storage of one static
+ * linked list, and every bucket of the wheel is a chain of that list, so
+ * arming and cancelling a timer are O(1), and a timer keeps its index while it
+ * cascades down the wheel. The wheel has four levels of 256 buckets; level 0
+ * has one bucket per tick, and every higher level is 256 times coarser.
+ *
+ * The wheel is driven either by the calibrated rdtsc clock
+ * (timer_wheelx_run), or by the caller (timer_wheelx_advance). It is not
+ * thread-safe.
+ *
+ * Author: Wei Wang <wwang@virginia.edu>
+ */
+
+#ifndef __COMMON_TOOLX_TIMER_WHEELX_H__
+#define __COMMON_TOOLX_TIMER_WHEELX_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A timer handle is the index of the timer in the lower 32 bits and a
+ * generation in the higher 32 bits, so the handle of a timer that has
+ * expired or been cancelled is detected as stale.
+ */
+#define TIMER_WHEELX_NULL_HANDLE 0ULL
+
+/*
+ * The expiry callback. It may arm and cancel timers, but must not call
+ * timer_wheelx_run or timer_wheelx_advance.
+ */
+typedef void (*timer_wheelx_cb)(void *arg);
+
+/*
+ * Initialize a timer wheel.
+ * Input parameters:
+ *     tick_us: the length of a tick in microseconds
+ * Output parameters:
+ *     wheel: the handle to the wheel
+ * Return values:
+ *     0: success
+ *     1: wrong parameter, wheel is NULL or tick_us is 0
+ *     2: unable to allocate space
+ */
+int timer_wheelx_init(void **wheel, unsigned int tick_us);
+
+/*
+ * Arm a timer. The timer expires after at least timeout_us microseconds,
+ * rounded up to whole ticks (at least one tick), counted from the tick the
+ * wheel was last advanced to. Timeouts longer than 2^32 ticks are 
+ * supported, but they cascade through the top level more than once.
+ * Input parameters:
+ *     wheel: the timer wheel
+ *     timeout_us: the timeout in microseconds
+ *     cb: the callback to call when the timer expires
+ *     arg: the argument of the callback
+ * Output parameters:
+ *     timer: the handle to the timer, can be NULL
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ *     2: unable to allocate space
+ */
+int timer_wheelx_arm(void *wheel, unsigned long long timeout_us,
+		     timer_wheelx_cb cb, void *arg, unsigned long long *timer);
+
+/*
+ * Cancel a timer.
+ * Input parameters:
+ *     wheel: the timer wheel
+ *     timer: the handle to the timer
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ *     2: stale handle, the timer has expired or been cancelled
+ */
+int timer_wheelx_cancel(void *wheel, unsigned long long timer);
+
+/*
+ * Advance the wheel by nticks ticks, or to the current time of the rdtsc
+ * clock, and call the callbacks of all expired timers. The timers of a tick
+ * are detached from their bucket as a batch, and their callbacks are called
+ * in the order the timers were armed.
+ * Input parameters:
+ *     wheel: the timer wheel
+ *     nticks: the number of ticks to advance
+ * Output parameters:
+ *     expired: the number of expired timers, can be NULL
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ */
+int timer_wheelx_advance(void *wheel, unsigned long long nticks,
+			 int *expired);
+int timer_wheelx_run(void *wheel, int *expired);
+
+/*
+ * Return the number of armed timers.
+ * Return values:
+ *     0: success
+ *     1: wrong parameters
+ */
+int timer_wheelx_count(void *wheel, int *count);
+
+/*
+ * Free a timer wheel. Armed timers are dropped without calling their
+ * callbacks.
+ * Return values:
+ *     0: success
+ *     1: wrong parameter, wheel is NULL
+ */
+int timer_wheelx_free(void *wheel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif